@@ -23,6 +23,7 @@ AC_PROG_LIBTOOL
 AC_HEADER_STDC
 AC_HEADER_DIRENT
 AC_DECL_SYS_SIGLIST
+AC_CHECK_HEADERS([ucontext.h])
 
 # Checks for typedefs, structures, and compiler characteristics.
 AC_C_CONST
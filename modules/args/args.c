@@ -89,6 +89,19 @@ static int compare_entry_name(void const *in, void const *find)
 	return (strcmp(entry->name, name)) ? NOMATCH : MATCH;
 }
 
+static void const *key_entry_name(void const *in)
+{
+	args_entry_t const *entry = in;
+	return entry->name;
+}
+
+/* section tables are indexed by entry name */
+static ratt_table_hash_t const l_sectab_hash = {
+	.key = key_entry_name,
+	.hash = ratt_table_hash_string,
+	.compare = compare_entry_name,
+};
+
 static int constrains_on_entry(void const *in, void const *find)
 {
 	args_entry_t const *entry = find;
@@ -142,10 +155,10 @@ static int create_section(ratt_table_t *table)
 {
 	int retval;
 
-	retval = ratt_table_create(table, ARGSSECTABSIZ,
-	    sizeof(args_entry_t), 0);
+	retval = ratt_table_create_hashed(table, ARGSSECTABSIZ,
+	    sizeof(args_entry_t), 0, &l_sectab_hash);
 	if (retval != OK) {
-		debug("ratt_table_create() failed");
+		debug("ratt_table_create_hashed() failed");
 		return FAIL;
 	}
 
@@ -0,0 +1,142 @@
+#ifndef RATT_DATA_ALLOC_H
+#define RATT_DATA_ALLOC_H
+
+/* alignment of every block handed out by arenas and slabs */
+#ifndef RATTALLOCALIGN
+#define RATTALLOCALIGN		16
+#endif
+
+/* default arena block size */
+#ifndef RATTARENABLKSIZ
+#define RATTARENABLKSIZ		(64 * 1024)
+#endif
+
+/* slab size classes, as powers of two; larger blocks go to malloc() */
+#ifndef RATTSLABCLSMIN
+#define RATTSLABCLSMIN		4
+#endif
+
+#ifndef RATTSLABCLSMAX
+#define RATTSLABCLSMAX		12
+#endif
+
+#define RATTSLABCLSCNT		(RATTSLABCLSMAX - RATTSLABCLSMIN + 1)
+
+/* slab page size; must hold at least one block of the largest class */
+#ifndef RATTSLABPAGESIZ
+#define RATTSLABPAGESIZ		(64 * 1024)
+#endif
+
+/*
+ * allocator information
+ *
+ * Tables and module cores may be given an allocator in place of the
+ * C library; a NULL allocator stands for malloc(), realloc() and free().
+ * Callers always pass the size of the block back, so implementations
+ * need not keep it in a header.
+ */
+struct ratt_alloc {
+	void *(*alloc)(void *, size_t);
+	void *(*realloc)(void *, void *, size_t, size_t);
+	void (*free)(void *, void *, size_t);
+	void *ctx;		/* allocator context */
+};
+
+typedef struct ratt_alloc ratt_alloc_t;
+
+/*
+ * arena information
+ *
+ * An arena bumps a pointer through large blocks; freeing a single block
+ * does nothing but the whole arena is released at once by
+ * ratt_arena_reset() or ratt_arena_destroy(). Not thread safe.
+ */
+struct ratt_arena_block;
+
+struct ratt_arena {
+	ratt_alloc_t alloc;	/* interface, context is the arena */
+	struct ratt_arena_block *block;	/* current block first */
+	size_t block_size;	/* default block size */
+	void *last;		/* last block handed out */
+};
+
+typedef struct ratt_arena ratt_arena_t;
+
+/*
+ * slab information
+ *
+ * A slab rounds every request up to a power of two size class and keeps
+ * a free list per class, carving new blocks out of pages; requests over
+ * the largest class go to malloc(). Everything is released at once by
+ * ratt_slab_destroy(). Not thread safe.
+ */
+struct ratt_slab_page;
+
+struct ratt_slab {
+	ratt_alloc_t alloc;	/* interface, context is the slab */
+	void *free_list[RATTSLABCLSCNT];	/* free blocks per class */
+	struct ratt_slab_page *page;	/* pages and large blocks */
+};
+
+typedef struct ratt_slab ratt_slab_t;
+
+static inline
+ratt_alloc_t const *ratt_arena_alloc(ratt_arena_t *arena)
+{
+	return &(arena->alloc);
+}
+
+static inline
+ratt_alloc_t const *ratt_slab_alloc(ratt_slab_t *slab)
+{
+	return &(slab->alloc);
+}
+
+static inline
+void *ratt_mem_alloc(ratt_alloc_t const *alloc, size_t size)
+{
+	return (alloc) ? alloc->alloc(alloc->ctx, size) : malloc(size);
+}
+
+static inline
+void *ratt_mem_calloc(ratt_alloc_t const *alloc, size_t cnt, size_t size)
+{
+	void *ptr = NULL;
+
+	if (!alloc)
+		return calloc(cnt, size);
+	if (size && cnt > ((size_t) -1) / size)
+		return NULL;
+
+	ptr = alloc->alloc(alloc->ctx, cnt * size);
+	if (ptr)
+		memset(ptr, 0, cnt * size);
+	return ptr;
+}
+
+static inline
+void *ratt_mem_realloc(ratt_alloc_t const *alloc, void *ptr,
+                       size_t old, size_t size)
+{
+	return (alloc) ? alloc->realloc(alloc->ctx, ptr, old, size)
+	    : realloc(ptr, size);
+}
+
+static inline
+void ratt_mem_free(ratt_alloc_t const *alloc, void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	if (alloc)
+		alloc->free(alloc->ctx, ptr, size);
+	else
+		free(ptr);
+}
+
+extern int ratt_arena_create(ratt_arena_t *, size_t);
+extern void ratt_arena_reset(ratt_arena_t *);
+extern void ratt_arena_destroy(ratt_arena_t *);
+extern int ratt_slab_create(ratt_slab_t *);
+extern void ratt_slab_destroy(ratt_slab_t *);
+
+#endif /* RATT_DATA_ALLOC_H */
@@ -0,0 +1,374 @@
+/*
+ * RATTLE allocator helper
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <rattle.h>
+#include <rattle/alloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define align_up(size) \
+	(((size) + RATTALLOCALIGN - 1) & ~((size_t) RATTALLOCALIGN - 1))
+
+/*
+ * Arena blocks are chained from the current one, which is the only one
+ * still bumped; blocks larger than the default size are chained behind
+ * it so that it keeps serving small requests. The last block handed out
+ * can grow or be given back in place, which suits a table growing
+ * alone in its arena.
+ */
+struct ratt_arena_block {
+	struct ratt_arena_block *next;	/* next block */
+	size_t size, used;	/* block size and bytes handed out */
+};
+
+#define ARENA_BLKHDR	align_up(sizeof(struct ratt_arena_block))
+#define arena_data(blk)	((char *) (blk) + ARENA_BLKHDR)
+
+static struct ratt_arena_block *arena_block_new(size_t size)
+{
+	struct ratt_arena_block *blk = NULL;
+
+	blk = malloc(ARENA_BLKHDR + size);
+	if (!blk) {
+		debug("malloc() failed");
+		return NULL;
+	}
+	blk->next = NULL;
+	blk->size = size;
+	blk->used = 0;
+	return blk;
+}
+
+static void *arena_alloc(void *ctx, size_t size)
+{
+	ratt_arena_t *arena = ctx;
+	struct ratt_arena_block *blk = arena->block;
+	void *ptr = NULL;
+
+	size = (size) ? align_up(size) : RATTALLOCALIGN;
+
+	if (blk && blk->size - blk->used >= size) {
+		ptr = arena_data(blk) + blk->used;
+		blk->used += size;
+		arena->last = ptr;
+		return ptr;
+	}
+
+	if (size > arena->block_size) {	/* dedicated block */
+		blk = arena_block_new(size);
+		if (!blk)
+			return NULL;
+		blk->used = size;
+		if (arena->block) {
+			blk->next = arena->block->next;
+			arena->block->next = blk;
+		} else
+			arena->block = blk;
+		return arena_data(blk);
+	}
+
+	blk = arena_block_new(arena->block_size);
+	if (!blk)
+		return NULL;
+	blk->next = arena->block;
+	arena->block = blk;
+
+	debug("arena at %p took a new block at %p", arena, blk);
+
+	blk->used = size;
+	arena->last = arena_data(blk);
+	return arena->last;
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t old, size_t size)
+{
+	ratt_arena_t *arena = ctx;
+	struct ratt_arena_block *blk = arena->block;
+	void *newptr = NULL;
+	size_t off;
+
+	if (!ptr)
+		return arena_alloc(ctx, size);
+	else if (size <= old)
+		return ptr;
+
+	if (ptr == arena->last) {	/* try growing in place */
+		off = (char *) ptr - arena_data(blk);
+		if (blk->size - off >= align_up(size)) {
+			blk->used = off + align_up(size);
+			return ptr;
+		}
+	}
+
+	newptr = arena_alloc(ctx, size);
+	if (newptr)
+		memcpy(newptr, ptr, old);
+	return newptr;
+}
+
+static void arena_free(void *ctx, void *ptr, size_t size)
+{
+	ratt_arena_t *arena = ctx;
+
+	/* only the last block goes back, the rest waits for a reset */
+	if (ptr == arena->last) {
+		arena->block->used = (char *) ptr - arena_data(arena->block);
+		arena->last = NULL;
+	}
+}
+
+int ratt_arena_create(ratt_arena_t *arena, size_t block_size)
+{
+	RATTLOG_TRACE();
+
+	memset(arena, 0, sizeof(ratt_arena_t));
+
+	arena->block_size = (block_size) ? align_up(block_size)
+	    : RATTARENABLKSIZ;
+	arena->alloc.alloc = arena_alloc;
+	arena->alloc.realloc = arena_realloc;
+	arena->alloc.free = arena_free;
+	arena->alloc.ctx = arena;
+
+	debug("created arena at %p with blocks of %u bytes",
+	    arena, arena->block_size);
+	return OK;
+}
+
+void ratt_arena_reset(ratt_arena_t *arena)
+{
+	struct ratt_arena_block *blk = NULL, *next = NULL, *keep = NULL;
+
+	RATTLOG_TRACE();
+
+	/* keep the current block if it is a default one, free the rest */
+	blk = arena->block;
+	if (blk && blk->size == arena->block_size) {
+		keep = blk;
+		blk = blk->next;
+		keep->next = NULL;
+		keep->used = 0;
+	}
+
+	for (; blk; blk = next) {
+		next = blk->next;
+		free(blk);
+	}
+
+	arena->block = keep;
+	arena->last = NULL;
+}
+
+void ratt_arena_destroy(ratt_arena_t *arena)
+{
+	RATTLOG_TRACE();
+
+	ratt_arena_reset(arena);
+	free(arena->block);
+	debug("destroyed arena at %p", arena);
+	memset(arena, 0, sizeof(ratt_arena_t));
+}
+
+/*
+ * Slab pages and large blocks share one doubly linked list so that a
+ * large block can be unlinked when freed and everything else released
+ * at once by ratt_slab_destroy(). Small blocks are never given back to
+ * the system before then; they wait on the free list of their class,
+ * linked through their first word.
+ */
+struct ratt_slab_page {
+	struct ratt_slab_page *next, *prev;	/* page list */
+};
+
+#define SLAB_PAGEHDR	align_up(sizeof(struct ratt_slab_page))
+#define slab_data(page)	((char *) (page) + SLAB_PAGEHDR)
+#define slab_page(ptr)	((struct ratt_slab_page *) \
+	((char *) (ptr) - SLAB_PAGEHDR))
+
+#define SLAB_SIZMAX	(((size_t) 1) << RATTSLABCLSMAX)
+
+static int slab_class(size_t size)
+{
+	int cls = RATTSLABCLSMIN;
+
+	while ((((size_t) 1) << cls) < size)
+		++cls;
+	return cls - RATTSLABCLSMIN;
+}
+
+static void slab_link(ratt_slab_t *slab, struct ratt_slab_page *page)
+{
+	page->prev = NULL;
+	page->next = slab->page;
+	if (slab->page)
+		slab->page->prev = page;
+	slab->page = page;
+}
+
+static void slab_unlink(ratt_slab_t *slab, struct ratt_slab_page *page)
+{
+	if (page->prev)
+		page->prev->next = page->next;
+	else
+		slab->page = page->next;
+	if (page->next)
+		page->next->prev = page->prev;
+}
+
+static int slab_refill(ratt_slab_t *slab, int cls)
+{
+	struct ratt_slab_page *page = NULL;
+	size_t size = ((size_t) 1) << (cls + RATTSLABCLSMIN);
+	char *ptr, *end;
+
+	page = malloc(RATTSLABPAGESIZ);
+	if (!page) {
+		debug("malloc() failed");
+		return FAIL;
+	}
+	slab_link(slab, page);
+
+	end = (char *) page + RATTSLABPAGESIZ - size;
+	for (ptr = slab_data(page); ptr <= end; ptr += size) {
+		*(void **) ptr = slab->free_list[cls];
+		slab->free_list[cls] = ptr;
+	}
+
+	debug("slab at %p carved page %p into %u byte blocks",
+	    slab, page, size);
+	return OK;
+}
+
+static void *slab_alloc(void *ctx, size_t size)
+{
+	ratt_slab_t *slab = ctx;
+	struct ratt_slab_page *page = NULL;
+	void *ptr = NULL;
+	int cls;
+
+	if (size > SLAB_SIZMAX) {
+		page = malloc(SLAB_PAGEHDR + size);
+		if (!page) {
+			debug("malloc() failed");
+			return NULL;
+		}
+		slab_link(slab, page);
+		return slab_data(page);
+	}
+
+	cls = slab_class(size);
+	if (!slab->free_list[cls] && slab_refill(slab, cls) != OK)
+		return NULL;
+
+	ptr = slab->free_list[cls];
+	slab->free_list[cls] = *(void **) ptr;
+	return ptr;
+}
+
+static void slab_free(void *ctx, void *ptr, size_t size)
+{
+	ratt_slab_t *slab = ctx;
+	int cls;
+
+	if (size > SLAB_SIZMAX) {
+		slab_unlink(slab, slab_page(ptr));
+		free(slab_page(ptr));
+		return;
+	}
+
+	cls = slab_class(size);
+	*(void **) ptr = slab->free_list[cls];
+	slab->free_list[cls] = ptr;
+}
+
+static void *slab_realloc(void *ctx, void *ptr, size_t old, size_t size)
+{
+	ratt_slab_t *slab = ctx;
+	struct ratt_slab_page *page = NULL;
+	void *newptr = NULL;
+
+	if (!ptr)
+		return slab_alloc(ctx, size);
+
+	if (old > SLAB_SIZMAX && size > SLAB_SIZMAX) {
+		slab_unlink(slab, slab_page(ptr));
+		page = realloc(slab_page(ptr), SLAB_PAGEHDR + size);
+		if (!page) {
+			debug("realloc() failed");
+			slab_link(slab, slab_page(ptr));
+			return NULL;
+		}
+		slab_link(slab, page);
+		return slab_data(page);
+	} else if (old <= SLAB_SIZMAX && size <= SLAB_SIZMAX
+	    && slab_class(old) == slab_class(size))
+		return ptr;
+
+	newptr = slab_alloc(ctx, size);
+	if (newptr) {
+		memcpy(newptr, ptr, (old < size) ? old : size);
+		slab_free(ctx, ptr, old);
+	}
+	return newptr;
+}
+
+int ratt_slab_create(ratt_slab_t *slab)
+{
+	RATTLOG_TRACE();
+
+	memset(slab, 0, sizeof(ratt_slab_t));
+
+	slab->alloc.alloc = slab_alloc;
+	slab->alloc.realloc = slab_realloc;
+	slab->alloc.free = slab_free;
+	slab->alloc.ctx = slab;
+
+	debug("created slab at %p", slab);
+	return OK;
+}
+
+void ratt_slab_destroy(ratt_slab_t *slab)
+{
+	struct ratt_slab_page *page = NULL, *next = NULL;
+
+	RATTLOG_TRACE();
+
+	for (page = slab->page; page; page = next) {
+		next = page->next;
+		free(page);
+	}
+
+	debug("destroyed slab at %p", slab);
+	memset(slab, 0, sizeof(ratt_slab_t));
+}
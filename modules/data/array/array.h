@@ -8,6 +8,16 @@
 #define RATTTABFLXIS	0x1	/* table exists */
 #define RATTTABFLNRA	0x2	/* disable realloc */
 #define RATTTABFLNRU	0x4	/* disable fragment reuse */
+#define RATTTABFLHSH	0x8	/* hash index */
+#define RATTTABFLGR2	0x10	/* grow by doubling, not by half */
+#define RATTTABFLGRP	0x20	/* grow to whole pages */
+#define RATTTABFLGRH	0x40	/* grow to whole huge pages */
+#define RATTTABFLSHR	0x80	/* shrink when the tail retracts */
+#define RATTTABFLSEG	0x100	/* segmented, chunks never move */
+#define RATTTABFLSRT	0x200	/* sorted, chunks move on insert */
+#define RATTTABFLMAP	0x400	/* mapped from a file */
+#define RATTTABFLRDO	0x800	/* read only */
+#define RATTTABFLRPR	0x1000	/* repair a mapped file not synced */
 
 /* minimum table size; cannot be lower than 1 */
 #ifndef RATTTABSIZMIN
@@ -19,6 +29,47 @@
 #define RATTTABSIZMAX		RATTSIZMAX - 1
 #endif
 
+/* page sizes tables grow to with RATTTABFLGRP and RATTTABFLGRH */
+#ifndef RATTTABPAGESIZ
+#define RATTTABPAGESIZ		4096
+#endif
+
+#ifndef RATTTABHUGESIZ
+#define RATTTABHUGESIZ		(2 * 1024 * 1024)
+#endif
+
+/* RATTTABFLSHR shrinks a table whose tail lies below 1/ratio of it */
+#ifndef RATTTABSHRRATIO
+#define RATTTABSHRRATIO		4
+#endif
+
+/* minimum chunks per block of a segmented table; a power of two, 64 or
+ * more as bulk scans take 64 chunks at once */
+#ifndef RATTTABSEGSIZMIN
+#define RATTTABSEGSIZMIN	64
+#endif
+
+/* minimum hash index size; must be a power of two */
+#ifndef RATTTABHSHSIZMIN
+#define RATTTABHSHSIZMIN	8
+#endif
+
+/*
+ * table hash index information
+ *
+ * ratt_table_search() goes through the index when given the compare
+ * callback and a key; ratt_table_satisfy_constrains() goes through it
+ * when constrains only match chunks of the same key.
+ */
+typedef struct {
+	/* key callback, gives the key of a chunk */
+	void const *(*key)(void const *);
+	/* hash callback, gives the hash of a key */
+	size_t (*hash)(void const *);
+	/* compare callback, matches a chunk against a key */
+	int (*compare)(void const *, void const *);
+} ratt_table_hash_t;
+
 /* table information */
 struct ratt_table {
 	void *head, *tail;	/* head and tail of table */
@@ -28,23 +79,85 @@ struct ratt_table {
 	size_t chunk_count;	/* chunk counter */
 
 	size_t frag_count;	/* fragment counter */
-	uint8_t *frag_mask;	/* fragment mask */
+	uint64_t *frag_mask;	/* fragment mask */
 
 	int flags;		/* table flags */
 
 	/* constrains callback */
 	int (*constrains)(void const *, void const *);
 	int (*on_constrains)(void *, void const *);
+
+	/*
+	 * A sorted table (RATTTABFLSRT) keeps live chunks in the order
+	 * given by the order callback, which compares two chunks the way
+	 * strcmp() does; a chunk goes after the chunks equal to it.
+	 */
+	int (*order)(void const *, void const *);
+
+	ratt_table_hash_t const *hash;	/* hash index information */
+	size_t hash_size;	/* hash index size */
+	size_t *hash_bucket;	/* hash buckets, position + 1 */
+	size_t *hash_next;	/* hash chains, position + 1 */
+
+	struct ratt_alloc const *alloc;	/* allocator, NULL for libc */
+
+	/*
+	 * A segmented table (RATTTABFLSEG) lays chunks out in blocks of
+	 * a power of two chunks which never move; growing adds blocks
+	 * and head is the first chunk of the first block.
+	 */
+	void **block;		/* blocks of a segmented table */
+	size_t block_count;	/* room for block pointers */
+	size_t block_shift;	/* chunks per block, log2 */
+
+	/*
+	 * A mapped table (RATTTABFLMAP) keeps a header, its chunks then
+	 * its frag_mask in one shared mapping of a file.
+	 */
+	void *map;		/* file mapping */
+	size_t map_size;	/* file mapping size */
+	int map_fd;		/* mapped file */
 };
 
 typedef struct ratt_table ratt_table_t;
 
+/*
+ * table iterator
+ *
+ * An iterator walks a table on its own position and leaves the table
+ * untouched, thus any number of them may walk the same table at once,
+ * nested or from several threads sharing a read lock, as long as nobody
+ * writes to the table meanwhile.  Deleting the chunk an iterator is on
+ * is fine; the iterator goes on with the next one.
+ */
+typedef struct {
+	ratt_table_t const *table;	/* table walked */
+	size_t pos;		/* position of the chunk given last */
+} ratt_table_iter_t;
+
 static inline
 size_t ratt_table_size(ratt_table_t *table)
 {
 	return table->size;
 }
 
+static inline
+struct ratt_alloc const *ratt_table_allocator(ratt_table_t *table)
+{
+	return table->alloc;
+}
+
+/* address of the chunk at pos; pos is not checked */
+static inline
+void *ratt_table_addr(ratt_table_t const *table, size_t pos)
+{
+	if (table->flags & RATTTABFLSEG)
+		return (char *) table->block[pos >> table->block_shift]
+		    + ((pos & ((((size_t) 1) << table->block_shift) - 1))
+		    * table->chunk_size);
+	return (char *) table->head + (pos * table->chunk_size);
+}
+
 static inline
 size_t ratt_table_count(ratt_table_t *table)
 {
@@ -127,8 +240,7 @@ void *ratt_table_current(ratt_table_t *table)
 {
 	if (!ratt_table_isempty(table)
 	    && table->pos <= table->last) {
-		return (char *) table->head
-		    + (table->pos * table->chunk_size);
+		return ratt_table_addr(table, table->pos);
 	}
 	return NULL;
 }
@@ -139,8 +251,7 @@ void *ratt_table_chunk(ratt_table_t *table, size_t pos)
 	if (!ratt_table_isempty(table)
 	    && pos <= table->last) {
 		table->pos = pos;
-		return (char *) table->head
-		    + (table->pos * table->chunk_size);
+		return ratt_table_addr(table, table->pos);
 	}
 
 	return NULL;
@@ -162,6 +273,16 @@ ratt_table_set_on_constrains(
 	table->on_constrains = resolve;
 }
 
+/* for a table created later on its own allocator, e.g. a core hook table */
+static inline void
+ratt_table_set_allocator(
+    ratt_table_t *table,
+    struct ratt_alloc const *alloc)
+{
+	if (!ratt_table_exists(table))
+		table->alloc = alloc;
+}
+
 #define RATT_TABLE_FOREACH(tab, chunk) \
 	for ((chunk) = ratt_table_first_next((tab)); \
 	    (chunk) != NULL; (chunk) = ratt_table_next((tab)))
@@ -170,14 +291,47 @@ ratt_table_set_on_constrains(
 	for ((chunk) = ratt_table_last((tab)); \
 	    (chunk) != NULL; (chunk) = ratt_table_prev((tab)))
 
+#define RATT_TABLE_ITER_FOREACH(tab, it, chunk) \
+	for ((chunk) = ratt_table_iter_first((it), (tab)); \
+	    (chunk) != NULL; (chunk) = ratt_table_iter_next((it)))
+
+#define RATT_TABLE_ITER_FOREACH_REVERSE(tab, it, chunk) \
+	for ((chunk) = ratt_table_iter_last((it), (tab)); \
+	    (chunk) != NULL; (chunk) = ratt_table_iter_prev((it)))
+
 #define RATT_TABLE_INIT(tab) ratt_table_t (tab) = { 0 }
 
+static inline
+size_t ratt_table_iter_pos(ratt_table_iter_t const *it)
+{
+	return it->pos;
+}
+
 extern int ratt_table_create(ratt_table_t *, size_t, size_t, int);
+extern int ratt_table_create_hashed(ratt_table_t *, size_t, size_t, int,
+    ratt_table_hash_t const *);
+extern int ratt_table_create_alloc(ratt_table_t *, size_t, size_t, int,
+    struct ratt_alloc const *);
+extern int ratt_table_create_hashed_alloc(ratt_table_t *, size_t, size_t, int,
+    ratt_table_hash_t const *, struct ratt_alloc const *);
+extern int ratt_table_create_mmap(ratt_table_t *, char const *, size_t, size_t,
+    int);
+extern int ratt_table_sync(ratt_table_t *);
 extern int ratt_table_destroy(ratt_table_t *);
+extern int ratt_table_reserve(ratt_table_t *, size_t);
+extern int ratt_table_compact(ratt_table_t *);
+extern int ratt_table_set_order(ratt_table_t *,
+    int (*)(void const *, void const *));
 extern int ratt_table_push(ratt_table_t *, void const *);
 extern int ratt_table_insert(ratt_table_t *, void const *);
 extern int ratt_table_search(ratt_table_t *, void **,
     int (*)(void const *, void const *), void const *);
+extern int ratt_table_bsearch(ratt_table_t *, void **,
+    int (*)(void const *, void const *), void const *);
+extern int ratt_table_find_u32(ratt_table_t *, void **, size_t, uint32_t);
+extern int ratt_table_find_u64(ratt_table_t *, void **, size_t, uint64_t);
+extern size_t ratt_table_count_if(ratt_table_t *,
+    int (*)(void const *, void const *), void const *);
 extern int ratt_table_get_tail_next(ratt_table_t *, void **);
 extern int ratt_table_get_frag_first(ratt_table_t *, void **);
 extern int ratt_table_del_current(ratt_table_t *);
@@ -188,5 +342,14 @@ extern void *ratt_table_prev(ratt_table_t *);
 extern void *ratt_table_next(ratt_table_t *);
 extern void *ratt_table_first_next(ratt_table_t *);
 extern void *ratt_table_circular_next(ratt_table_t *);
+extern size_t ratt_table_hash_string(void const *);
+extern void *ratt_table_iter_first(ratt_table_iter_t *, ratt_table_t const *);
+extern void *ratt_table_iter_last(ratt_table_iter_t *, ratt_table_t const *);
+extern void *ratt_table_iter_at(ratt_table_iter_t *, ratt_table_t const *,
+    size_t);
+extern void *ratt_table_iter_next(ratt_table_iter_t *);
+extern void *ratt_table_iter_prev(ratt_table_iter_t *);
+extern void *ratt_table_iter_search(ratt_table_iter_t *, ratt_table_t const *,
+    int (*)(void const *, void const *), void const *);
 
 #endif /* RATT_DATA_ARRAY_H */
@@ -31,55 +31,75 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <rattle.h>
+#include <rattle/alloc.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_TABLE_SIMD	1
+#include <immintrin.h>
+#endif
 
 
 /*
  * The following macro defines the bit flag mathematics
  * used to compute the table->frag_mask member which is laid out
- * on a dynamically allocated array of 8bits slot.
+ * on a dynamically allocated array of 64bits words.
  *
  * A frag_mask bit toggled on means there is fragmentation at
  * the corresponding table->pos which is zero-based.
  *
+ * frag_mask_words macro gives the number of words of a (x) flags array
  * frag_mask_size macro gives the size of a (x) flags array
- * fsbset() macro finds the first significant bit set in the slot
- * shift_mask() macro computes the bit flags position in the slot
- * shift_mask_slot() macro computes the slot position in the array
+ * fsbset() macro finds the first significant bit set in the word
+ * lsbset() macro finds the last significant bit set in the word
+ * shift_mask() macro computes the bit flags position in the word
+ * shift_mask_slot() macro computes the word position in the array
  *
- * Note: fsbset() uses ffs() to take advantages of hardware support
- *       for find first bit set operation *but* ffs() is one-based.
- *       Thus, fsbset() substracts one so that results are zero-based.
+ * Note: fsbset() and lsbset() use the count trailing/leading zeros
+ *       builtins to take advantages of hardware support, both are
+ *       zero-based.
  *
  *       Care must be taken to verify that bits are set before using
- *       fsbset() as ffs() uses return value of 0 to indicate that
+ *       fsbset() or lsbset() as the builtins are undefined when
  *       no bit is set.
  */
-#define frag_mask_size(x) ((1 + ((x) / 8)) * sizeof(uint8_t))
-#define fsbset(x) (ffs((x)) - 1)
-#define shift_mask(pos) (1 << ((pos) & 7))
+#define FRAG_MASK_BITS		64
+#define frag_mask_words(x) (1 + ((x) / FRAG_MASK_BITS))
+#define frag_mask_size(x) (frag_mask_words((x)) * sizeof(uint64_t))
+#define fsbset(x) (__builtin_ctzll((x)))
+#define lsbset(x) (FRAG_MASK_BITS - 1 - __builtin_clzll((x)))
+#define shift_mask(pos) (((uint64_t) 1) << ((pos) & (FRAG_MASK_BITS - 1)))
 #define shift_mask_slot(head, pos)			\
 	do {						\
 		if ((head)) {				\
-			(head) += (pos) / 8;		\
+			(head) += (pos) / FRAG_MASK_BITS;	\
 		}					\
 	} while (0)
 
-static inline int is_frag(uint8_t const *slot, size_t pos)
+/* word-aligned position of pos */
+#define word_pos(pos) ((pos) & ~((size_t) FRAG_MASK_BITS - 1))
+
+static inline int is_frag(uint64_t const *slot, size_t pos)
 {
 	shift_mask_slot(slot, pos);
-	return (*slot & shift_mask(pos));
+	return ((*slot & shift_mask(pos)) != 0);
 }
 
-static inline int frag_mask_set(uint8_t *slot, size_t pos, size_t *cnt)
+static inline int frag_mask_set(uint64_t *slot, size_t pos, size_t *cnt)
 {
-	uint8_t bitmask = shift_mask(pos);
+	uint64_t bitmask = shift_mask(pos);
 
 	shift_mask_slot(slot, pos);
 	if (*slot & bitmask) {
-		debug("bitmask 0x%x already set in mask slot", bitmask);
+		debug("bitmask 0x%llx already set in mask slot",
+		    (unsigned long long) bitmask);
 		return FAIL;
 	}
 
@@ -89,13 +109,14 @@ static inline int frag_mask_set(uint8_t *slot, size_t pos, size_t *cnt)
 	return OK;
 }
 
-static inline int frag_mask_unset(uint8_t *slot, size_t pos, size_t *cnt)
+static inline int frag_mask_unset(uint64_t *slot, size_t pos, size_t *cnt)
 {
-	uint8_t bitmask = shift_mask(pos);
+	uint64_t bitmask = shift_mask(pos);
 
 	shift_mask_slot(slot, pos);
 	if (!(*slot & bitmask)) {
-		debug("bitmask 0x%x absent from mask slot", bitmask);
+		debug("bitmask 0x%llx absent from mask slot",
+		    (unsigned long long) bitmask);
 		return FAIL;
 	}
 
@@ -105,10 +126,366 @@ static inline int frag_mask_unset(uint8_t *slot, size_t pos, size_t *cnt)
 	return OK;
 }
 
+/* clear every bit from pos `first' to pos `last', both included */
+static inline void
+frag_mask_clear(uint64_t *slot, size_t first, size_t last, size_t *cnt)
+{
+	uint64_t bitmask;
+	size_t i, end = last / FRAG_MASK_BITS;
+
+	for (i = first / FRAG_MASK_BITS; i <= end; ++i) {
+		bitmask = ~((uint64_t) 0);
+		if (i == first / FRAG_MASK_BITS)
+			bitmask <<= (first & (FRAG_MASK_BITS - 1));
+		if (i == end)
+			bitmask &= ~((uint64_t) 0) >> (FRAG_MASK_BITS - 1
+			    - (last & (FRAG_MASK_BITS - 1)));
+
+		*cnt -= __builtin_popcountll(slot[i] & bitmask);
+		slot[i] &= ~bitmask;
+	}
+}
+
+/*
+ * next_live() gives the first live position at or after pos, skipping
+ * whole words of fragments at once.  The result is greater than
+ * table->last when no live chunk remains.
+ */
+static inline size_t next_live(ratt_table_t const *table, size_t pos)
+{
+	uint64_t const *slot = table->frag_mask;
+	uint64_t live;
+
+	if (!ratt_table_fragmented((ratt_table_t *) table))
+		return pos;
+
+	shift_mask_slot(slot, pos);
+	live = ~(*slot) & (~((uint64_t) 0) << (pos & (FRAG_MASK_BITS - 1)));
+	while (!live) {
+		pos = word_pos(pos) + FRAG_MASK_BITS;
+		if (pos > table->last)
+			return pos;
+		live = ~(*(++slot));
+	}
+
+	return word_pos(pos) + fsbset(live);
+}
+
+/*
+ * prev_live() gives the last live position at or before pos, skipping
+ * whole words of fragments at once.  The result is RATTSIZMAX when no
+ * live chunk is found.
+ */
+static inline size_t prev_live(ratt_table_t const *table, size_t pos)
+{
+	uint64_t const *slot = table->frag_mask;
+	uint64_t live;
+
+	if (!ratt_table_fragmented((ratt_table_t *) table))
+		return pos;
+
+	shift_mask_slot(slot, pos);
+	live = ~(*slot) & (~((uint64_t) 0)
+	    >> (FRAG_MASK_BITS - 1 - (pos & (FRAG_MASK_BITS - 1))));
+	while (!live) {
+		if (pos < FRAG_MASK_BITS)
+			return RATTSIZMAX;
+		pos = word_pos(pos) - 1;
+		live = ~(*(--slot));
+	}
+
+	return word_pos(pos) + lsbset(live);
+}
+
+/*
+ * next_frag() gives the first fragment at or after pos.  The result is
+ * greater than table->last when no fragment remains.
+ */
+static inline size_t next_frag(ratt_table_t const *table, size_t pos)
+{
+	uint64_t const *slot = table->frag_mask;
+	uint64_t frag;
+
+	if (!ratt_table_fragmented((ratt_table_t *) table) || pos > table->last)
+		return table->last + 1;
+
+	shift_mask_slot(slot, pos);
+	frag = *slot & (~((uint64_t) 0) << (pos & (FRAG_MASK_BITS - 1)));
+	while (!frag) {
+		pos = word_pos(pos) + FRAG_MASK_BITS;
+		if (pos > table->last)
+			return pos;
+		frag = *(++slot);
+	}
+
+	return word_pos(pos) + fsbset(frag);
+}
+
+/*
+ * The hash index maps the key of every live chunk to its position.
+ * Buckets and chains hold positions plus one so that zero ends a chain;
+ * hash_next is laid out along the table itself, a position never moves
+ * thus neither table_resize() nor fragment reuse breaks the chains.
+ */
+#define hash_chunk(table, pos) ratt_table_addr((table), (pos))
+#define hash_bucket_of(table, key) \
+	((table)->hash->hash((key)) & ((table)->hash_size - 1))
+
+static void hash_index_fill(ratt_table_t *table)
+{
+	size_t pos, bucket;
+
+	memset(table->hash_bucket, 0, table->hash_size * sizeof(size_t));
+	if (ratt_table_isempty(table))
+		return;
+
+	for (pos = next_live(table, 0); pos <= table->last;
+	    pos = next_live(table, pos + 1)) {
+		bucket = hash_bucket_of(table,
+		    table->hash->key(hash_chunk(table, pos)));
+		table->hash_next[pos] = table->hash_bucket[bucket];
+		table->hash_bucket[bucket] = pos + 1;
+	}
+}
+
+static int hash_index_resize(ratt_table_t *table, size_t hash_size)
+{
+	size_t *bucket = NULL;
+
+	bucket = ratt_mem_realloc(table->alloc, table->hash_bucket,
+	    table->hash_size * sizeof(size_t), hash_size * sizeof(size_t));
+	if (!bucket) {
+		debug("realloc() failed");
+		return FAIL;
+	}
+
+	table->hash_bucket = bucket;
+	table->hash_size = hash_size;
+	hash_index_fill(table);
+
+	debug("hash index of table at %p resized to %u buckets",
+	    table, table->hash_size);
+	return OK;
+}
+
+static void hash_index_add(ratt_table_t *table, size_t pos)
+{
+	size_t bucket;
+
+	/* keep about one chunk per bucket; a longer chain will do if
+	 * the index cannot grow.  Growing indexes the new chunk too. */
+	if (ratt_table_count(table) > table->hash_size
+	    && hash_index_resize(table, 2 * table->hash_size) == OK)
+		return;
+
+	bucket = hash_bucket_of(table,
+	    table->hash->key(hash_chunk(table, pos)));
+	table->hash_next[pos] = table->hash_bucket[bucket];
+	table->hash_bucket[bucket] = pos + 1;
+}
+
+static void hash_index_del(ratt_table_t *table, size_t pos)
+{
+	size_t *link;
+
+	link = &(table->hash_bucket[hash_bucket_of(table,
+	    table->hash->key(hash_chunk(table, pos)))]);
+	while (*link) {
+		if (*link == pos + 1) {
+			*link = table->hash_next[pos];
+			table->hash_next[pos] = 0;
+			return;
+		}
+		link = &(table->hash_next[*link - 1]);
+	}
+
+	debug("chunk %u is missing from the hash index", pos);
+}
+
+/* position plus one of the chunk matching key, 0 if none */
+static size_t hash_index_lookup(ratt_table_t const *table, void const *key,
+                                int (*comp)(void const *, void const *),
+                                void const *compdata)
+{
+	size_t link;
+
+	link = table->hash_bucket[hash_bucket_of(table, key)];
+	while (link) {
+		if (comp(hash_chunk(table, link - 1), compdata) == MATCH)
+			return link;
+		link = table->hash_next[link - 1];
+	}
+
+	return 0;
+}
+
+static int hash_index_find(ratt_table_t *table, void const *key,
+                           int (*comp)(void const *, void const *),
+                           void const *compdata)
+{
+	size_t link;
+
+	link = hash_index_lookup(table, key, comp, compdata);
+	if (!link)
+		return FAIL;
+
+	table->pos = link - 1;
+	return OK;
+}
+
+/*
+ * A mapped table file starts with a header, then come the chunks and
+ * the frag_mask, each 64 bytes aligned.  The header is written back by
+ * ratt_table_sync() and ratt_table_destroy(); it stays dirty from the
+ * first write on until then, and a dirty file is not opened for writing
+ * as its counters may not match its chunks anymore.  The header goes to
+ * disk as soon as it turns dirty, and its size and tail follow the table
+ * as they change, so RATTTABFLRPR can take the counters back from the
+ * frag_mask.  Read only mappers hold a shared flock() on the file,
+ * which is never resized under them.
+ */
+#define RATTTABMAPMAGIC		0x52415454	/* RATT */
+#define RATTTABMAPVERSION	1
+
+typedef struct {
+	uint32_t magic;		/* RATTTABMAPMAGIC */
+	uint32_t version;	/* RATTTABMAPVERSION */
+	uint64_t chunk_size;	/* chunk size */
+	uint64_t size;		/* table size */
+	uint64_t last;		/* tail position */
+	uint64_t chunk_count;	/* chunk counter */
+	uint64_t frag_count;	/* fragment counter */
+	uint32_t dirty;		/* written to since the last sync */
+} map_header_t;
+
+#define map_align(x) (((x) + 63) & ~((size_t) 63))
+#define map_head_offset() map_align(sizeof(map_header_t))
+#define map_frag_offset(size, chunk_size) \
+	map_align(map_head_offset() + (size) * (chunk_size))
+#define map_file_size(size, chunk_size) \
+	(map_frag_offset((size), (chunk_size)) + frag_mask_size((size)))
+
+/* every write goes through here: read only tables refuse it */
+static inline int table_write(ratt_table_t *table)
+{
+	map_header_t *header = table->map;
+
+	if (table->flags & RATTTABFLRDO) {
+		debug("table at %p is read only", table);
+		return FAIL;
+	}
+	if ((table->flags & RATTTABFLMAP) && !header->dirty) {
+		/* on disk first, or a crash would leave it looking synced */
+		header->dirty = 1;
+		if (msync(table->map, map_head_offset(), MS_SYNC) != 0) {
+			debug("msync() failed: %s", strerror(errno));
+			header->dirty = 0;
+			return FAIL;
+		}
+	}
+	return OK;
+}
+
+/* size, tail and counters of a mapped table follow it in the header */
+static inline void map_track(ratt_table_t *table)
+{
+	map_header_t *header = table->map;
+
+	if (table->flags & RATTTABFLMAP) {
+		header->size = table->size;
+		header->last = table->last;
+		header->chunk_count = table->chunk_count;
+		header->frag_count = table->frag_count;
+	}
+}
+
+/*
+ * A sorted table is searched by bisection over positions: the first
+ * live chunk at or after a position is ordered against the key, which
+ * is monotonic as live chunks are sorted and fragments are skipped.
+ * sorted_bound() gives the lowest position whose first live chunk
+ * compares greater than key (or not lower if !strict), table->last + 1
+ * if there is none.
+ */
+static size_t sorted_bound(ratt_table_t const *table,
+                           int (*comp)(void const *, void const *),
+                           void const *key, int strict)
+{
+	size_t lo = 0, hi, mid, pos;
+	int cmp;
+
+	if (ratt_table_isempty((ratt_table_t *) table))
+		return 0;
+
+	hi = table->last + 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		pos = next_live(table, mid);
+		cmp = (pos > table->last) ? 1
+		    : comp(ratt_table_addr(table, pos), key);
+		if (cmp > 0 || (!strict && !cmp))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/*
+ * get_sorted_slot() makes room for src in a sorted table, after every
+ * chunk not greater than src.  A fragment right there is reused as is;
+ * otherwise the chunks up to the next fragment, or up to the tail, move
+ * up by one and `moved' is set.  Fragment reuse cannot be disabled.
+ */
+static int get_sorted_slot(ratt_table_t *table, void const *src,
+                           void **dst, int *moved)
+{
+	size_t pos, frag;
+	void *tail = NULL;
+	int retval;
+
+	*moved = 0;
+	if (ratt_table_isempty(table))
+		return ratt_table_get_tail_next(table, dst);
+
+	pos = sorted_bound(table, table->order, src, 1);
+	if (pos > table->last)
+		return ratt_table_get_tail_next(table, dst);
+
+	if (is_frag(table->frag_mask, pos)) {
+		frag_mask_unset(table->frag_mask, pos, &(table->frag_count));
+		table->chunk_count++;
+	} else if ((frag = next_frag(table, pos)) <= table->last) {
+		memmove(ratt_table_addr(table, pos + 1),
+		    ratt_table_addr(table, pos),
+		    (frag - pos) * table->chunk_size);
+		frag_mask_unset(table->frag_mask, frag, &(table->frag_count));
+		table->chunk_count++;
+		*moved = 1;
+	} else {
+		retval = ratt_table_get_tail_next(table, &tail);
+		if (retval != OK) {
+			debug("ratt_table_get_tail_next() failed");
+			return FAIL;
+		}
+		memmove(ratt_table_addr(table, pos + 1),
+		    ratt_table_addr(table, pos),
+		    (table->last - pos) * table->chunk_size);
+		*moved = 1;
+	}
+
+	map_track(table);
+	table->pos = pos;
+	*dst = ratt_table_addr(table, pos);
+	return OK;
+}
+
 static inline int write_chunk(ratt_table_t *table, void const *src,
                               int (*getdst)(ratt_table_t *, void **))
 {
 	void *dst = NULL, *curr = NULL;
+	int moved = 0;
 	int retval;
 
 	if (!getdst) {
@@ -116,6 +493,9 @@ static inline int write_chunk(ratt_table_t *table, void const *src,
 		getdst = ratt_table_get_tail_next;
 	}
 
+	if (table_write(table) != OK)
+		return FAIL;
+
 	retval = ratt_table_satisfy_constrains(table, src);
 	if (retval != OK && !table->on_constrains) {
 		debug("ratt_table_satisfy_constrains() failed");
@@ -135,7 +515,10 @@ static inline int write_chunk(ratt_table_t *table, void const *src,
 		return OK;
 	}
 
-	retval = getdst(table, &dst);
+	if (table->flags & RATTTABFLSRT)
+		retval = get_sorted_slot(table, src, &dst, &moved);
+	else
+		retval = getdst(table, &dst);
 	if (retval != OK) {
 		debug("getdst() failed");
 		return FAIL;
@@ -143,163 +526,781 @@ static inline int write_chunk(ratt_table_t *table, void const *src,
 
 	memcpy(dst, src, table->chunk_size);
 
+	/* getdst() left the position on dst */
+	if ((table->flags & RATTTABFLHSH) && moved)
+		hash_index_fill(table);
+	else if (table->flags & RATTTABFLHSH)
+		hash_index_add(table, table->pos);
+
 	debug("chunk at %p written to %p, slot %u", src, dst,
 	    ratt_table_pos_current(table));
 	return OK;
 }
 
-static int realloc_and_move(ratt_table_t *table)
+/*
+ * grow_size() gives the size of a full table about to grow: half again
+ * its size by default or twice its size with RATTTABFLGR2, then rounded
+ * up so that chunks fill whole pages (RATTTABFLGRP) or whole huge pages
+ * (RATTTABFLGRH).  Rounding adds at most one page worth of chunks.
+ * A segmented table then rounds up to whole blocks, which only costs
+ * new blocks as chunks are never copied.
+ */
+static size_t grow_size(ratt_table_t const *table)
 {
-	void *head = NULL;
-	uint8_t *frag_mask = NULL;
-	size_t newsiz = 0, growsiz = 0;
+	size_t growsiz, newsiz, page = 0;
 
-	growsiz = table->size / 2;
+	growsiz = (table->flags & RATTTABFLGR2) ? table->size
+	    : table->size / 2;
 	if (!growsiz) /* cannot be 0 */
 		growsiz = 1;
 
-	if ((table->size + growsiz) > RATTTABMAXSIZ) {
+	if (growsiz > RATTTABMAXSIZ - table->size) {
 		debug("increment is over maximum size (%u)", RATTTABMAXSIZ);
-		newsiz = RATTTABMAXSIZ;
-	} else
-		newsiz = table->size + growsiz;
+		return RATTTABMAXSIZ;
+	}
+	newsiz = table->size + growsiz;
 
-	if (newsiz <= table->size) {
-		debug("not growing... %u vs %u", newsiz, table->size);
+	if (table->flags & RATTTABFLGRH)
+		page = RATTTABHUGESIZ;
+	else if (table->flags & RATTTABFLGRP)
+		page = RATTTABPAGESIZ;
+
+	if (page && newsiz <= (RATTTABMAXSIZ - page) / table->chunk_size)
+		newsiz = ((newsiz * table->chunk_size + page - 1)
+		    & ~(page - 1)) / table->chunk_size;
+
+	return newsiz;
+}
+
+/*
+ * A segmented table holds size >> block_shift blocks; the block pointers
+ * grow twice as many at once and never shrink.  seg_grow() adds blocks
+ * up to newsiz chunks, seg_drop() frees the blocks holding chunks from
+ * `from' up to `to'.
+ */
+#define seg_chunks(table) (((size_t) 1) << (table)->block_shift)
+#define seg_bytes(table) (seg_chunks((table)) * (table)->chunk_size)
+
+static int seg_grow(ratt_table_t *table, size_t newsiz)
+{
+	void **block = NULL;
+	size_t i, count, from = table->size >> table->block_shift;
+
+	count = newsiz >> table->block_shift;
+	if (count > table->block_count) {
+		if (count < 2 * table->block_count)
+			count = 2 * table->block_count;
+		block = ratt_mem_realloc(table->alloc, table->block,
+		    table->block_count * sizeof(void *),
+		    count * sizeof(void *));
+		if (!block) {
+			debug("realloc() failed");
+			return FAIL;
+		}
+		table->block = block;
+		table->block_count = count;
+	}
+
+	for (i = from; i < (newsiz >> table->block_shift); ++i) {
+		table->block[i] = ratt_mem_calloc(table->alloc, 1,
+		    seg_bytes(table));
+		if (!table->block[i]) {
+			debug("calloc() failed");
+			while (i-- > from)
+				ratt_mem_free(table->alloc, table->block[i],
+				    seg_bytes(table));
+			return FAIL;
+		}
+	}
+
+	return OK;
+}
+
+static void seg_drop(ratt_table_t *table, size_t from, size_t to)
+{
+	size_t i;
+
+	for (i = from >> table->block_shift;
+	    i < (to >> table->block_shift); ++i) {
+		ratt_mem_free(table->alloc, table->block[i], seg_bytes(table));
+		table->block[i] = NULL;
+	}
+}
+
+/*
+ * map_move() moves the file of a mapped table from room for `from'
+ * chunks to room for `to' chunks.  The frag_mask follows the chunks, so
+ * it moves up before the chunks grow into it or down before they shrink
+ * over it; new chunks and frag_mask words are zeroed.
+ */
+static int map_move(ratt_table_t *table, size_t from, size_t to)
+{
+	size_t cs = table->chunk_size, newmap = map_file_size(to, cs);
+	size_t oldfrag = map_frag_offset(from, cs);
+	size_t newfrag = map_frag_offset(to, cs);
+	void *map = NULL;
+
+	if (to > from && ftruncate(table->map_fd, newmap) != 0) {
+		debug("ftruncate() failed: %s", strerror(errno));
+		return FAIL;
+	} else if (to < from)
+		memmove((char *) table->map + newfrag,
+		    (char *) table->map + oldfrag, frag_mask_size(to));
+
+#ifdef MREMAP_MAYMOVE
+	map = mremap(table->map, table->map_size, newmap, MREMAP_MAYMOVE);
+#else
+	map = mmap(NULL, newmap, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    table->map_fd, 0);
+	if (map != MAP_FAILED)
+		munmap(table->map, table->map_size);
+#endif
+	if (map == MAP_FAILED) {
+		debug("mremap() failed: %s", strerror(errno));
+		if (to < from) {	/* put the frag_mask back */
+			memmove((char *) table->map + oldfrag,
+			    (char *) table->map + newfrag,
+			    frag_mask_size(to));
+			memset((char *) table->map + newfrag, 0,
+			    (frag_mask_size(to) < oldfrag - newfrag)
+			    ? frag_mask_size(to) : oldfrag - newfrag);
+		} else
+			ftruncate(table->map_fd, table->map_size);
 		return FAIL;
 	}
 
-	head = realloc(table->head, newsiz * table->chunk_size);
+	if (to > from) {
+		memmove((char *) map + newfrag, (char *) map + oldfrag,
+		    frag_mask_size(from));
+		memset((char *) map + map_head_offset() + from * cs, 0,
+		    newfrag - map_head_offset() - from * cs);
+		memset((char *) map + newfrag + frag_mask_size(from), 0,
+		    frag_mask_size(to) - frag_mask_size(from));
+	} else if (ftruncate(table->map_fd, newmap) != 0)
+		debug("ftruncate() failed: %s", strerror(errno));
+
+	table->map = map;
+	table->map_size = newmap;
+	table->head = (char *) map + map_head_offset();
+	table->tail = (char *) table->head + table->last * cs;
+	table->frag_mask = (uint64_t *) ((char *) map + newfrag);
+	return OK;
+}
+
+/*
+ * map_resize() resizes the file of a mapped table unless read only
+ * mappers share it: they hold a shared flock() and would lose track of
+ * the frag_mask, which moves with the size.
+ */
+static int map_resize(ratt_table_t *table, size_t from, size_t to)
+{
+	int retval;
+
+	/* readers opening meanwhile wait for the new layout */
+	if (flock(table->map_fd, LOCK_EX | LOCK_NB) != 0) {
+		debug("mapped table at %p is shared: %s",
+		    table, strerror(errno));
+		return FAIL;
+	}
+	retval = map_move(table, from, to);
+	flock(table->map_fd, LOCK_UN);
+	return retval;
+}
+
+/*
+ * table_resize() moves the table to room for newsiz chunks, growing or
+ * shrinking it; chunks keep their position so newsiz must be past the
+ * tail.  Grown room is zeroed as a table always is past its tail.
+ * A segmented table resizes to whole blocks and its chunks stay put.
+ */
+static int table_resize(ratt_table_t *table, size_t newsiz)
+{
+	void *head = NULL;
+	uint64_t *frag_mask = NULL;
+	size_t *hash_next = NULL;
+
+	if ((table->flags & RATTTABFLSEG)
+	    && newsiz <= RATTTABMAXSIZ - seg_chunks(table))
+		newsiz = (newsiz + seg_chunks(table) - 1)
+		    & ~(seg_chunks(table) - 1);
+
+	if (newsiz == table->size)
+		return OK;
+	else if (newsiz <= table->last || newsiz < RATTTABMINSIZ) {
+		debug("cannot resize to %u, tail is at %u",
+		    newsiz, table->last);
+		return FAIL;
+	}
+
+	if (table->flags & RATTTABFLSEG) {
+		/* blocks go only once nothing else may fail */
+		if (newsiz > table->size && seg_grow(table, newsiz) != OK) {
+			error("table resize operation failed");
+			debug("seg_grow() failed");
+			return FAIL;
+		}
+		goto resize_index;
+	} else if (table->flags & RATTTABFLMAP) {
+		if (map_resize(table, table->size, newsiz) != OK) {
+			error("table resize operation failed");
+			debug("map_resize() failed");
+			return FAIL;
+		}
+		head = table->head;
+		goto resize_hash;
+	}
+
+	head = ratt_mem_realloc(table->alloc, table->head,
+	    table->size * table->chunk_size, newsiz * table->chunk_size);
 	if (!head) {
 		error("table resize operation failed: %s", strerror(errno));
 		debug("realloc() failed");
 		return FAIL;
 	}
 
-	frag_mask = realloc(table->frag_mask, frag_mask_size(newsiz));
+	if (table->head != head) {	/* realloc moved it, recompute */
+		debug("head is now at %p, was %p", head, table->head);
+		table->head = head;
+		table->tail = (char *) head
+		    + (table->last * table->chunk_size);
+	}
+
+resize_index:
+	frag_mask = ratt_mem_realloc(table->alloc, table->frag_mask,
+	    frag_mask_size(table->size), frag_mask_size(newsiz));
 	if (!frag_mask) {
 		error("memory allocation failed");
 		debug("realloc() failed");
-		return FAIL;
+		goto undo_head;
 	}
-
 	debug("reallocated frag_mask at %p", frag_mask);
 	table->frag_mask = frag_mask;
-	shift_mask_slot(frag_mask, table->last);
-	frag_mask++;	/* entering uninitialized memory */
-	memset(frag_mask, 0,
-	    frag_mask_size(newsiz) - frag_mask_size(table->size));
 
-	if (table->head != head) {	/* realloc moved it, recompute */
-		debug("head is now at %p, was %p", head, table->head);
+resize_hash:
+	if (table->flags & RATTTABFLHSH) {
+		hash_next = ratt_mem_realloc(table->alloc, table->hash_next,
+		    table->size * sizeof(size_t), newsiz * sizeof(size_t));
+		if (!hash_next) {
+			error("memory allocation failed");
+			debug("realloc() failed");
+			goto undo_frag_mask;
+		}
+		table->hash_next = hash_next;
+	}
+
+	if (newsiz > table->size) {	/* uninitialized memory */
+		if (!(table->flags & RATTTABFLSEG))
+			memset((char *) head + table->size * table->chunk_size,
+			    0, (newsiz - table->size) * table->chunk_size);
+		memset(table->frag_mask + frag_mask_words(table->size), 0,
+		    frag_mask_size(newsiz) - frag_mask_size(table->size));
+		if (table->flags & RATTTABFLHSH)
+			memset(table->hash_next + table->size, 0,
+			    (newsiz - table->size) * sizeof(size_t));
+	} else if (table->flags & RATTTABFLSEG)
+		seg_drop(table, newsiz, table->size);
+	table->size = newsiz;
+	map_track(table);
+
+	return OK;
+
+	/* put back what moved so that every array matches table->size */
+undo_frag_mask:
+	if (table->flags & RATTTABFLMAP) {
+		if (map_resize(table, newsiz, table->size) != OK)
+			debug("could not put the mapping back");
+		return FAIL;
+	}
+	frag_mask = ratt_mem_realloc(table->alloc, table->frag_mask,
+	    frag_mask_size(newsiz), frag_mask_size(table->size));
+	if (frag_mask)
+		table->frag_mask = frag_mask;
+	else
+		debug("could not put frag_mask back");
+undo_head:
+	if (table->flags & RATTTABFLSEG) {
+		if (newsiz > table->size)
+			seg_drop(table, table->size, newsiz);
+		return FAIL;
+	}
+	head = ratt_mem_realloc(table->alloc, table->head,
+	    newsiz * table->chunk_size, table->size * table->chunk_size);
+	if (head) {
 		table->head = head;
 		table->tail = (char *) head
 		    + (table->last * table->chunk_size);
+	} else
+		debug("could not put head back");
+	return FAIL;
+}
+
+int ratt_table_pos_isfrag(ratt_table_t *table, size_t pos)
+{
+	if (!ratt_table_isempty(table)
+	    && pos <= table->last)
+		return is_frag(table->frag_mask, pos);
+	return 0;
+}
+
+void *ratt_table_prev(ratt_table_t *table)
+{
+	size_t pos;
+
+	if (!ratt_table_isempty(table) && table->pos) {
+		pos = prev_live(table, table->pos - 1);
+		if (pos != RATTSIZMAX) {
+			table->pos = pos;
+			return ratt_table_addr(table, table->pos);
+		}
+		table->pos = 0;
 	}
 
-	memset((char *) table->tail + table->chunk_size, 0,
-	    (newsiz - table->size) * table->chunk_size);
-	table->size = newsiz;
+	return NULL;
+}
+
+void *ratt_table_next(ratt_table_t *table)
+{
+	size_t pos;
+
+	if (!ratt_table_isempty(table) && table->pos < table->last) {
+		pos = next_live(table, table->pos + 1);
+		if (pos <= table->last) {
+			table->pos = pos;
+			return ratt_table_addr(table, table->pos);
+		}
+		table->pos = table->last;
+	}
+	return NULL;
+}
+
+void *ratt_table_first_next(ratt_table_t *table)
+{
+	size_t pos;
+
+	if (ratt_table_first(table) != NULL) {
+		pos = next_live(table, 0);
+		if (pos <= table->last) {
+			table->pos = pos;
+			return ratt_table_addr(table, table->pos);
+		}
+	}
+	return NULL;
+}
+
+void *ratt_table_circular_next(ratt_table_t *table)
+{
+	void *chunk = NULL;
+	if ((chunk = ratt_table_next(table)) != NULL) {
+		return chunk;
+	}
+	return ratt_table_first_next(table);
+}
+
+/*
+ * Iterators read the table only; the casts below are for the inline
+ * helpers which take no const table.
+ */
+void *ratt_table_iter_first(ratt_table_iter_t *it, ratt_table_t const *table)
+{
+	it->table = table;
+	it->pos = 0;
+
+	if (ratt_table_isempty((ratt_table_t *) table))
+		return NULL;
+
+	it->pos = next_live(table, 0);
+	if (it->pos > table->last) {
+		it->pos = table->last;
+		return NULL;
+	}
+	return ratt_table_addr(table, it->pos);
+}
+
+void *ratt_table_iter_last(ratt_table_iter_t *it, ratt_table_t const *table)
+{
+	it->table = table;
+	it->pos = 0;
+
+	if (ratt_table_isempty((ratt_table_t *) table))
+		return NULL;
+
+	it->pos = table->last;	/* the tail is always live */
+	return ratt_table_addr(table, it->pos);
+}
+
+/* first live chunk at or after pos */
+void *ratt_table_iter_at(ratt_table_iter_t *it, ratt_table_t const *table,
+                         size_t pos)
+{
+	it->table = table;
+	it->pos = 0;
+
+	if (ratt_table_isempty((ratt_table_t *) table) || pos > table->last)
+		return NULL;
+
+	it->pos = next_live(table, pos);
+	if (it->pos > table->last) {
+		it->pos = table->last;
+		return NULL;
+	}
+	return ratt_table_addr(table, it->pos);
+}
+
+void *ratt_table_iter_next(ratt_table_iter_t *it)
+{
+	ratt_table_t const *table = it->table;
+	size_t pos;
+
+	if (ratt_table_isempty((ratt_table_t *) table)
+	    || it->pos >= table->last)
+		return NULL;
+
+	pos = next_live(table, it->pos + 1);
+	if (pos > table->last)
+		return NULL;
+
+	it->pos = pos;
+	return ratt_table_addr(table, it->pos);
+}
+
+void *ratt_table_iter_prev(ratt_table_iter_t *it)
+{
+	ratt_table_t const *table = it->table;
+	size_t pos;
+
+	if (ratt_table_isempty((ratt_table_t *) table) || !it->pos)
+		return NULL;
+
+	pos = prev_live(table, it->pos - 1);
+	if (pos == RATTSIZMAX)
+		return NULL;
+
+	it->pos = pos;
+	return ratt_table_addr(table, it->pos);
+}
+
+void *ratt_table_iter_search(ratt_table_iter_t *it, ratt_table_t const *table,
+                             int (*comp)(void const *, void const *),
+                             void const *compdata)
+{
+	void *chunk = NULL;
+	size_t link;
+
+	if ((table->flags & RATTTABFLHSH) && comp == table->hash->compare) {
+		it->table = table;
+		it->pos = 0;
+		if (ratt_table_isempty((ratt_table_t *) table))
+			return NULL;
+		link = hash_index_lookup(table, compdata, comp, compdata);
+		if (!link)
+			return NULL;
+		it->pos = link - 1;
+		return ratt_table_addr(table, it->pos);
+	}
+
+	RATT_TABLE_ITER_FOREACH(table, it, chunk)
+	{
+		if (comp(chunk, compdata) == MATCH)
+			return chunk;
+	}
+
+	return NULL;
+}
+
+int ratt_table_search(ratt_table_t *table, void **retchunk,
+                      int (*comp)(void const *, void const *),
+                      void const *compdata)
+{
+	RATTLOG_TRACE();
+	void *chunk = NULL;
+
+	if ((table->flags & RATTTABFLHSH) && comp == table->hash->compare) {
+		if (hash_index_find(table, compdata, comp, compdata) == OK) {
+			*retchunk = ratt_table_current(table);
+			return OK;
+		}
+		*retchunk = NULL;
+		return FAIL;
+	}
 
+	chunk = ratt_table_current(table);
+	if (chunk && (comp(chunk, compdata) == MATCH)) {
+		*retchunk = chunk;
+		return OK;
+	} else
+		RATT_TABLE_FOREACH(table, chunk)
+		{
+			if (chunk && (comp(chunk, compdata) == MATCH)) {
+				*retchunk = chunk;
+				return OK;
+			}
+		}
+
+	*retchunk = NULL;
+	return FAIL;
+}
+
+/*
+ * ratt_table_bsearch() finds in a sorted table the first chunk for which
+ * comp(chunk, key) gives 0; comp orders chunks against the key the way
+ * the order callback orders chunks.
+ */
+int ratt_table_bsearch(ratt_table_t *table, void **retchunk,
+                       int (*comp)(void const *, void const *),
+                       void const *key)
+{
+	RATTLOG_TRACE();
+	size_t pos;
+
+	*retchunk = NULL;
+	if (!(table->flags & RATTTABFLSRT)) {
+		debug("table at %p is not sorted", table);
+		return FAIL;
+	}
+
+	pos = next_live(table, sorted_bound(table, comp, key, 0));
+	if (ratt_table_isempty(table) || pos > table->last
+	    || comp(ratt_table_addr(table, pos), key))
+		return FAIL;
+
+	table->pos = pos;
+	*retchunk = ratt_table_addr(table, pos);
 	return OK;
 }
 
-int ratt_table_pos_isfrag(ratt_table_t *table, size_t pos)
+/*
+ * Bulk scans go through a table one frag_mask word at a time: the key
+ * mask of the 64 chunks of a word is taken against the live mask of the
+ * word, so fragments cost nothing and no chunk is handed out one call
+ * at a time.  The chunks of a word are contiguous in both layouts as a
+ * segmented block holds a multiple of 64 chunks.
+ *
+ * Tables of bare keys get their key masks from SSE2 or AVX2, picked at
+ * runtime; others, and words running past the allocated chunks, are
+ * compared one live chunk at a time.
+ */
+typedef uint64_t (*key_mask_t)(void const *, uint64_t);
+
+static key_mask_t l_key_mask[2];	/* 32 and 64 bits keys */
+static int l_key_mask_init = 0;
+
+static inline uint64_t live_mask(ratt_table_t const *table, size_t base)
+{
+	uint64_t live = ~((uint64_t) 0);
+
+	if (ratt_table_fragmented((ratt_table_t *) table))
+		live = ~(table->frag_mask[base / FRAG_MASK_BITS]);
+	if (table->last - base < FRAG_MASK_BITS - 1)
+		live &= ~((uint64_t) 0)
+		    >> (FRAG_MASK_BITS - 1 - (table->last - base));
+	return live;
+}
+
+static uint64_t key_mask_scalar(unsigned char const *key, size_t stride,
+                                size_t width, uint64_t value, uint64_t live)
+{
+	uint64_t mask = 0, key64;
+	uint32_t key32;
+	size_t i;
+
+	for (; live; live &= live - 1) {
+		i = fsbset(live);
+		if (width == sizeof(uint32_t)) {
+			memcpy(&key32, key + i * stride, sizeof(uint32_t));
+			key64 = key32;
+		} else
+			memcpy(&key64, key + i * stride, sizeof(uint64_t));
+		if (key64 == value)
+			mask |= ((uint64_t) 1) << i;
+	}
+
+	return mask;
+}
+
+#ifdef HAVE_TABLE_SIMD
+__attribute__((target("sse2")))
+static uint64_t key_mask_u32_sse2(void const *keys, uint64_t value)
+{
+	__m128i const v = _mm_set1_epi32((int) (uint32_t) value);
+	__m128i const *p = keys;
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < FRAG_MASK_BITS; i += 4, p++)
+		mask |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(
+		    _mm_cmpeq_epi32(_mm_loadu_si128(p), v))) << i;
+	return mask;
+}
+
+/* SSE2 has no 64 bits compare: both halves must match */
+__attribute__((target("sse2")))
+static uint64_t key_mask_u64_sse2(void const *keys, uint64_t value)
+{
+	__m128i const v = _mm_set1_epi64x((long long) value);
+	__m128i const *p = keys;
+	__m128i eq;
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < FRAG_MASK_BITS; i += 2, p++) {
+		eq = _mm_cmpeq_epi32(_mm_loadu_si128(p), v);
+		eq = _mm_and_si128(eq,
+		    _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		mask |= (uint64_t) _mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+	}
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t key_mask_u32_avx2(void const *keys, uint64_t value)
+{
+	__m256i const v = _mm256_set1_epi32((int) (uint32_t) value);
+	__m256i const *p = keys;
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < FRAG_MASK_BITS; i += 8, p++)
+		mask |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(
+		    _mm256_cmpeq_epi32(_mm256_loadu_si256(p), v))) << i;
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t key_mask_u64_avx2(void const *keys, uint64_t value)
 {
-	uint8_t const *slot = table->frag_mask;
-	if (!ratt_table_isempty(table)
-	    && pos <= table->last)
-		shift_mask_slot(slot, pos);
-		return (*slot & shift_mask(pos));
-	return 0;
+	__m256i const v = _mm256_set1_epi64x((long long) value);
+	__m256i const *p = keys;
+	uint64_t mask = 0;
+	int i;
+
+	for (i = 0; i < FRAG_MASK_BITS; i += 4, p++)
+		mask |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(
+		    _mm256_cmpeq_epi64(_mm256_loadu_si256(p), v))) << i;
+	return mask;
 }
+#endif
 
-void *ratt_table_prev(ratt_table_t *table)
+/* pick key masks once; racing threads pick the same */
+static void key_mask_init(void)
 {
-	if (!ratt_table_isempty(table)) {
-		while (table->pos) {
-			table->pos--;
-
-			if (ratt_table_fragmented(table)
-			    && ratt_table_pos_isfrag(table, table->pos))
-				continue;
-
-			return (char *) table->head
-			    + (table->pos * table->chunk_size);
-		}
+	if (__atomic_load_n(&l_key_mask_init, __ATOMIC_ACQUIRE))
+		return;
+
+#ifdef HAVE_TABLE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		l_key_mask[0] = key_mask_u32_avx2;
+		l_key_mask[1] = key_mask_u64_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		l_key_mask[0] = key_mask_u32_sse2;
+		l_key_mask[1] = key_mask_u64_sse2;
 	}
+#endif
 
-	return NULL;
+	__atomic_store_n(&l_key_mask_init, 1, __ATOMIC_RELEASE);
 }
 
-void *ratt_table_next(ratt_table_t *table)
+static int find_key(ratt_table_t *table, void **retchunk, size_t offset,
+                    size_t width, uint64_t value)
 {
-	if (!ratt_table_isempty(table)) {
-		while ((table->pos + 1) <= table->last) {
-			table->pos++;
-			if (ratt_table_fragmented(table)
-			    && ratt_table_pos_isfrag(table, table->pos))
-				continue;
-
-			return (char *) table->head
-			    + (table->pos * table->chunk_size);
+	key_mask_t simd = NULL;
+	unsigned char const *keys;
+	uint64_t live, mask;
+	size_t base;
+
+	*retchunk = NULL;
+	if (offset + width > table->chunk_size) {
+		debug("key at %u runs past chunk size %u",
+		    offset, table->chunk_size);
+		return FAIL;
+	} else if (ratt_table_isempty(table))
+		return FAIL;
+
+	key_mask_init();
+	if (table->chunk_size == width)
+		simd = l_key_mask[width == sizeof(uint64_t)];
+
+	for (base = 0; base <= table->last; base += FRAG_MASK_BITS) {
+		live = live_mask(table, base);
+		if (!live)
+			continue;
+
+		keys = (unsigned char const *) ratt_table_addr(table, base)
+		    + offset;
+		if (simd && ((table->flags & RATTTABFLSEG)
+		    || base + FRAG_MASK_BITS <= table->size))
+			mask = simd(keys, value) & live;
+		else
+			mask = key_mask_scalar(keys, table->chunk_size,
+			    width, value, live);
+
+		if (mask) {
+			table->pos = base + fsbset(mask);
+			*retchunk = ratt_table_addr(table, table->pos);
+			return OK;
 		}
 	}
-	return NULL;
+
+	return FAIL;
 }
 
-void *ratt_table_first_next(ratt_table_t *table)
+/*
+ * ratt_table_find_u32() and ratt_table_find_u64() find the first chunk
+ * whose key, at offset in the chunk, equals value.
+ */
+int ratt_table_find_u32(ratt_table_t *table, void **retchunk,
+                        size_t offset, uint32_t value)
 {
-	void *chunk = NULL;
-	if ((chunk = ratt_table_first(table)) != NULL) {
-		if (!ratt_table_fragmented(table)
-		    || !ratt_table_pos_isfrag(table, table->pos))
-			return chunk;
-	}
-	return ratt_table_next(table);
+	RATTLOG_TRACE();
+	return find_key(table, retchunk, offset, sizeof(uint32_t), value);
 }
 
-void *ratt_table_circular_next(ratt_table_t *table)
+int ratt_table_find_u64(ratt_table_t *table, void **retchunk,
+                        size_t offset, uint64_t value)
 {
-	void *chunk = NULL;
-	if ((chunk = ratt_table_next(table)) != NULL) {
-		return chunk;
-	}
-	return ratt_table_first_next(table);
+	RATTLOG_TRACE();
+	return find_key(table, retchunk, offset, sizeof(uint64_t), value);
 }
 
-int ratt_table_search(ratt_table_t *table, void **retchunk,
-                      int (*comp)(void const *, void const *),
-                      void const *compdata)
+/* number of chunks for which comp(chunk, compdata) matches */
+size_t ratt_table_count_if(ratt_table_t *table,
+                           int (*comp)(void const *, void const *),
+                           void const *compdata)
 {
 	RATTLOG_TRACE();
-	void *chunk = NULL;
-
-	chunk = ratt_table_current(table);
-	if (chunk && (comp(chunk, compdata) == MATCH)) {
-		*retchunk = chunk;
-		return OK;
-	} else
-		RATT_TABLE_FOREACH(table, chunk)
-		{
-			if (chunk && (comp(chunk, compdata) == MATCH)) {
-				*retchunk = chunk;
-				return OK;
-			}
-		}
+	unsigned char const *chunks;
+	uint64_t live;
+	size_t base, cnt = 0;
+
+	if (ratt_table_isempty(table))
+		return 0;
+
+	for (base = 0; base <= table->last; base += FRAG_MASK_BITS) {
+		chunks = ratt_table_addr(table, base);
+		for (live = live_mask(table, base); live; live &= live - 1)
+			if (comp(chunks + fsbset(live) * table->chunk_size,
+			    compdata) == MATCH)
+				cnt++;
+	}
 
-	*retchunk = NULL;
-	return FAIL;
+	return cnt;
 }
 
 int ratt_table_satisfy_constrains(ratt_table_t *table, void const *chunk)
 {
 	RATTLOG_TRACE();
 	void *match = NULL;
+	int retval;
 
 	if (!table->constrains)	/* table has no constrain */
 		return OK;
 
+	if (table->flags & RATTTABFLHSH) {
+		retval = hash_index_find(table, table->hash->key(chunk),
+		    table->constrains, chunk);
+		return (retval == OK) ? FAIL : OK;
+	}
+
 	ratt_table_search(table, &match, table->constrains, chunk);
 	if (!match)	/* constrains did not match */
 		return OK;
@@ -310,8 +1311,8 @@ int ratt_table_satisfy_constrains(ratt_table_t *table, void const *chunk)
 int ratt_table_set_pos_frag_first(ratt_table_t *table)
 {
 	RATTLOG_TRACE();
-	uint8_t *slot, *slot_last = table->frag_mask;
-	size_t i, pos = 0;
+	uint64_t *slot, *slot_last = table->frag_mask;
+	size_t i;
 
 	if (!ratt_table_fragmented(table)) {
 		debug("table is not fragmented");
@@ -321,15 +1322,66 @@ int ratt_table_set_pos_frag_first(ratt_table_t *table)
 	shift_mask_slot(slot_last, table->last);
 	for (i = 0, slot = table->frag_mask; slot <= slot_last; slot++, i++) {
 		if (*slot) {
-			pos = fsbset(*slot);
-			debug("fsbset() gives %u in slot_mask(%u)", pos, i);
-			break;
+			table->pos = fsbset(*slot) + i * FRAG_MASK_BITS;
+			debug("fsbset() gives %u in slot_mask(%u)",
+			    fsbset(*slot), i);
+			return OK;
 		}
 	}
 
-	table->pos = pos + i * 8;
+	debug("fragment counter is set but frag_mask is clear");
+	return FAIL;
+}
 
-	return OK;
+/*
+ * Deleting the tail moves it back to the previous live chunk; fragments
+ * skipped along the way are no longer fragments as they lie past the
+ * tail.  Deleting the very last chunk leaves an empty table at head.
+ */
+static void retract_tail(ratt_table_t *table)
+{
+	uint64_t *slot = table->frag_mask;
+	size_t pos;
+
+	pos = (table->last) ? prev_live(table, table->last - 1) : RATTSIZMAX;
+	if (pos == RATTSIZMAX)	/* no live chunk left */
+		pos = 0;
+
+	if (!table->chunk_count) {	/* head was freed too */
+		memset(slot, 0, frag_mask_size(table->last));
+		table->frag_count = 0;
+	} else if (pos + 1 < table->last)
+		frag_mask_clear(slot, pos + 1, table->last - 1,
+		    &(table->frag_count));
+
+	table->pos = table->last = pos;
+	table->tail = ratt_table_addr(table, pos);
+	map_track(table);
+	debug("moved tail back to %p", table->tail);
+}
+
+/*
+ * With RATTTABFLSHR, a table whose tail retracted below 1/RATTTABSHRRATIO
+ * of its size shrinks to twice the room in use so that it does not
+ * grow again right away.  Chunks never move here; ratt_table_compact()
+ * does that.
+ */
+static void shrink_to_tail(ratt_table_t *table)
+{
+	size_t newsiz = 2 * (table->last + 1);
+
+	if ((table->flags & RATTTABFLNRA)
+	    || table->last + 1 > table->size / RATTTABSHRRATIO)
+		return;
+	if (newsiz < RATTTABMINSIZ)
+		newsiz = RATTTABMINSIZ;
+
+	if (table_resize(table, newsiz) != OK) {
+		debug("could not shrink table at %p", table->head);
+		return;
+	}
+
+	debug("table at %p shrank to %u chunks", table->head, table->size);
 }
 
 int ratt_table_del_current(ratt_table_t *table)
@@ -337,6 +1389,9 @@ int ratt_table_del_current(ratt_table_t *table)
 	RATTLOG_TRACE();
 	void *chunk = NULL;
 
+	if (table_write(table) != OK)
+		return FAIL;
+
 	chunk = ratt_table_current(table);
 	if (!chunk) {
 		debug("ratt_table_current() failed");
@@ -347,18 +1402,20 @@ int ratt_table_del_current(ratt_table_t *table)
 	}
 
 	debug("deleting chunk at %p", chunk);
+	if (table->flags & RATTTABFLHSH)
+		hash_index_del(table, table->pos);
 	memset(chunk, 0, table->chunk_size);
 	table->chunk_count--;
 
 	/* if chunk is the tail, move the tail back */
-	if (ratt_table_istail(table, chunk)
-	    && !ratt_table_ishead(table, chunk)) {
-		table->tail = (char *) chunk - table->chunk_size;
-		table->pos = --table->last;
-		debug("moved tail back to %p", table->tail);
+	if (ratt_table_istail(table, chunk)) {
+		retract_tail(table);
+		if (table->flags & RATTTABFLSHR)
+			shrink_to_tail(table);
 	} else	/* handle fragmentation */
 		frag_mask_set(table->frag_mask,
 		    table->pos, &(table->frag_count));
+	map_track(table);
 
 	return OK;
 }
@@ -372,6 +1429,9 @@ int ratt_table_get_tail_next(ratt_table_t *table, void **tail)
 #ifdef DEBUG
 	size_t oldsiz = 0;
 #endif
+	if (table_write(table) != OK)
+		return FAIL;
+
 	if (!ratt_table_isempty(table) && (table->last + 1) >= table->size) {
 		if (table->flags & RATTTABFLNRA) { /* forbid realloc */
 			debug("table is full with %i chunks",
@@ -382,7 +1442,7 @@ int ratt_table_get_tail_next(ratt_table_t *table, void **tail)
 #ifdef DEBUG
 		oldsiz = table->size;
 #endif
-		retval = realloc_and_move(table);
+		retval = table_resize(table, grow_size(table));
 		if (retval != OK) {
 			debug("could not realloc table at %p", table->head);
 			return FAIL;
@@ -392,13 +1452,16 @@ int ratt_table_get_tail_next(ratt_table_t *table, void **tail)
 	}
 
 	if (!ratt_table_isempty(table)) { /* table is not empty */
-		next = (char *) table->tail + table->chunk_size;
 		table->pos = ++(table->last);	/* push resets position */
-	} else
+		next = ratt_table_addr(table, table->last);
+	} else {
 		next = table->head;
+		table->pos = table->last = 0;
+	}
 
 	table->chunk_count++;
 	*tail = table->tail = next;
+	map_track(table);
 
 	return OK;
 }
@@ -408,6 +1471,9 @@ int ratt_table_get_frag_first(ratt_table_t *table, void **next)
 	RATTLOG_TRACE();
 	int retval;
 
+	if (table_write(table) != OK)
+		return FAIL;
+
 	if ((!ratt_table_fragmented(table))	/* table not fragmented */
 	    || (table->flags & RATTTABFLNRU))	/* forbid fragment reuse */
 		return ratt_table_get_tail_next(table, next);
@@ -432,6 +1498,7 @@ int ratt_table_get_frag_first(ratt_table_t *table, void **next)
 	}
 
 	table->chunk_count++;
+	map_track(table);
 
 	return OK;
 }
@@ -448,16 +1515,199 @@ int ratt_table_insert(ratt_table_t *table, void const *chunk)
 	return write_chunk(table, chunk, ratt_table_get_frag_first);
 }
 
+int ratt_table_reserve(ratt_table_t *table, size_t cnt)
+{
+	RATTLOG_TRACE();
+	size_t hash_size;
+
+	if (!ratt_table_exists(table)) {
+		debug("table at %p does not exist", table);
+		return FAIL;
+	} else if (cnt > RATTTABMAXSIZ) {
+		debug("asked for size %u when maximum is %u",
+		    cnt, RATTTABMAXSIZ);
+		return FAIL;
+	} else if (table_write(table) != OK)
+		return FAIL;
+
+	if (cnt > table->size && table_resize(table, cnt) != OK) {
+		debug("table_resize() failed");
+		return FAIL;
+	}
+
+	/* size the index too, rebuilding it once rather than every time */
+	if (table->flags & RATTTABFLHSH) {
+		hash_size = table->hash_size;
+		while (hash_size < cnt)
+			hash_size *= 2;
+		if (hash_size != table->hash_size
+		    && hash_index_resize(table, hash_size) != OK) {
+			debug("hash_index_resize() failed");
+			return FAIL;
+		}
+	}
+
+	return OK;
+}
+
+/*
+ * compact_chunks() fills every fragment: the tail moves into the first
+ * fragment until none is left, or in a sorted table every live chunk
+ * slides down in order.  It gives the number of chunks moved.
+ */
+static size_t compact_chunks(ratt_table_t *table)
+{
+	size_t pos = 0, from, run, moved = 0;
+
+	if (!ratt_table_fragmented(table))
+		return 0;
+
+	if (table->flags & RATTTABFLSRT) {
+		/* slide whole runs of live chunks, never a segmented table */
+		pos = next_frag(table, 0);
+		for (from = next_live(table, pos); from <= table->last;
+		    from = next_live(table, run)) {
+			run = next_frag(table, from);
+			if (run > table->last)
+				run = table->last + 1;
+			memmove(ratt_table_addr(table, pos),
+			    ratt_table_addr(table, from),
+			    (run - from) * table->chunk_size);
+			pos += run - from;
+			moved += run - from;
+		}
+		memset(ratt_table_addr(table, pos), 0,
+		    (table->last + 1 - pos) * table->chunk_size);
+		memset(table->frag_mask, 0, frag_mask_size(table->last));
+		table->frag_count = 0;
+		table->pos = table->last = pos - 1;
+		table->tail = ratt_table_addr(table, table->last);
+		map_track(table);
+	} else
+		while (ratt_table_fragmented(table)) {
+			pos = next_frag(table, pos);
+			memcpy(hash_chunk(table, pos), table->tail,
+			    table->chunk_size);
+			memset(table->tail, 0, table->chunk_size);
+			frag_mask_unset(table->frag_mask, pos,
+			    &(table->frag_count));
+			retract_tail(table);
+			moved++;
+		}
+
+	if (moved && (table->flags & RATTTABFLHSH))
+		hash_index_fill(table);
+
+	return moved;
+}
+
+/*
+ * Compaction fills every fragment then shrinks the table to fit.
+ * Chunks past the first fragment may change position, so positions and
+ * pointers held on them are stale.
+ */
+int ratt_table_compact(ratt_table_t *table)
+{
+	RATTLOG_TRACE();
+#ifdef DEBUG
+	size_t moved;
+#endif
+
+	if (!ratt_table_exists(table)) {
+		debug("table at %p does not exist", table);
+		return FAIL;
+	} else if (table_write(table) != OK)
+		return FAIL;
+
+#ifdef DEBUG
+	moved = compact_chunks(table);
+	debug("moved %u chunks of table at %p", moved, table->head);
+#else
+	compact_chunks(table);
+#endif
+
+	if (!(table->flags & RATTTABFLNRA)
+	    && table_resize(table, table->last + 1) != OK) {
+		debug("table_resize() failed");
+		return FAIL;
+	}
+
+	return OK;
+}
+
+/*
+ * ratt_table_set_order() sorts a table with order and keeps it sorted
+ * from then on; a NULL order leaves the table unsorted again.  Sorting
+ * compacts the table first.  Chunks move, thus segmented tables cannot
+ * be sorted; writers must go through ratt_table_push() or
+ * ratt_table_insert(), which both insert in order.
+ */
+int ratt_table_set_order(ratt_table_t *table,
+                         int (*order)(void const *, void const *))
+{
+	RATTLOG_TRACE();
+
+	if (!ratt_table_exists(table)) {
+		debug("table at %p does not exist", table);
+		return FAIL;
+	} else if (table_write(table) != OK)
+		return FAIL;
+	else if (!order) {
+		table->flags &= ~RATTTABFLSRT;
+		table->order = NULL;
+		return OK;
+	} else if (table->flags & RATTTABFLSEG) {
+		debug("chunks of segmented table at %p never move", table);
+		return FAIL;
+	}
+
+	table->flags &= ~RATTTABFLSRT;
+	compact_chunks(table);
+	if (!ratt_table_isempty(table)) {
+		qsort(table->head, ratt_table_count(table),
+		    table->chunk_size, order);
+		if (table->flags & RATTTABFLHSH)
+			hash_index_fill(table);
+	}
+
+	table->order = order;
+	table->flags |= RATTTABFLSRT;
+	return OK;
+}
+
 int ratt_table_destroy(ratt_table_t *table)
 {
 	RATTLOG_TRACE();
 	if (table && table->head) {
+		if (table->flags & RATTTABFLHSH) {
+			debug("freeing hash index of table at %p", table);
+			ratt_mem_free(table->alloc, table->hash_bucket,
+			    table->hash_size * sizeof(size_t));
+			ratt_mem_free(table->alloc, table->hash_next,
+			    table->size * sizeof(size_t));
+		}
+		if (table->flags & RATTTABFLMAP) {
+			if (!(table->flags & RATTTABFLRDO))
+				ratt_table_sync(table);
+			debug("unmapping table at %p", table->head);
+			munmap(table->map, table->map_size);
+			close(table->map_fd);
+			memset(table, 0, sizeof(ratt_table_t));
+			return OK;
+		}
 		if (table->frag_mask) {
 			debug("freeing frag_mask at %p", table->frag_mask);
-			free(table->frag_mask);
+			ratt_mem_free(table->alloc, table->frag_mask,
+			    frag_mask_size(table->size));
 		}
 		debug("freeing table at %p", table->head);
-		free(table->head);
+		if (table->flags & RATTTABFLSEG) {
+			seg_drop(table, 0, table->size);
+			ratt_mem_free(table->alloc, table->block,
+			    table->block_count * sizeof(void *));
+		} else
+			ratt_mem_free(table->alloc, table->head,
+			    table->size * table->chunk_size);
 		memset(table, 0, sizeof(ratt_table_t));
 		return OK;
 	}
@@ -466,7 +1716,8 @@ int ratt_table_destroy(ratt_table_t *table)
 	return FAIL;
 }
 
-int ratt_table_create(ratt_table_t *table, size_t cnt, size_t size, int flags)
+int ratt_table_create_alloc(ratt_table_t *table, size_t cnt, size_t size,
+                            int flags, ratt_alloc_t const *alloc)
 {
 	RATTLOG_TRACE();
 
@@ -484,20 +1735,39 @@ int ratt_table_create(ratt_table_t *table, size_t cnt, size_t size, int flags)
 	}
 
 	memset(table, 0, sizeof(ratt_table_t));
-
-	table->head = calloc(cnt, size);
+	table->alloc = alloc;
+
+	/* a segmented table starts with one block of at least cnt chunks */
+	if (flags & RATTTABFLSEG) {
+		while ((((size_t) 1) << table->block_shift) < cnt
+		    || (((size_t) 1) << table->block_shift) < RATTTABSEGSIZMIN)
+			table->block_shift++;
+		cnt = ((size_t) 1) << table->block_shift;
+		table->block = ratt_mem_calloc(alloc, 1, sizeof(void *));
+		if (!table->block) {
+			error("memory allocation failed");
+			debug("calloc() failed");
+			return FAIL;
+		}
+		table->block_count = 1;
+		table->block[0] = ratt_mem_calloc(alloc, cnt, size);
+		table->head = table->block[0];
+	} else
+		table->head = ratt_mem_calloc(alloc, cnt, size);
 	if (!table->head) {
 		error("memory allocation failed");
 		debug("calloc() failed");
+		ratt_mem_free(alloc, table->block, sizeof(void *));
 		return FAIL;
 	}
 
 	/* always have frag_mask, even if no reuse flag given */
-	table->frag_mask = calloc(1, frag_mask_size(cnt));
+	table->frag_mask = ratt_mem_calloc(alloc, 1, frag_mask_size(cnt));
 	if (!table->frag_mask) {
 		error("memory allocation failed");
 		debug("calloc() failed");
-		free(table->head);
+		ratt_mem_free(alloc, table->head, cnt * size);
+		ratt_mem_free(alloc, table->block, sizeof(void *));
 		return FAIL;
 	}
 
@@ -512,3 +1782,276 @@ int ratt_table_create(ratt_table_t *table, size_t cnt, size_t size, int flags)
 
 	return OK;
 }
+
+int ratt_table_create(ratt_table_t *table, size_t cnt, size_t size, int flags)
+{
+	return ratt_table_create_alloc(table, cnt, size, flags, NULL);
+}
+
+int ratt_table_create_hashed_alloc(ratt_table_t *table, size_t cnt,
+                                   size_t size, int flags,
+                                   ratt_table_hash_t const *hash,
+                                   ratt_alloc_t const *alloc)
+{
+	RATTLOG_TRACE();
+	size_t hash_size = RATTTABHSHSIZMIN;
+	int retval;
+
+	if (!hash || !hash->key || !hash->hash || !hash->compare) {
+		debug("hash index information is incomplete");
+		return FAIL;
+	}
+
+	retval = ratt_table_create_alloc(table, cnt, size, flags, alloc);
+	if (retval != OK) {
+		debug("ratt_table_create_alloc() failed");
+		return FAIL;
+	}
+
+	cnt = ratt_table_size(table);	/* segmented, rounded up */
+	while (hash_size < cnt)
+		hash_size *= 2;
+
+	table->hash_bucket = ratt_mem_calloc(alloc, hash_size, sizeof(size_t));
+	table->hash_next = ratt_mem_calloc(alloc, cnt, sizeof(size_t));
+	if (!table->hash_bucket || !table->hash_next) {
+		error("memory allocation failed");
+		debug("calloc() failed");
+		ratt_mem_free(alloc, table->hash_bucket,
+		    hash_size * sizeof(size_t));
+		ratt_mem_free(alloc, table->hash_next, cnt * sizeof(size_t));
+		ratt_table_destroy(table);
+		return FAIL;
+	}
+
+	table->hash = hash;
+	table->hash_size = hash_size;
+	table->flags |= RATTTABFLHSH;
+
+	debug("table at %p indexed with %u buckets", table, hash_size);
+
+	return OK;
+}
+
+int ratt_table_create_hashed(ratt_table_t *table, size_t cnt, size_t size,
+                             int flags, ratt_table_hash_t const *hash)
+{
+	return ratt_table_create_hashed_alloc(table, cnt, size, flags, hash,
+	    NULL);
+}
+
+/*
+ * map_repair() counts the fragments of a table whose file was not
+ * synced again from its frag_mask, up to the tail kept in the header.
+ * Chunks written in place since the last sync may be half written.
+ */
+static void map_repair(ratt_table_t *table, int rdonly)
+{
+	map_header_t *header = table->map;
+	size_t i;
+
+	table->frag_count = 0;
+	for (i = 0; i < frag_mask_words(table->last); ++i)
+		table->frag_count += __builtin_popcountll(table->frag_mask[i]);
+
+	/* a table at head holds one chunk unless it was emptied */
+	table->chunk_count = 0;
+	if (header->chunk_count || table->last)
+		table->chunk_count = table->last + 1 - table->frag_count;
+
+	debug("repaired table with %u chunks and %u fragments",
+	    table->chunk_count, table->frag_count);
+	if (!rdonly) {
+		header->chunk_count = table->chunk_count;
+		header->frag_count = table->frag_count;
+	}
+}
+
+/*
+ * map_open() maps the table file at path, creating it for cnt chunks of
+ * size bytes if it is empty, and checks its header.
+ */
+static int map_open(ratt_table_t *table, char const *path, size_t cnt,
+                    size_t size, int flags)
+{
+	int rdonly = (flags & RATTTABFLRDO);
+	map_header_t *header = NULL;
+	struct stat st;
+
+	table->map_fd = open(path, (rdonly) ? O_RDONLY | O_CLOEXEC
+	    : O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (table->map_fd < 0) {
+		debug("open() failed on `%s': %s", path, strerror(errno));
+		return FAIL;
+	} else if (rdonly && flock(table->map_fd, LOCK_SH) != 0) {
+		debug("flock() failed on `%s': %s", path, strerror(errno));
+		goto close_file;
+	} else if (fstat(table->map_fd, &st) != 0) {
+		debug("fstat() failed on `%s': %s", path, strerror(errno));
+		goto close_file;
+	}
+
+	table->map_size = st.st_size;
+	if (!st.st_size && !rdonly) {	/* new table */
+		table->map_size = map_file_size(cnt, size);
+		if (ftruncate(table->map_fd, table->map_size) != 0) {
+			debug("ftruncate() failed: %s", strerror(errno));
+			goto close_file;
+		}
+	} else if (table->map_size < map_head_offset()) {
+		debug("`%s' holds no table", path);
+		goto close_file;
+	}
+
+	table->map = mmap(NULL, table->map_size, (rdonly) ? PROT_READ
+	    : PROT_READ | PROT_WRITE, MAP_SHARED, table->map_fd, 0);
+	if (table->map == MAP_FAILED) {
+		debug("mmap() failed: %s", strerror(errno));
+		goto close_file;
+	}
+
+	header = table->map;
+	if (!st.st_size) {
+		header->magic = RATTTABMAPMAGIC;
+		header->version = RATTTABMAPVERSION;
+		header->chunk_size = size;
+		header->size = cnt;
+	} else if (header->magic != RATTTABMAPMAGIC
+	    || header->version != RATTTABMAPVERSION) {
+		debug("`%s' holds no table of version %u",
+		    path, RATTTABMAPVERSION);
+		goto unmap_file;
+	} else if (header->chunk_size != size
+	    || header->size < RATTTABMINSIZ
+	    || header->size > RATTTABMAXSIZ
+	    || header->last >= header->size
+	    || table->map_size < map_file_size(header->size, size)) {
+		debug("`%s' holds a table of another layout", path);
+		goto unmap_file;
+	} else if (header->dirty && !(flags & RATTTABFLRPR)) {
+		debug("`%s' was not synced", path);
+		goto unmap_file;
+	}
+
+	table->head = (char *) table->map + map_head_offset();
+	table->frag_mask = (uint64_t *) ((char *) table->map
+	    + map_frag_offset(header->size, size));
+	table->size = header->size;
+	table->last = table->pos = header->last;
+	table->chunk_count = header->chunk_count;
+	table->frag_count = header->frag_count;
+	table->chunk_size = size;
+	table->tail = (char *) table->head + table->last * size;
+	if (header->dirty && (flags & RATTTABFLRPR))
+		map_repair(table, rdonly);
+	return OK;
+
+unmap_file:
+	munmap(table->map, table->map_size);
+close_file:
+	close(table->map_fd);
+	return FAIL;
+}
+
+/* flags a mapped table honours */
+#define RATTTABMAPFLAGS	(RATTTABFLNRA | RATTTABFLNRU | RATTTABFLGR2 \
+	| RATTTABFLGRP | RATTTABFLGRH | RATTTABFLSHR | RATTTABFLRDO \
+	| RATTTABFLRPR)
+
+/*
+ * ratt_table_create_mmap() maps a table from the file at path, creating
+ * it with room for cnt chunks if the file is empty; chunks and fragments
+ * come back as they were at the last ratt_table_sync(), paged in on
+ * first access.  With RATTTABFLRDO the file is mapped read only and may
+ * be shared by any number of processes; writes to the file show through
+ * their mapping as they happen, but their tail and counters are those of
+ * the open, and the writer cannot resize the file while they hold it.
+ * A file that was not synced, such as one still being written to, is
+ * refused unless RATTTABFLRPR is given, which repairs it; read only
+ * tables repair their own counters and leave the file alone.  Mapped
+ * tables cannot be segmented nor hashed; they may be sorted afterwards
+ * with ratt_table_set_order().
+ */
+int ratt_table_create_mmap(ratt_table_t *table, char const *path, size_t cnt,
+                           size_t size, int flags)
+{
+	RATTLOG_TRACE();
+
+	if (ratt_table_exists(table)) {
+		debug("table at %p exists already", table);
+		return FAIL;
+	} else if (cnt < RATTTABMINSIZ || cnt > RATTTABMAXSIZ) {
+		debug("asked for size %u out of %u to %u",
+		    cnt, RATTTABMINSIZ, RATTTABMAXSIZ);
+		return FAIL;
+	} else if (flags & ~RATTTABMAPFLAGS) {
+		debug("flags %x cannot be honoured by a mapped table",
+		    flags & ~RATTTABMAPFLAGS);
+		return FAIL;
+	}
+
+	memset(table, 0, sizeof(ratt_table_t));
+	if (map_open(table, path, cnt, size, flags) != OK) {
+		error("could not map table from `%s'", path);
+		debug("map_open() failed");
+		memset(table, 0, sizeof(ratt_table_t));
+		return FAIL;
+	}
+
+	/* table exists now */
+	table->flags = RATTTABFLXIS | RATTTABFLMAP | (flags & ~RATTTABFLRPR);
+
+	debug("mapped table at %p from `%s' with %u chunks",
+	    table, path, table->chunk_count);
+
+	return OK;
+}
+
+/* ratt_table_sync() writes a mapped table back to its file */
+int ratt_table_sync(ratt_table_t *table)
+{
+	RATTLOG_TRACE();
+	map_header_t *header = NULL;
+
+	if (!(table->flags & RATTTABFLMAP)
+	    || (table->flags & RATTTABFLRDO)) {
+		debug("table at %p is not mapped for writing", table);
+		return FAIL;
+	}
+
+	header = table->map;
+	header->size = table->size;
+	header->last = table->last;
+	header->chunk_count = table->chunk_count;
+	header->frag_count = table->frag_count;
+	if (msync(table->map, table->map_size, MS_SYNC) != 0) {
+		debug("msync() failed: %s", strerror(errno));
+		return FAIL;
+	}
+
+	/* the header goes clean only once the chunks are on disk */
+	header->dirty = 0;
+	if (msync(table->map, map_head_offset(), MS_SYNC) != 0) {
+		debug("msync() failed: %s", strerror(errno));
+		return FAIL;
+	}
+
+	return OK;
+}
+
+/* FNV-1a hash of a NULL-terminated string; NULL hashes to 0 */
+size_t ratt_table_hash_string(void const *key)
+{
+	unsigned char const *str = key;
+	uint64_t hash = 14695981039346656037ULL;
+
+	if (!str)
+		return 0;
+
+	while (*str) {
+		hash ^= *str++;
+		hash *= 1099511628211ULL;
+	}
+
+	return (size_t) hash;
+}
@@ -0,0 +1,155 @@
+/*
+ * RATTLE read-copy-update helper
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <rattle.h>
+#include <rattle/rcu.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Epochs only grow; a reader which announced epoch e went through a
+ * quiescent state after the writer which started epoch e moved on.
+ * The lock guards the readers list only: a writer lets go of it while
+ * it waits on a reader, then looks over the list again, and goes
+ * offline itself meanwhile so that writers never wait on each other.
+ */
+void ratt_rcu_synchronize(ratt_rcu_t *rcu, ratt_rcu_reader_t *self)
+{
+	RATTLOG_TRACE();
+	ratt_rcu_reader_t *reader = NULL;
+	uint64_t target, epoch, online = 0;
+
+	/* we hold nothing */
+	if (self) {
+		online = __atomic_load_n(&(self->epoch), __ATOMIC_ACQUIRE);
+		ratt_rcu_offline(self);
+	}
+
+	target = __atomic_add_fetch(&(rcu->epoch), 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&(rcu->lock));
+	for (reader = rcu->reader; reader; ) {
+		epoch = __atomic_load_n(&(reader->epoch), __ATOMIC_ACQUIRE);
+		if (reader == self || !epoch || epoch >= target) {
+			reader = reader->next;
+			continue;
+		}
+
+		/* readers may come and go meanwhile */
+		pthread_mutex_unlock(&(rcu->lock));
+		sched_yield();
+		pthread_mutex_lock(&(rcu->lock));
+		reader = rcu->reader;
+	}
+	pthread_mutex_unlock(&(rcu->lock));
+
+	if (online)
+		ratt_rcu_online(rcu, self);
+	debug("rcu at %p went through epoch %u", rcu, target);
+}
+
+int ratt_rcu_register(ratt_rcu_t *rcu, ratt_rcu_reader_t *reader)
+{
+	RATTLOG_TRACE();
+
+	if (!ratt_rcu_exists(rcu)) {
+		debug("rcu at %p does not exist", rcu);
+		return FAIL;
+	}
+
+	memset(reader, 0, sizeof(ratt_rcu_reader_t));
+
+	pthread_mutex_lock(&(rcu->lock));
+	reader->next = rcu->reader;
+	rcu->reader = reader;
+	pthread_mutex_unlock(&(rcu->lock));
+
+	ratt_rcu_online(rcu, reader);
+	return OK;
+}
+
+void ratt_rcu_unregister(ratt_rcu_t *rcu, ratt_rcu_reader_t *reader)
+{
+	RATTLOG_TRACE();
+	ratt_rcu_reader_t **link = NULL;
+
+	ratt_rcu_offline(reader);
+
+	pthread_mutex_lock(&(rcu->lock));
+	for (link = &(rcu->reader); *link; link = &((*link)->next)) {
+		if (*link == reader) {
+			*link = reader->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(rcu->lock));
+}
+
+int ratt_rcu_destroy(ratt_rcu_t *rcu)
+{
+	RATTLOG_TRACE();
+
+	if (!ratt_rcu_exists(rcu)) {
+		debug("rcu at %p is already destroyed", rcu);
+		return FAIL;
+	}
+
+	if (rcu->reader)
+		debug("rcu at %p still has readers", rcu);
+
+	pthread_mutex_destroy(&(rcu->lock));
+	memset(rcu, 0, sizeof(ratt_rcu_t));
+	return OK;
+}
+
+int ratt_rcu_create(ratt_rcu_t *rcu)
+{
+	RATTLOG_TRACE();
+
+	if (ratt_rcu_exists(rcu)) {
+		debug("rcu at %p exists already", rcu);
+		return FAIL;
+	}
+
+	memset(rcu, 0, sizeof(ratt_rcu_t));
+	if (pthread_mutex_init(&(rcu->lock), NULL)) {
+		debug("pthread_mutex_init() failed");
+		return FAIL;
+	}
+
+	rcu->epoch = 1;
+	rcu->flags = RATTRCUFLXIS;
+	return OK;
+}
@@ -0,0 +1,86 @@
+#ifndef RATT_DATA_RCU_H
+#define RATT_DATA_RCU_H
+
+/* cache line size, readers announce apart from each other */
+#ifndef RATTRCULINESIZ
+#define RATTRCULINESIZ		64
+#endif
+
+/* rcu flags */
+#define RATTRCUFLXIS	0x1	/* rcu exists */
+
+/*
+ * read-copy-update information
+ *
+ * Writers publish a new copy of some data with ratt_rcu_assign() then
+ * wait in ratt_rcu_synchronize() before freeing the old one.  Readers
+ * load it with ratt_rcu_dereference() and take no lock; a reader only
+ * announces once in a while, with a plain store, that it holds no
+ * reference anymore (a quiescent state).  A reader going to sleep goes
+ * offline so that writers do not wait on it.
+ *
+ * The writer waits for every online reader to have announced after
+ * the epoch it started; readers registered later cannot have seen the
+ * old copy.  A writer which is a reader itself passes its own reader,
+ * offline while it waits.
+ */
+struct ratt_rcu_reader {
+	uint64_t epoch;		/* epoch announced last, 0 offline */
+	struct ratt_rcu_reader *next;	/* next reader */
+} __attribute__((aligned(RATTRCULINESIZ)));
+
+typedef struct ratt_rcu_reader ratt_rcu_reader_t;
+
+struct ratt_rcu {
+	uint64_t epoch;		/* current epoch, from 1 */
+	pthread_mutex_t lock;	/* readers list and writers */
+	ratt_rcu_reader_t *reader;	/* registered readers */
+	int flags;		/* rcu flags */
+};
+
+typedef struct ratt_rcu ratt_rcu_t;
+
+#define ratt_rcu_dereference(ptr) __atomic_load_n(&(ptr), __ATOMIC_CONSUME)
+#define ratt_rcu_assign(ptr, val) \
+	__atomic_store_n(&(ptr), (val), __ATOMIC_RELEASE)
+
+static inline
+int ratt_rcu_exists(ratt_rcu_t *rcu)
+{
+	return (rcu->flags & RATTRCUFLXIS);
+}
+
+/* reader holds no reference from here on; no atomic RMW */
+static inline
+void ratt_rcu_quiescent(ratt_rcu_t *rcu, ratt_rcu_reader_t *reader)
+{
+	__atomic_store_n(&(reader->epoch),
+	    __atomic_load_n(&(rcu->epoch), __ATOMIC_ACQUIRE),
+	    __ATOMIC_RELEASE);
+}
+
+static inline
+void ratt_rcu_offline(ratt_rcu_reader_t *reader)
+{
+	__atomic_store_n(&(reader->epoch), 0, __ATOMIC_RELEASE);
+}
+
+/* the announce must be seen before the reader loads anything again */
+static inline
+void ratt_rcu_online(ratt_rcu_t *rcu, ratt_rcu_reader_t *reader)
+{
+	__atomic_store_n(&(reader->epoch),
+	    __atomic_load_n(&(rcu->epoch), __ATOMIC_ACQUIRE),
+	    __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#define RATT_RCU_INIT(rcu) ratt_rcu_t (rcu) = { 0 }
+
+extern int ratt_rcu_create(ratt_rcu_t *);
+extern int ratt_rcu_destroy(ratt_rcu_t *);
+extern int ratt_rcu_register(ratt_rcu_t *, ratt_rcu_reader_t *);
+extern void ratt_rcu_unregister(ratt_rcu_t *, ratt_rcu_reader_t *);
+extern void ratt_rcu_synchronize(ratt_rcu_t *, ratt_rcu_reader_t *);
+
+#endif /* RATT_DATA_RCU_H */
@@ -0,0 +1,183 @@
+/*
+ * RATTLE ring helper
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <rattle.h>
+#include <rattle/ring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * The ring follows the bounded multi-producer multi-consumer queue
+ * layout where every slot owns a sequence number:
+ *
+ * seq == pos		slot is free for the producer at position pos
+ * seq == pos + 1	slot is filled for the consumer at position pos
+ *
+ * A producer (consumer) claims position pos by moving enqueue_pos
+ * (dequeue_pos) forward with a compare and swap, copies the chunk
+ * then publishes the slot by storing its next sequence number.
+ * A thread never waits on another; push fails when the ring is full
+ * and pop fails when it is empty.
+ */
+#define slot_chunk(ring, pos) \
+	((char *) (ring)->head + (((pos) & ((ring)->size - 1)) \
+	    * (ring)->chunk_size))
+#define slot_seq(ring, pos) (&((ring)->seq[(pos) & ((ring)->size - 1)]))
+
+int ratt_ring_push(ratt_ring_t *ring, void const *chunk)
+{
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&(ring->enqueue_pos), __ATOMIC_RELAXED);
+	for (;;) {
+		seq = __atomic_load_n(slot_seq(ring, pos), __ATOMIC_ACQUIRE);
+		diff = (intptr_t) seq - (intptr_t) pos;
+		if (!diff) {		/* slot is free, claim it */
+			if (__atomic_compare_exchange_n(&(ring->enqueue_pos),
+			    &pos, pos + 1, 1, __ATOMIC_RELAXED,
+			    __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {	/* slot not consumed yet */
+			debug("ring at %p is full", ring);
+			return FAIL;
+		} else			/* another producer got it */
+			pos = __atomic_load_n(&(ring->enqueue_pos),
+			    __ATOMIC_RELAXED);
+	}
+
+	memcpy(slot_chunk(ring, pos), chunk, ring->chunk_size);
+	__atomic_store_n(slot_seq(ring, pos), pos + 1, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+int ratt_ring_pop(ratt_ring_t *ring, void *chunk)
+{
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&(ring->dequeue_pos), __ATOMIC_RELAXED);
+	for (;;) {
+		seq = __atomic_load_n(slot_seq(ring, pos), __ATOMIC_ACQUIRE);
+		diff = (intptr_t) seq - (intptr_t) (pos + 1);
+		if (!diff) {		/* slot is filled, claim it */
+			if (__atomic_compare_exchange_n(&(ring->dequeue_pos),
+			    &pos, pos + 1, 1, __ATOMIC_RELAXED,
+			    __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {	/* slot not produced yet */
+			return FAIL;
+		} else			/* another consumer got it */
+			pos = __atomic_load_n(&(ring->dequeue_pos),
+			    __ATOMIC_RELAXED);
+	}
+
+	memcpy(chunk, slot_chunk(ring, pos), ring->chunk_size);
+	__atomic_store_n(slot_seq(ring, pos),
+	    pos + ring->size, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+int ratt_ring_destroy(ratt_ring_t *ring)
+{
+	RATTLOG_TRACE();
+	if (ring && ring->head) {
+		debug("freeing sequence numbers at %p", ring->seq);
+		free(ring->seq);
+		debug("freeing ring at %p", ring->head);
+		free(ring->head);
+		memset(ring, 0, sizeof(ratt_ring_t));
+		return OK;
+	}
+
+	debug("ring at %p is already freed", ring);
+	return FAIL;
+}
+
+int ratt_ring_create(ratt_ring_t *ring, size_t cnt, size_t size, int flags)
+{
+	RATTLOG_TRACE();
+	size_t i, ringsiz = RATTRINGSIZMIN;
+
+	if (ratt_ring_exists(ring)) {
+		debug("ring at %p exists already", ring);
+		return FAIL;
+	} else if (cnt < RATTRINGSIZMIN) {
+		debug("asked for size %u when minimum is %u",
+		    cnt, RATTRINGSIZMIN);
+		return FAIL;
+	} else if (cnt > RATTRINGSIZMAX) {
+		debug("asked for size %u when maximum is %u",
+		    cnt, RATTRINGSIZMAX);
+		return FAIL;
+	}
+
+	/* positions wrap around with a mask, round size up */
+	while (ringsiz < cnt)
+		ringsiz *= 2;
+
+	memset(ring, 0, sizeof(ratt_ring_t));
+
+	ring->head = calloc(ringsiz, size);
+	if (!ring->head) {
+		error("memory allocation failed");
+		debug("calloc() failed");
+		return FAIL;
+	}
+
+	ring->seq = calloc(ringsiz, sizeof(size_t));
+	if (!ring->seq) {
+		error("memory allocation failed");
+		debug("calloc() failed");
+		free(ring->head);
+		ring->head = NULL;
+		return FAIL;
+	}
+
+	/* every slot is free for the first lap */
+	for (i = 0; i < ringsiz; ++i)
+		ring->seq[i] = i;
+
+	ring->size = ringsiz;
+	ring->chunk_size = size;
+
+	/* ring exists now */
+	ring->flags = RATTRINGFLXIS | flags;
+
+	debug("created new ring at %p with head at %p", ring, ring->head);
+
+	return OK;
+}
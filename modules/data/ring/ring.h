@@ -0,0 +1,85 @@
+#ifndef RATT_DATA_RING_H
+#define RATT_DATA_RING_H
+
+/* ring flags */
+#define RATTRINGFLXIS	0x1	/* ring exists */
+
+/* minimum ring size; cannot be lower than 2 */
+#ifndef RATTRINGSIZMIN
+#define RATTRINGSIZMIN		2
+#endif
+
+/* maximum ring size; must be a power of two */
+#ifndef RATTRINGSIZMAX
+#define RATTRINGSIZMAX		(((size_t) 1) << (sizeof(size_t) * 8 - 2))
+#endif
+
+/* cache line size, producers and consumers positions lie apart */
+#ifndef RATTRINGLINESIZ
+#define RATTRINGLINESIZ		64
+#endif
+
+/*
+ * ring information
+ *
+ * A ring is a bounded queue of fixed size chunks which any number of
+ * threads may push to and pop from at the same time without locking.
+ * Each slot carries a sequence number telling whether it is free for
+ * the producer or filled for the consumer at a given ring position.
+ */
+struct ratt_ring {
+	size_t enqueue_pos;	/* producers position */
+	char enqueue_pad[RATTRINGLINESIZ - sizeof(size_t)];
+
+	size_t dequeue_pos;	/* consumers position */
+	char dequeue_pad[RATTRINGLINESIZ - sizeof(size_t)];
+
+	void *head;		/* head of ring */
+	size_t *seq;		/* slot sequence numbers */
+	size_t size;		/* size of ring; a power of two */
+	size_t chunk_size;	/* chunk size */
+
+	int flags;		/* ring flags */
+} __attribute__((aligned(RATTRINGLINESIZ)));
+
+typedef struct ratt_ring ratt_ring_t;
+
+static inline
+size_t ratt_ring_size(ratt_ring_t *ring)
+{
+	return ring->size;
+}
+
+static inline
+int ratt_ring_exists(ratt_ring_t *ring)
+{
+	return (ring->flags & RATTRINGFLXIS);
+}
+
+static inline
+size_t ratt_ring_count(ratt_ring_t *ring)
+{
+	/* a hint only, producers and consumers may be moving */
+	size_t enqueue, dequeue;
+
+	dequeue = __atomic_load_n(&(ring->dequeue_pos), __ATOMIC_RELAXED);
+	enqueue = __atomic_load_n(&(ring->enqueue_pos), __ATOMIC_RELAXED);
+
+	return (enqueue > dequeue) ? enqueue - dequeue : 0;
+}
+
+static inline
+int ratt_ring_isempty(ratt_ring_t *ring)
+{
+	/* true if ring does not exist yet or no chunk pushed yet */
+	return (!ratt_ring_exists(ring) || !ratt_ring_count(ring));
+}
+
+#define RATT_RING_INIT(ring) ratt_ring_t (ring) = { 0 }
+
+extern int ratt_ring_create(ratt_ring_t *, size_t, size_t, int);
+extern int ratt_ring_destroy(ratt_ring_t *);
+extern int ratt_ring_push(ratt_ring_t *, void const *);
+extern int ratt_ring_pop(ratt_ring_t *, void *);
+
+#endif /* RATT_DATA_RING_H */
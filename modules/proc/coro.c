@@ -0,0 +1,665 @@
+/*
+ * RATTLE processor coroutines
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A process registered with RATTPROCFLCOR runs on a stack of its own
+ * and may give the processor back halfway through with ratt_proc_yield()
+ * or ratt_proc_wait_fd(). The processor only ever sees a sticky resume
+ * process standing for the coroutine, registered plainly while it is
+ * runnable and with the awaited descriptor while it waits, so any
+ * processor resumes it; an event-driven one only once the descriptor
+ * is ready.  The others run it on each pass: when the descriptor is not
+ * ready the wait moves to a timer, checked back twice as late each time
+ * up to PROC_CORO_POLL_MAX, then tries the descriptor again.
+ *
+ * Runs and failures are accounted per coroutine, as its process and
+ * user data, never as the resume process.
+ *
+ * Coroutines are known to the processor by id, never by address, and
+ * their records are recycled rather than freed, so a resume picked just
+ * before a cancel finds nothing and leaves. Stacks are guard-paged and
+ * pooled.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+
+#include "coro.h"
+#include "fail.h"
+#include "hist.h"
+#include "timer.h"
+
+#ifdef HAVE_UCONTEXT_H
+#include <poll.h>
+#include <ucontext.h>
+
+#include <sys/mman.h>
+
+/* usable stack of a coroutine */
+#ifndef PROC_CORO_STACK
+#define PROC_CORO_STACK		(64 * 1024)
+#endif
+
+/* stacks kept for reuse */
+#ifndef PROC_CORO_POOL
+#define PROC_CORO_POOL		64
+#endif
+
+/* first check back on a descriptor not ready, in microseconds */
+#ifndef PROC_CORO_POLL
+#define PROC_CORO_POLL		1000
+#endif
+
+/* latest check back on a descriptor not ready, in microseconds */
+#ifndef PROC_CORO_POLL_MAX
+#define PROC_CORO_POLL_MAX	64000
+#endif
+
+/* coroutine table initial size */
+#ifndef PROC_CORO_TABSIZ
+#define PROC_CORO_TABSIZ	64
+#endif
+
+typedef enum {
+	PROC_CORO_STATE_NEW = 0,	/* not started yet */
+	PROC_CORO_STATE_RUN,		/* yielded, runnable */
+	PROC_CORO_STATE_WAIT,		/* waiting on a descriptor */
+	PROC_CORO_STATE_DONE		/* process returned */
+} proc_coro_state_t;
+
+typedef struct proc_coro {
+	uintptr_t id;			/* resume udata, 0 if recycled */
+	int (*process)(void *);		/* process pointer */
+	ratt_proc_attr_t *user_attr;	/* process attributes */
+	void *udata;			/* process user data */
+
+	ratt_proc_attr_t attr;		/* resume while runnable */
+	ratt_proc_attr_t wait_attr;	/* resume once fd is ready */
+	ratt_proc_attr_t time_attr;	/* resume on a timer */
+	ratt_proc_attr_t *reg;		/* resume registered, if any */
+	int timed;			/* resume on a timer instead */
+	unsigned int idle;		/* checks back on a descriptor */
+
+	ucontext_t ctx;			/* coroutine context */
+	ucontext_t *caller;		/* context resuming us */
+	void *stack;			/* stack mapping, guard first */
+
+	proc_coro_state_t state;
+	int retval;			/* of the process, once done */
+	ratt_proc_health_t health;	/* failures of a sticky one */
+	ratt_proc_hist_t *hist;		/* run latencies, NULL if none */
+	int busy;			/* running somewhere */
+	int cancel;			/* unregistered while running */
+
+	struct proc_coro *next;		/* next free record */
+	struct proc_coro *all;		/* next of every record */
+} proc_coro_t;
+
+/* live coroutines, indexed by id */
+static RATT_TABLE_INIT(l_corotab);
+static pthread_mutex_t l_coro_lock = PTHREAD_MUTEX_INITIALIZER;
+static uintptr_t l_coro_id = 0;
+
+static proc_coro_t *l_coro_all = NULL;	/* every record ever made */
+static proc_coro_t *l_coro_free = NULL;	/* records to recycle */
+static size_t l_coro_pooled = 0;	/* stacks on the free records */
+static size_t l_coro_page = 0;
+
+static __thread proc_coro_t *l_coro_current = NULL;
+static __thread ucontext_t l_coro_caller;
+
+/* processor interface */
+static int (*l_coro_register)(int (*)(void *), ratt_proc_attr_t *, void *);
+static void (*l_coro_unregister)(int (*)(void *), ratt_proc_attr_t *, void *);
+
+static int compare_coro(void const *in, void const *find)
+{
+	proc_coro_t * const *co = in;
+	uintptr_t const *id = find;
+	return ((*co)->id == *id) ? MATCH : NOMATCH;
+}
+
+static void const *key_coro(void const *in)
+{
+	proc_coro_t * const *co = in;
+	return &((*co)->id);
+}
+
+static size_t hash_coro(void const *key)
+{
+	uintptr_t const *id = key;
+	return (size_t) *id;
+}
+
+static ratt_table_hash_t const l_corotab_hash = {
+	.key = key_coro,
+	.hash = hash_coro,
+	.compare = compare_coro,
+};
+
+static proc_coro_t *coro_find(uintptr_t id)
+{
+	proc_coro_t **co = NULL;
+
+	ratt_table_search(&l_corotab, (void **) &co, compare_coro, &id);
+	return co ? *co : NULL;
+}
+
+static void *coro_stack(void)
+{
+	char *stack;
+
+	stack = mmap(NULL, PROC_CORO_STACK + l_coro_page,
+	    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+	    -1, 0);
+	if (stack == MAP_FAILED) {
+		debug("mmap() failed");
+		return NULL;
+	}
+
+	/* stacks grow down onto the guard */
+	if (mprotect(stack, l_coro_page, PROT_NONE) != 0) {
+		debug("mprotect() failed");
+		munmap(stack, PROC_CORO_STACK + l_coro_page);
+		return NULL;
+	}
+
+	return stack;
+}
+
+/* caller holds l_coro_lock */
+static void coro_recycle(proc_coro_t *co)
+{
+	co->id = 0;
+	co->reg = NULL;
+	co->timed = 0;
+
+	if (!co->stack) {
+		/* nothing to pool */
+	} else if (l_coro_pooled < PROC_CORO_POOL) {
+		l_coro_pooled++;
+	} else {
+		munmap(co->stack, PROC_CORO_STACK + l_coro_page);
+		co->stack = NULL;
+	}
+
+	/* the record itself stays; a resume may still be on its way */
+	co->user_attr = NULL;
+	co->busy = co->cancel = 0;
+	co->next = l_coro_free;
+	l_coro_free = co;
+}
+
+/* caller holds l_coro_lock */
+static void coro_drop(proc_coro_t *co)
+{
+	proc_coro_t **entry = NULL;
+
+	ratt_table_search(&l_corotab, (void **) &entry,
+	    compare_coro, &(co->id));
+	if (entry)
+		ratt_table_del_current(&l_corotab);
+}
+
+/* caller holds l_coro_lock */
+static proc_coro_t *coro_alloc(void)
+{
+	proc_coro_t *co = l_coro_free;
+
+	if (co) {
+		l_coro_free = co->next;
+		if (co->stack)
+			l_coro_pooled--;
+	} else {
+		co = calloc(1, sizeof(proc_coro_t));
+		if (!co) {
+			debug("calloc() failed");
+			return NULL;
+		}
+		co->all = l_coro_all;
+		l_coro_all = co;
+	}
+
+	if (!co->stack) {
+		co->stack = coro_stack();
+		if (!co->stack) {
+			coro_recycle(co);
+			return NULL;
+		}
+	}
+
+	return co;
+}
+
+static void coro_main(void)
+{
+	proc_coro_t *co = l_coro_current;
+
+	co->retval = co->process(co->udata);
+	co->state = PROC_CORO_STATE_DONE;
+	/* a sticky one gets a fresh context before it is resumed */
+	swapcontext(&(co->ctx), co->caller);
+}
+
+static int coro_ready(proc_coro_t const *co)
+{
+	struct pollfd pfd = { .fd = co->wait_attr.fd };
+
+	if (co->wait_attr.events & RATTPROCEVRD)
+		pfd.events |= POLLIN;
+	if (co->wait_attr.events & RATTPROCEVWR)
+		pfd.events |= POLLOUT;
+
+	return (poll(&pfd, 1, 0) != 0);
+}
+
+static int coro_resume(void *);
+
+/* caller holds l_coro_lock; resume at until, a ratt_proc_clock() */
+static int coro_sleep(proc_coro_t *co, uint64_t until)
+{
+	co->time_attr.deadline = until;
+	if (proc_timer_arm(coro_resume, &(co->time_attr),
+	    (void *) co->id) != OK)
+		return FAIL;
+	co->timed = 1;
+	return OK;
+}
+
+/*
+ * caller holds l_coro_lock; the descriptor was not ready. Past a check
+ * on the timer the resume waits on the descriptor, otherwise it checks
+ * back later on the timer.
+ */
+static int coro_idle(proc_coro_t *co, int timed)
+{
+	uint64_t usec;
+
+	if (timed && l_coro_register(coro_resume, &(co->wait_attr),
+	    (void *) co->id) == OK) {
+		co->reg = &(co->wait_attr);
+		return OK;
+	}
+
+	if (co->reg)
+		l_coro_unregister(coro_resume, co->reg, (void *) co->id);
+	co->reg = NULL;
+
+	usec = (uint64_t) PROC_CORO_POLL << co->idle;
+	if (usec >= PROC_CORO_POLL_MAX)
+		usec = PROC_CORO_POLL_MAX;
+	else
+		co->idle++;
+
+	return coro_sleep(co, ratt_proc_clock() + usec);
+}
+
+/* caller holds l_coro_lock; FAIL if the sticky coroutine is evicted */
+static int coro_account(proc_coro_t *co)
+{
+	ratt_proc_entry_t entry = { co->process, co->user_attr, co->udata };
+
+	if (co->retval == OK && !co->health.failed)
+		return OK;
+	return proc_fail_account(&entry, co->retval, &(co->health));
+}
+
+/* resume process standing for a coroutine */
+static int coro_resume(void *udata)
+{
+	uintptr_t id = (uintptr_t) udata;
+	ratt_proc_attr_t *want = NULL;
+	proc_coro_t *co = NULL;
+	uint64_t since, until = 0;
+	int timed, ready;
+
+	pthread_mutex_lock(&l_coro_lock);
+	co = coro_find(id);
+	if (!co || co->busy) {
+		pthread_mutex_unlock(&l_coro_lock);
+		return OK;
+	}
+	co->busy = 1;
+	/* nothing else stands for it while on the timer */
+	timed = co->timed;
+	co->timed = 0;
+	pthread_mutex_unlock(&l_coro_lock);
+
+	ready = (co->state != PROC_CORO_STATE_WAIT || coro_ready(co));
+
+	/* a cancel may have come since busy was set, before what is ready */
+	pthread_mutex_lock(&l_coro_lock);
+	if (co->cancel || !ready) {
+		co->busy = 0;
+		if (co->cancel) {
+			coro_recycle(co);
+		} else if (coro_idle(co, timed) != OK) {
+			error("coroutine %p lost its resume", co->process);
+			coro_drop(co);
+			coro_recycle(co);
+		}
+		pthread_mutex_unlock(&l_coro_lock);
+		return OK;
+	}
+	pthread_mutex_unlock(&l_coro_lock);
+	co->idle = 0;
+
+	if (co->state == PROC_CORO_STATE_NEW) {
+		getcontext(&(co->ctx));
+		co->ctx.uc_stack.ss_sp = (char *) co->stack + l_coro_page;
+		co->ctx.uc_stack.ss_size = PROC_CORO_STACK;
+		co->ctx.uc_link = NULL;
+		makecontext(&(co->ctx), coro_main, 0);
+	}
+
+	co->caller = &l_coro_caller;
+	l_coro_current = co;
+	since = ratt_proc_nclock();
+	swapcontext(&l_coro_caller, &(co->ctx));
+	ratt_proc_hist_record(co->hist, ratt_proc_nclock() - since);
+	l_coro_current = NULL;
+
+	pthread_mutex_lock(&l_coro_lock);
+	co->busy = 0;
+	if (co->cancel) {
+		/* unregistered while it ran, resume is gone already */
+		coro_recycle(co);
+		pthread_mutex_unlock(&l_coro_lock);
+		return OK;
+	}
+
+	switch (co->state) {
+	case PROC_CORO_STATE_WAIT:
+		want = &(co->wait_attr);
+		break;
+	case PROC_CORO_STATE_DONE:
+		if (!(co->user_attr->flags & RATTPROCFLSTC)
+		    || coro_account(co) != OK)
+			break;
+		co->state = PROC_CORO_STATE_NEW;
+		/* a failing one rests on the timer */
+		if (co->health.retry)
+			until = co->health.retry;
+		else
+			want = &(co->attr);
+		break;
+	default:
+		want = &(co->attr);
+		break;
+	}
+
+	if (want != co->reg) {
+		if (co->reg)
+			l_coro_unregister(coro_resume, co->reg, udata);
+		co->reg = NULL;
+		if (want && l_coro_register(coro_resume, want, udata) != OK) {
+			error("coroutine %p lost its resume", co->process);
+			want = NULL;
+		}
+		co->reg = want;
+	}
+
+	if (until && coro_sleep(co, until) != OK)
+		error("coroutine %p lost its resume", co->process);
+
+	if (!co->reg && !co->timed) {
+		coro_drop(co);
+		coro_recycle(co);
+	}
+	pthread_mutex_unlock(&l_coro_lock);
+	return OK;
+}
+
+/* true if process stands for coroutines, which are timed on their own */
+int proc_coro_resumer(int (*process)(void *))
+{
+	return (process == coro_resume);
+}
+
+void proc_coro_cancel(int (*process)(void *),
+                      ratt_proc_attr_t *attr,
+                      void *udata)
+{
+	RATTLOG_TRACE();
+	proc_coro_t **entry = NULL, *co = NULL;
+
+	pthread_mutex_lock(&l_coro_lock);
+	RATT_TABLE_FOREACH(&l_corotab, entry)
+	{
+		if ((*entry)->process == process && (*entry)->udata == udata) {
+			co = *entry;
+			break;
+		}
+	}
+	if (!co) {
+		debug("no matching coroutine found");
+		pthread_mutex_unlock(&l_coro_lock);
+		return;
+	}
+
+	if (co->reg)
+		l_coro_unregister(coro_resume, co->reg, (void *) co->id);
+	co->reg = NULL;
+	if (co->timed)
+		proc_timer_cancel(coro_resume, &(co->time_attr),
+		    (void *) co->id);
+	co->timed = 0;
+	coro_drop(co);
+
+	if (co->busy)
+		co->cancel = 1;
+	else
+		coro_recycle(co);
+	pthread_mutex_unlock(&l_coro_lock);
+}
+
+int proc_coro_spawn(int (*process)(void *),
+                    ratt_proc_attr_t *attr,
+                    void *udata)
+{
+	RATTLOG_TRACE();
+	proc_coro_t *co = NULL;
+	int retval;
+
+	if (attr->events || proc_timer_timed(attr)) {
+		error("coroutine %p cannot wait on descriptors or timers"
+		    " through its attributes", process);
+		return FAIL;
+	}
+
+	pthread_mutex_lock(&l_coro_lock);
+	co = coro_alloc();
+	if (!co) {
+		debug("coro_alloc() failed");
+		goto fail;
+	}
+
+	/* ids stay unique through recycling, zero is none */
+	if (!++l_coro_id)
+		++l_coro_id;
+	co->id = l_coro_id;
+	co->process = process;
+	co->user_attr = attr;
+	co->udata = udata;
+	co->state = PROC_CORO_STATE_NEW;
+	co->idle = 0;
+	memset(&(co->health), 0, sizeof(ratt_proc_health_t));
+	co->hist = proc_hist_get(process, udata);
+
+	co->attr = *attr;
+	co->attr.flags = (attr->flags | RATTPROCFLSTC) & ~RATTPROCFLCOR;
+	co->wait_attr = co->attr;
+	co->time_attr = co->attr;
+	co->time_attr.flags &= ~RATTPROCFLSTC;
+
+	retval = ratt_table_push(&l_corotab, &co);
+	if (retval != OK) {
+		debug("ratt_table_push() failed");
+		coro_recycle(co);
+		goto fail;
+	}
+
+	retval = l_coro_register(coro_resume, &(co->attr), (void *) co->id);
+	if (retval != OK) {
+		debug("registering coroutine %p failed", process);
+		coro_drop(co);
+		coro_recycle(co);
+		goto fail;
+	}
+	co->reg = &(co->attr);
+
+	pthread_mutex_unlock(&l_coro_lock);
+	return OK;
+
+fail:
+	pthread_mutex_unlock(&l_coro_lock);
+	return FAIL;
+}
+
+void proc_coro_fini(void)
+{
+	RATTLOG_TRACE();
+	proc_coro_t *co = NULL;
+
+	pthread_mutex_lock(&l_coro_lock);
+	while (l_coro_all) {
+		co = l_coro_all;
+		l_coro_all = co->all;
+		if (co->stack)
+			munmap(co->stack, PROC_CORO_STACK + l_coro_page);
+		free(co);
+	}
+	l_coro_free = NULL;
+	l_coro_pooled = 0;
+	ratt_table_destroy(&l_corotab);
+	pthread_mutex_unlock(&l_coro_lock);
+}
+
+int proc_coro_init(
+    int (*reg)(int (*)(void *), ratt_proc_attr_t *, void *),
+    void (*unreg)(int (*)(void *), ratt_proc_attr_t *, void *))
+{
+	RATTLOG_TRACE();
+	int retval;
+
+	retval = ratt_table_create_hashed(&l_corotab, PROC_CORO_TABSIZ,
+	    sizeof(proc_coro_t *), 0, &l_corotab_hash);
+	if (retval != OK) {
+		debug("ratt_table_create_hashed() failed");
+		return FAIL;
+	}
+
+	l_coro_page = sysconf(_SC_PAGESIZE);
+	l_coro_register = reg;
+	l_coro_unregister = unreg;
+	return OK;
+}
+
+void ratt_proc_yield(void)
+{
+	proc_coro_t *co = l_coro_current;
+
+	if (!co) {
+		debug("not a coroutine, nothing to yield");
+		return;
+	}
+
+	co->state = PROC_CORO_STATE_RUN;
+	swapcontext(&(co->ctx), co->caller);
+}
+
+int ratt_proc_wait_fd(int fd, uint32_t events)
+{
+	proc_coro_t *co = l_coro_current;
+
+	if (!co) {
+		debug("not a coroutine, cannot wait");
+		return FAIL;
+	}
+
+	co->wait_attr.fd = fd;
+	co->wait_attr.events = events;
+	co->state = PROC_CORO_STATE_WAIT;
+	swapcontext(&(co->ctx), co->caller);
+	return OK;
+}
+
+#else /* !HAVE_UCONTEXT_H */
+
+int proc_coro_resumer(int (*process)(void *))
+{
+	return 0;
+}
+
+void proc_coro_fini(void)
+{
+}
+
+int proc_coro_init(
+    int (*reg)(int (*)(void *), ratt_proc_attr_t *, void *),
+    void (*unreg)(int (*)(void *), ratt_proc_attr_t *, void *))
+{
+	return OK;
+}
+
+void proc_coro_cancel(int (*process)(void *),
+                      ratt_proc_attr_t *attr,
+                      void *udata)
+{
+	debug("no coroutines on this platform");
+}
+
+int proc_coro_spawn(int (*process)(void *),
+                    ratt_proc_attr_t *attr,
+                    void *udata)
+{
+	error("no coroutines on this platform");
+	return FAIL;
+}
+
+void ratt_proc_yield(void)
+{
+}
+
+int ratt_proc_wait_fd(int fd, uint32_t events)
+{
+	return FAIL;
+}
+
+#endif /* HAVE_UCONTEXT_H */
@@ -0,0 +1,19 @@
+#ifndef SRC_PROC_CORO_H
+#define SRC_PROC_CORO_H
+
+#include <rattle/proc.h>
+
+/* true if attributes make a process a coroutine */
+static inline int proc_coro_coro(ratt_proc_attr_t const *attr)
+{
+	return (attr && (attr->flags & RATTPROCFLCOR));
+}
+
+void proc_coro_fini(void);
+int proc_coro_init(int (*)(int (*)(void *), ratt_proc_attr_t *, void *),
+    void (*)(int (*)(void *), ratt_proc_attr_t *, void *));
+void proc_coro_cancel(int (*)(void *), ratt_proc_attr_t *, void *);
+int proc_coro_spawn(int (*)(void *), ratt_proc_attr_t *, void *);
+int proc_coro_resumer(int (*)(void *));
+
+#endif /* SRC_PROC_CORO_H */
@@ -0,0 +1,11 @@
+#
+# proc_epoll rattle module
+#
+
+RATTLE_MODULE([proc_epoll])
+
+# readiness of descriptors, and waking up on stop
+AC_CHECK_HEADERS([sys/epoll.h sys/eventfd.h])
+
+# batched I/O submission, readiness is the fallback
+AC_CHECK_HEADERS([linux/io_uring.h])
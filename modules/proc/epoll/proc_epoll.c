@@ -0,0 +1,1059 @@
+/*
+ * RATTLE epoll module processor
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A process registered with a descriptor and readiness events is run
+ * only once epoll reports the descriptor ready; a sticky one stays
+ * registered, any other is dropped after its run. Processes without
+ * events run on every pass as with proc_serial, and while any is
+ * registered the processor polls instead of sleeping.
+ *
+ * Submitted I/O goes to an io_uring when the kernel has one, queued
+ * during a pass and handed over with a single io_uring_enter() before
+ * the next wait; the ring reports completions through epoll. Without
+ * it, reads, writes and accepts wait for readiness of the descriptor
+ * first. The owner is run once its request is over either way.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(HAVE_SYS_EPOLL_H) || !defined(HAVE_SYS_EVENTFD_H)
+#error "proc_epoll implies sys/epoll.h and sys/eventfd.h"
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+
+#define MODULE_NAME	RATT_PROC_NAME "_epoll"
+#define MODULE_DESC	"epoll processor"
+#define MODULE_VERSION	"0.1"
+
+static enum {
+	PROC_EPOLL_STATE_BOOT = 0,	/* processor has not run yet */
+	PROC_EPOLL_STATE_RUN,		/* processor is running */
+	PROC_EPOLL_STATE_STOP		/* processor stopped */
+} l_proc_state = PROC_EPOLL_STATE_BOOT;
+
+typedef struct {
+	int (*process)(void *);		/* process pointer */
+	ratt_proc_attr_t *attr;		/* process attributes */
+	void *udata;			/* process user data */
+	ratt_proc_health_t health;	/* failures of a sticky process */
+	ratt_proc_hist_t *hist;		/* run latencies, NULL if none */
+} proc_epoll_register_t;
+
+typedef struct {
+	int fd;				/* descriptor waited on */
+	int (*process)(void *);		/* process pointer */
+	ratt_proc_attr_t *attr;		/* process attributes */
+	void *udata;			/* process user data */
+	ratt_proc_hist_t *hist;		/* run latencies, NULL if none */
+} proc_epoll_fd_t;
+
+typedef struct {
+	ratt_proc_io_t *io;		/* request */
+	int (*process)(void *);		/* owner process */
+	ratt_proc_attr_t *attr;		/* owner attributes */
+	void *udata;			/* owner user data */
+	uint32_t gen;			/* generation of the slot, never 0 */
+} proc_epoll_io_t;
+
+/* process table initial size */
+#ifndef PROC_PROCTABSIZ
+#define PROC_PROCTABSIZ		4
+#endif
+
+/* descriptor table initial size */
+#ifndef PROC_EPOLL_FDTABSIZ
+#define PROC_EPOLL_FDTABSIZ	64
+#endif
+
+/* events taken from the kernel per pass */
+#ifndef PROC_EPOLL_EVENTS
+#define PROC_EPOLL_EVENTS	256
+#endif
+
+/* I/O table initial size */
+#ifndef PROC_EPOLL_IOTABSIZ
+#define PROC_EPOLL_IOTABSIZ	64
+#endif
+
+/* submission queue entries of the ring */
+#ifndef PROC_EPOLL_RING_ENTRIES
+#define PROC_EPOLL_RING_ENTRIES	256
+#endif
+
+#define PROC_EPOLL_RANKNONE	RATTPROCPRCNT	/* event has no process */
+
+/* processes without events, one table per priority class */
+static ratt_table_t l_proctab[RATTPROCPRCNT];
+/* processes waiting on descriptors, indexed by descriptor */
+static RATT_TABLE_INIT(l_fdtab);
+
+/* I/O in flight, by position */
+static RATT_TABLE_INIT(l_iotab);
+/* last generation given to a request */
+static uint32_t l_io_gen = 0;
+/* I/O waiting on readiness, sticky until done */
+static ratt_proc_attr_t l_io_attr[RATTPROCPRCNT];
+
+/* earliest end of a rest when the last pass ran nothing, else 0 */
+static uint64_t l_proc_rest = 0;
+
+static int l_epoll_fd = -1;	/* epoll instance */
+static int l_wake_fd = -1;	/* eventfd breaking a wait on stop */
+
+#ifdef HAVE_LINUX_IO_URING_H
+typedef struct {
+	int fd;				/* ring, -1 if none */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_entries;
+	unsigned int *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqe;	/* submission entries */
+	struct io_uring_cqe *cqe;	/* completion entries */
+	void *sq_map, *cq_map;		/* mapped rings */
+	size_t sq_size, cq_size, sqe_size;
+	unsigned int tail;		/* submission tail, ours */
+	unsigned int pending;		/* queued, not entered */
+} proc_epoll_ring_t;
+
+static proc_epoll_ring_t l_ring = { .fd = -1 };
+#endif
+
+/* runs per priority */
+static ratt_proc_stats_t l_stats;
+
+static int compare_process(void const *in, void const *find)
+{
+	proc_epoll_register_t const *entry = in;
+	proc_epoll_register_t const *proc = find;
+	int retval;
+
+	if (proc->process != entry->process) {
+		/* not the same process */
+		return NOMATCH;
+	}
+
+	if (proc->udata != entry->udata) {
+		/* user data did not match */
+		return NOMATCH;
+	}
+
+	if (proc->attr && entry->attr) {
+		retval = memcmp(proc->attr,
+		    entry->attr, sizeof(ratt_proc_attr_t));
+		if (retval != 0)
+			return NOMATCH;
+	} else if (proc->attr || entry->attr)
+		return NOMATCH;
+
+	return MATCH;
+}
+
+static int compare_fd(void const *in, void const *find)
+{
+	proc_epoll_fd_t const *entry = in;
+	int const *fd = find;
+	return (entry->fd == *fd) ? MATCH : NOMATCH;
+}
+
+static void const *key_fd(void const *in)
+{
+	proc_epoll_fd_t const *entry = in;
+	return &(entry->fd);
+}
+
+static size_t hash_fd(void const *key)
+{
+	int const *fd = key;
+	return (size_t) *fd;
+}
+
+/* descriptor table is indexed by descriptor */
+static ratt_table_hash_t const l_fdtab_hash = {
+	.key = key_fd,
+	.hash = hash_fd,
+	.compare = compare_fd,
+};
+
+static inline int is_sticky(ratt_proc_attr_t const *attr)
+{
+	return (attr && (attr->flags & RATTPROCFLSTC));
+}
+
+static proc_epoll_fd_t *fd_find(int fd)
+{
+	proc_epoll_fd_t *entry = NULL;
+
+	ratt_table_search(&l_fdtab, (void **) &entry, compare_fd, &fd);
+	return entry;
+}
+
+/* drop the process waiting on fd, if it is the one given */
+static int fd_release(int fd, int (*process)(void *), void *udata)
+{
+	proc_epoll_fd_t *entry = NULL;
+	int retval;
+
+	entry = fd_find(fd);
+	if (!entry || entry->process != process || entry->udata != udata)
+		return FAIL;
+
+	/* a closed descriptor left epoll already */
+	retval = epoll_ctl(l_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	if (retval != 0 && errno != EBADF && errno != ENOENT)
+		debug("epoll_ctl() failed: %s", strerror(errno));
+
+	return ratt_table_del_current(&l_fdtab);
+}
+
+static int fd_wait(int fd, uint32_t events, int (*process)(void *),
+    ratt_proc_attr_t *attr, void *udata, ratt_proc_hist_t *hist)
+{
+	proc_epoll_fd_t proc = { fd, process, attr, udata, hist };
+	struct epoll_event event = { 0 };
+	size_t pos;
+	int retval, err;
+
+	if (fd_find(fd)) {
+		debug("descriptor %i is waited on already", fd);
+		errno = EBUSY;
+		return FAIL;
+	}
+
+	retval = ratt_table_insert(&l_fdtab, &proc);
+	if (retval != OK) {
+		debug("ratt_table_insert() failed");
+		return FAIL;
+	}
+	pos = ratt_table_pos_current(&l_fdtab);
+
+	if (events & RATTPROCEVRD)
+		event.events |= EPOLLIN;
+	if (events & RATTPROCEVWR)
+		event.events |= EPOLLOUT;
+	event.data.fd = fd;
+
+	retval = epoll_ctl(l_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+	if (retval != 0) {
+		err = errno;
+		debug("epoll_ctl() failed: %s", strerror(err));
+		ratt_table_chunk(&l_fdtab, pos);
+		ratt_table_del_current(&l_fdtab);
+		errno = err;	/* callers tell files from the rest */
+		return FAIL;
+	}
+
+	debug("registered process %p on descriptor %i", process, fd);
+	return OK;
+}
+
+/*
+ * Run the process waiting on fd; it may have left since the wait.  A
+ * one-shot is released before it runs, free to wait on fd again; once
+ * it ran, a registration found on fd may be a new one.
+ */
+static void fd_run(int fd)
+{
+	proc_epoll_fd_t *entry = NULL, proc;
+	uint64_t since;
+
+	entry = fd_find(fd);
+	if (!entry)
+		return;
+
+	/* the table may move while the process runs */
+	proc = *entry;
+	if (!is_sticky(proc.attr))
+		fd_release(fd, proc.process, proc.udata);
+
+	since = ratt_proc_nclock();
+	if (proc.process(proc.udata) != OK)
+		debug("process at %p failed", proc.process);
+	ratt_proc_hist_record(proc.hist, ratt_proc_nclock() - since);
+	l_stats.runs[ratt_proc_rank_priority(ratt_proc_rank(proc.attr))]++;
+}
+
+/* request over, its owner runs once */
+static void io_done(size_t pos)
+{
+	proc_epoll_io_t *entry = NULL;
+	proc_epoll_register_t owner = { 0 };
+	int retval;
+
+	entry = ratt_table_chunk(&l_iotab, pos);
+	if (!entry) {
+		debug("no I/O on slot %u", pos);
+		return;
+	}
+	owner.process = entry->process;
+	owner.attr = entry->attr;
+	owner.udata = entry->udata;
+	owner.hist = ratt_proc_hist(owner.process, owner.udata);
+	ratt_table_del_current(&l_iotab);
+
+	retval = ratt_table_insert(&(l_proctab[ratt_proc_rank(owner.attr)]),
+	    &owner);
+	if (retval != OK)
+		error("process %p lost its I/O completion", owner.process);
+	else
+		l_proc_rest = 0;
+}
+
+/* descriptor of a request on the readiness path is ready */
+static int io_resume(void *udata)
+{
+	size_t pos = (uintptr_t) udata;
+	proc_epoll_io_t *entry = NULL;
+	ratt_proc_io_t *io = NULL;
+
+	entry = ratt_table_chunk(&l_iotab, pos);
+	if (!entry)
+		return FAIL;
+	io = entry->io;
+
+	if (ratt_proc_io_perform(io) == -EAGAIN)
+		return OK;	/* someone else took it */
+
+	fd_release(io->fd, io_resume, udata);
+	io_done(pos);
+	return OK;
+}
+
+static int io_wait(size_t pos)
+{
+	proc_epoll_io_t *entry = ratt_table_chunk(&l_iotab, pos);
+	ratt_proc_io_t *io = entry->io;
+	uint32_t events = 0;
+	int retval;
+
+	switch (io->op) {
+	case RATTPROCIORD:
+	case RATTPROCIOACC:
+		events = RATTPROCEVRD;
+		break;
+	case RATTPROCIOWR:
+		events = RATTPROCEVWR;
+		break;
+	}
+
+	if (events) {
+		/* the owner is timed once the I/O is over */
+		retval = fd_wait(io->fd, events, io_resume,
+		    &(l_io_attr[ratt_proc_rank(entry->attr)]),
+		    (void *) (uintptr_t) pos, NULL);
+		if (retval == OK)
+			return OK;
+		if (errno != EPERM)
+			return FAIL;
+		/* files are always ready */
+	}
+
+	ratt_proc_io_perform(io);
+	io_done(pos);
+	return OK;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+static void ring_enter(void)
+{
+	int retval;
+
+	if (!l_ring.pending)
+		return;
+
+	retval = syscall(__NR_io_uring_enter, l_ring.fd,
+	    l_ring.pending, 0, 0, NULL, 0);
+	if (retval < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			error("io_uring_enter() failed: %s",
+			    strerror(errno));
+		return;
+	}
+	l_ring.pending -= retval;
+}
+
+/* ring completions carry the slot and its generation, a late one must not
+ * complete the request that took the slot over */
+static int ring_submit(size_t pos, uint32_t gen, ratt_proc_io_t const *io)
+{
+	struct io_uring_sqe *sqe = NULL;
+	unsigned int head, idx;
+
+	head = __atomic_load_n(l_ring.sq_head, __ATOMIC_ACQUIRE);
+	if (l_ring.tail - head >= *l_ring.sq_entries) {
+		/* full, hand the pass over early */
+		ring_enter();
+		head = __atomic_load_n(l_ring.sq_head, __ATOMIC_ACQUIRE);
+		if (l_ring.tail - head >= *l_ring.sq_entries) {
+			debug("submission queue is full");
+			return FAIL;
+		}
+	}
+
+	idx = l_ring.tail & *l_ring.sq_mask;
+	sqe = &(l_ring.sqe[idx]);
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->fd = io->fd;
+	sqe->user_data = ((uint64_t) gen << 32) | (uint32_t) pos;
+
+	switch (io->op) {
+	case RATTPROCIORD:
+		sqe->opcode = IORING_OP_READ;
+		break;
+	case RATTPROCIOWR:
+		sqe->opcode = IORING_OP_WRITE;
+		break;
+	case RATTPROCIOACC:
+		sqe->opcode = IORING_OP_ACCEPT;
+		break;
+	case RATTPROCIOSYN:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	default:
+		debug("unknown I/O operation %u", io->op);
+		return FAIL;
+	}
+
+	if (io->op == RATTPROCIORD || io->op == RATTPROCIOWR) {
+		sqe->addr = (uintptr_t) io->buf;
+		sqe->len = io->len;
+		sqe->off = (io->off < 0) ? (uint64_t) -1 : (uint64_t) io->off;
+	}
+
+	l_ring.sq_array[idx] = idx;
+	__atomic_store_n(l_ring.sq_tail, ++l_ring.tail, __ATOMIC_RELEASE);
+	l_ring.pending++;
+	return OK;
+}
+
+static void ring_reap(void)
+{
+	struct io_uring_cqe *cqe = NULL;
+	proc_epoll_io_t *entry = NULL;
+	unsigned int head, tail;
+	size_t pos;
+
+	head = *l_ring.cq_head;
+	tail = __atomic_load_n(l_ring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		cqe = &(l_ring.cqe[head & *l_ring.cq_mask]);
+		pos = (uint32_t) cqe->user_data;
+		entry = ratt_table_chunk(&l_iotab, pos);
+		if (!entry || ratt_table_pos_isfrag(&l_iotab, pos)
+		    || entry->gen != (uint32_t) (cqe->user_data >> 32)) {
+			debug("stale completion on slot %u", pos);
+			continue;
+		}
+		entry->io->res = cqe->res;
+		io_done(pos);
+	}
+	__atomic_store_n(l_ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* true if the kernel does every operation we submit */
+static int ring_probe(void)
+{
+	static uint8_t const op[] = {
+		IORING_OP_READ, IORING_OP_WRITE,
+		IORING_OP_ACCEPT, IORING_OP_FSYNC
+	};
+	struct io_uring_probe *probe = NULL;
+	size_t size, i;
+	int retval;
+
+	size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	probe = calloc(1, size);
+	if (!probe) {
+		debug("calloc() failed");
+		return 0;
+	}
+
+	retval = syscall(__NR_io_uring_register, l_ring.fd,
+	    IORING_REGISTER_PROBE, probe, 256);
+	for (i = 0; retval == 0 && i < sizeof(op); ++i) {
+		if (op[i] > probe->last_op
+		    || !(probe->ops[op[i]].flags & IO_URING_OP_SUPPORTED))
+			retval = -1;
+	}
+
+	free(probe);
+	return (retval == 0);
+}
+
+static void ring_fini(void)
+{
+	if (l_ring.sqe)
+		munmap(l_ring.sqe, l_ring.sqe_size);
+	if (l_ring.cq_map && l_ring.cq_map != l_ring.sq_map)
+		munmap(l_ring.cq_map, l_ring.cq_size);
+	if (l_ring.sq_map)
+		munmap(l_ring.sq_map, l_ring.sq_size);
+	if (l_ring.fd >= 0)
+		close(l_ring.fd);
+
+	memset(&l_ring, 0, sizeof(l_ring));
+	l_ring.fd = -1;
+}
+
+/* set the ring up; without one I/O takes the readiness path */
+static int ring_init(void)
+{
+	struct io_uring_params params = { 0 };
+	struct epoll_event event = { 0 };
+	char *sq, *cq;
+
+	l_ring.fd = syscall(__NR_io_uring_setup,
+	    PROC_EPOLL_RING_ENTRIES, &params);
+	if (l_ring.fd < 0) {
+		debug("io_uring_setup() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	l_ring.sq_size = params.sq_off.array
+	    + params.sq_entries * sizeof(unsigned int);
+	l_ring.cq_size = params.cq_off.cqes
+	    + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (l_ring.cq_size > l_ring.sq_size)
+			l_ring.sq_size = l_ring.cq_size;
+		l_ring.cq_size = l_ring.sq_size;
+	}
+
+	l_ring.sq_map = mmap(NULL, l_ring.sq_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, l_ring.fd, IORING_OFF_SQ_RING);
+	if (l_ring.sq_map == MAP_FAILED) {
+		l_ring.sq_map = NULL;
+		debug("mmap() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		l_ring.cq_map = l_ring.sq_map;
+	} else {
+		l_ring.cq_map = mmap(NULL, l_ring.cq_size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    l_ring.fd, IORING_OFF_CQ_RING);
+		if (l_ring.cq_map == MAP_FAILED) {
+			l_ring.cq_map = NULL;
+			debug("mmap() failed: %s", strerror(errno));
+			goto fail;
+		}
+	}
+
+	l_ring.sqe_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	l_ring.sqe = mmap(NULL, l_ring.sqe_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, l_ring.fd, IORING_OFF_SQES);
+	if (l_ring.sqe == MAP_FAILED) {
+		l_ring.sqe = NULL;
+		debug("mmap() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	sq = l_ring.sq_map;
+	l_ring.sq_head = (unsigned int *) (sq + params.sq_off.head);
+	l_ring.sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+	l_ring.sq_mask = (unsigned int *) (sq + params.sq_off.ring_mask);
+	l_ring.sq_entries =
+	    (unsigned int *) (sq + params.sq_off.ring_entries);
+	l_ring.sq_array = (unsigned int *) (sq + params.sq_off.array);
+	l_ring.tail = *l_ring.sq_tail;
+
+	cq = l_ring.cq_map;
+	l_ring.cq_head = (unsigned int *) (cq + params.cq_off.head);
+	l_ring.cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+	l_ring.cq_mask = (unsigned int *) (cq + params.cq_off.ring_mask);
+	l_ring.cqe = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	if (!ring_probe()) {
+		debug("io_uring lacks operations we need");
+		goto fail;
+	}
+
+	/* completions wake the wait up */
+	event.events = EPOLLIN;
+	event.data.fd = l_ring.fd;
+	if (epoll_ctl(l_epoll_fd, EPOLL_CTL_ADD, l_ring.fd, &event) != 0) {
+		debug("epoll_ctl() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	debug("io_uring of %u entries set up", params.sq_entries);
+	return OK;
+
+fail:
+	ring_fini();
+	return FAIL;
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/* ready descriptors, the highest class first */
+static void fd_dispatch(struct epoll_event const *event, int cnt)
+{
+	uint8_t rank[PROC_EPOLL_EVENTS];
+	proc_epoll_fd_t *entry = NULL;
+	unsigned int pass;
+	uint64_t wake;
+	int i;
+
+	for (i = 0; i < cnt; ++i) {
+		rank[i] = PROC_EPOLL_RANKNONE;
+		if (event[i].data.fd == l_wake_fd) {
+			if (read(l_wake_fd, &wake, sizeof(wake)) < 0)
+				debug("read() failed: %s", strerror(errno));
+			continue;
+		}
+#ifdef HAVE_LINUX_IO_URING_H
+		if (event[i].data.fd == l_ring.fd) {
+			ring_reap();
+			continue;
+		}
+#endif
+
+		entry = fd_find(event[i].data.fd);
+		if (entry)
+			rank[i] = ratt_proc_rank(entry->attr);
+	}
+
+	for (pass = 0; pass < RATTPROCPRCNT; ++pass)
+		for (i = 0; i < cnt; ++i)
+			if (rank[i] == pass)
+				fd_run(event[i].data.fd);
+}
+
+/* failure accounting of the sticky process run from pos */
+static void proc_account(ratt_table_t *table, size_t pos,
+    proc_epoll_register_t *proc, int retval)
+{
+	ratt_proc_entry_t entry = { proc->process, proc->attr, proc->udata };
+	proc_epoll_register_t *found = NULL;
+	int verdict;
+
+	verdict = ratt_proc_account(&entry, retval, &(proc->health));
+
+	/* the process may have gone meanwhile */
+	if (ratt_table_pos_isfrag(table, pos))
+		return;
+	found = ratt_table_chunk(table, pos);
+	if (!found || compare_process(found, proc) != MATCH)
+		return;
+
+	if (verdict == OK)
+		found->health = proc->health;
+	else
+		ratt_table_del_current(table);
+}
+
+/* one pass over processes without events; failing ones may rest */
+static void proc_run(void)
+{
+	proc_epoll_register_t *entry = NULL, proc;
+	ratt_table_t *table = NULL;
+	uint64_t now = 0, rest = 0, since;
+	unsigned int rank, ran = 0;
+	size_t pos;
+	int retval;
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank) {
+		table = &(l_proctab[rank]);
+
+		for (pos = 0; !ratt_table_isempty(table)
+		    && pos <= ratt_table_pos_last(table); ++pos) {
+			if (ratt_table_pos_isfrag(table, pos))
+				continue;
+			entry = ratt_table_chunk(table, pos);
+
+			if (ratt_proc_resting(&(entry->health), &now)) {
+				if (!rest || entry->health.retry < rest)
+					rest = entry->health.retry;
+				continue;
+			}
+
+			/* the table may move while the process runs; a
+			 * one-shot is out before it runs, its slot free to
+			 * be reused */
+			proc = *entry;
+			if (!is_sticky(proc.attr))
+				ratt_table_del_current(table);
+			since = ratt_proc_nclock();
+			retval = proc.process(proc.udata);
+			ratt_proc_hist_record(proc.hist,
+			    ratt_proc_nclock() - since);
+			if (retval != OK)
+				debug("process at %p failed", proc.process);
+			l_stats.runs[ratt_proc_rank_priority(rank)]++;
+			ran++;
+
+			if (is_sticky(proc.attr)
+			    && (retval != OK || proc.health.failed))
+				proc_account(table, pos, &proc, retval);
+		}
+	}
+
+	l_proc_rest = (ran) ? 0 : rest;
+}
+
+static int proc_pending(void)
+{
+	unsigned int rank;
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+		if (!ratt_table_isempty(&(l_proctab[rank])))
+			return 1;
+	return 0;
+}
+
+/* milliseconds to wait on descriptors, -1 for ever */
+static int proc_timeout(void)
+{
+	uint64_t now, until;
+
+	/* due timers first, they may leave processes to run */
+	until = ratt_proc_tick();
+
+	if (proc_pending()) {
+		if (!l_proc_rest)
+			return 0;
+		/* only failing processes left, resting */
+		if (!until || l_proc_rest < until)
+			until = l_proc_rest;
+	}
+	if (!until)
+		return -1;
+
+	now = ratt_proc_clock();
+	return (until > now) ? (until - now + 999) / 1000 : 0;
+}
+
+static void
+on_unregister(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
+{
+	proc_epoll_register_t *entry = NULL, proc = { process, attr, udata };
+	ratt_table_t *table = NULL;
+	int retval;
+
+	if (attr && attr->events) {
+		retval = fd_release(attr->fd, process, udata);
+		if (retval != OK)
+			debug("no matching process found");
+		return;
+	}
+
+	table = &(l_proctab[ratt_proc_rank(attr)]);
+	retval = ratt_table_search(table, (void **) &entry,
+	    &compare_process, &proc);
+	if (retval != OK) {
+		debug("no matching process found");
+	} else
+		ratt_table_del_current(table);
+}
+
+static int
+on_register(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
+{
+	proc_epoll_register_t proc = { process, attr, udata };
+	int retval;
+
+	if (attr && attr->events)
+		return fd_wait(attr->fd, attr->events, process, attr, udata,
+		    ratt_proc_hist(process, udata));
+
+	proc.hist = ratt_proc_hist(process, udata);
+	retval = ratt_table_insert(&(l_proctab[ratt_proc_rank(attr)]), &proc);
+	if (retval != OK) {
+		debug("ratt_table_insert() failed");
+		return FAIL;
+	}
+	l_proc_rest = 0;
+
+	debug("registered process %p", process);
+	return OK;
+}
+
+static void
+on_unregister_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; ++i)
+		on_unregister(entry[i].process, entry[i].attr, entry[i].udata);
+}
+
+static int
+on_register_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; ++i) {
+		if (on_register(entry[i].process,
+		    entry[i].attr, entry[i].udata) != OK) {
+			on_unregister_batch(entry, i);
+			return FAIL;
+		}
+	}
+
+	return OK;
+}
+
+static int on_stats(ratt_proc_stats_t *stats)
+{
+	memcpy(stats, &l_stats, sizeof(ratt_proc_stats_t));
+	return OK;
+}
+
+static int on_submit(ratt_proc_io_t *io, ratt_proc_entry_t const *owner)
+{
+	proc_epoll_io_t entry = { io, owner->process, owner->attr, owner->udata };
+	size_t pos;
+	int retval;
+
+	if (!++l_io_gen)
+		++l_io_gen;
+	entry.gen = l_io_gen;
+
+	retval = ratt_table_insert(&l_iotab, &entry);
+	if (retval != OK) {
+		debug("ratt_table_insert() failed");
+		return FAIL;
+	}
+	pos = ratt_table_pos_current(&l_iotab);
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (l_ring.fd >= 0)
+		retval = ring_submit(pos, entry.gen, io);
+	else
+#endif
+		retval = io_wait(pos);
+
+	if (retval != OK) {
+		debug("I/O of process %p not submitted", owner->process);
+		ratt_table_chunk(&l_iotab, pos);
+		ratt_table_del_current(&l_iotab);
+		return FAIL;
+	}
+
+	return OK;
+}
+
+static int on_start(void)
+{
+	struct epoll_event event[PROC_EPOLL_EVENTS];
+	int cnt;
+
+	if (l_proc_state == PROC_EPOLL_STATE_RUN) {
+		debug("processor is running already");
+		return FAIL;
+	}
+
+	l_proc_state = PROC_EPOLL_STATE_RUN;
+
+	do {
+#ifdef HAVE_LINUX_IO_URING_H
+		/* I/O queued last pass, in one go */
+		if (l_ring.fd >= 0)
+			ring_enter();
+#endif
+		/* sleep only when nothing but descriptors is waiting */
+		cnt = epoll_wait(l_epoll_fd, event, PROC_EPOLL_EVENTS,
+		    proc_timeout());
+		if (cnt < 0) {
+			if (errno == EINTR)
+				continue;
+			error("epoll_wait() failed: %s", strerror(errno));
+			l_proc_state = PROC_EPOLL_STATE_STOP;
+			return FAIL;
+		}
+
+		fd_dispatch(event, cnt);
+		proc_run();
+	} while (l_proc_state == PROC_EPOLL_STATE_RUN);
+
+	return OK;
+}
+
+static int on_stop(void)
+{
+	uint64_t wake = 1;
+
+	if (l_proc_state != PROC_EPOLL_STATE_STOP) {
+		l_proc_state = PROC_EPOLL_STATE_STOP;
+		if (write(l_wake_fd, &wake, sizeof(wake)) < 0)
+			debug("write() failed: %s", strerror(errno));
+		return OK;
+	}
+
+	debug("processor is not running");
+	return FAIL;
+}
+
+static int
+attach_module(
+    ratt_module_core_t const *core,
+    ratt_module_hook_t *hookinfo)
+{
+	ratt_proc_hook_t *proc_hook = hookinfo->hook;
+
+	switch (core->ver_major) {
+	default:
+	case 2:
+		(*proc_hook).v2.on_submit = on_submit;
+		/* FALLTHROUGH */
+	case 1:
+		(*proc_hook).v1.on_unregister_batch = on_unregister_batch;
+		(*proc_hook).v1.on_register_batch = on_register_batch;
+		(*proc_hook).v1.on_stats = on_stats;
+		/* FALLTHROUGH */
+	case 0:
+		(*proc_hook).v0.on_start = on_start;
+		(*proc_hook).v0.on_stop = on_stop;
+		(*proc_hook).v0.on_register = on_register;
+		(*proc_hook).v0.on_unregister = on_unregister;
+		break;
+	}
+	hookinfo->version = (core->ver_major < 2) ? core->ver_major : 2;
+	return OK;
+}
+
+static void __proc_epoll_fini(void)
+{
+	RATTLOG_TRACE();
+	int rank;
+
+#ifdef HAVE_LINUX_IO_URING_H
+	ring_fini();
+#endif
+	if (l_wake_fd >= 0)
+		close(l_wake_fd);
+	if (l_epoll_fd >= 0)
+		close(l_epoll_fd);
+	l_wake_fd = l_epoll_fd = -1;
+
+	ratt_table_destroy(&l_iotab);
+	ratt_table_destroy(&l_fdtab);
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+		ratt_table_destroy(&(l_proctab[rank]));
+}
+
+static int __proc_epoll_init(void)
+{
+	RATTLOG_TRACE();
+	struct epoll_event event = { 0 };
+	int retval, rank;
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank) {
+		retval = ratt_table_create(&(l_proctab[rank]),
+		    PROC_PROCTABSIZ, sizeof(proc_epoll_register_t), 0);
+		if (retval != OK) {
+			debug("ratt_table_create() failed");
+			goto fail;
+		}
+	}
+
+	retval = ratt_table_create_hashed(&l_fdtab, PROC_EPOLL_FDTABSIZ,
+	    sizeof(proc_epoll_fd_t), 0, &l_fdtab_hash);
+	if (retval != OK) {
+		debug("ratt_table_create_hashed() failed");
+		goto fail;
+	}
+	debug("allocated descriptor table of size `%u'",
+	    PROC_EPOLL_FDTABSIZ);
+
+	retval = ratt_table_create(&l_iotab, PROC_EPOLL_IOTABSIZ,
+	    sizeof(proc_epoll_io_t), 0);
+	if (retval != OK) {
+		debug("ratt_table_create() failed");
+		goto fail;
+	}
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank) {
+		l_io_attr[rank].flags = RATTPROCFLSTC;
+		l_io_attr[rank].priority = ratt_proc_rank_priority(rank);
+	}
+
+	l_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (l_epoll_fd < 0) {
+		error("epoll_create1() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	l_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (l_wake_fd < 0) {
+		error("eventfd() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	event.events = EPOLLIN;
+	event.data.fd = l_wake_fd;
+	retval = epoll_ctl(l_epoll_fd, EPOLL_CTL_ADD, l_wake_fd, &event);
+	if (retval != 0) {
+		error("epoll_ctl() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (ring_init() != OK)
+		warning("no io_uring, I/O waits for readiness instead");
+#endif
+
+	return OK;
+
+fail:
+	__proc_epoll_fini();
+	return FAIL;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = attach_module,
+	.constructor = &__proc_epoll_init,
+	.destructor = &__proc_epoll_fini,
+	.hook_size = RATT_PROC_HOOK_SIZE,
+};
+
+RATT_MODULE_INIT(proc_epoll, &module_entry)
@@ -0,0 +1,251 @@
+/*
+ * RATTLE processor failure accounting
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A sticky process failing pass after pass rests between runs, twice
+ * as long after each failure in a row up to backoff-max, and is evicted
+ * from its processor once it failed max-failures times in a row.  The
+ * processor keeps the state along its entry; the core only decides and
+ * keeps a record of each failing process for ratt_proc_failures().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+
+#include "fail.h"
+
+/* rest after a first failure, in microseconds */
+#ifndef PROC_FAIL_BACKOFF_USEC
+#define PROC_FAIL_BACKOFF_USEC	1000
+#endif
+
+/* initial failure table size */
+#ifndef PROC_FAIL_TABSIZ
+#define PROC_FAIL_TABSIZ	16
+#endif
+
+/* failing processes kept on record, later ones go unrecorded */
+#ifndef PROC_FAIL_TABMAX
+#define PROC_FAIL_TABMAX	256
+#endif
+
+/* failure records, indexed by process and user data */
+static RATT_TABLE_INIT(l_failtab);
+static pthread_mutex_t l_fail_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t l_fail_max = 0;		/* failures before eviction */
+static uint64_t l_fail_backoff_max = 0;	/* longest rest, usec */
+
+/* atomic */
+static uint64_t l_fail_failures = 0;
+static uint64_t l_fail_evictions = 0;
+
+static int compare_failure(void const *in, void const *find)
+{
+	ratt_proc_failure_t const *failure = in;
+	ratt_proc_failure_t const *key = find;
+
+	return (failure->process == key->process
+	    && failure->udata == key->udata) ? MATCH : NOMATCH;
+}
+
+static void const *key_failure(void const *in)
+{
+	return in;
+}
+
+static size_t hash_failure(void const *key)
+{
+	ratt_proc_failure_t const *failure = key;
+	uint64_t hash;
+
+	hash = ((uintptr_t) failure->process ^ (uintptr_t) failure->udata)
+	    * 0x9e3779b97f4a7c15ULL;
+	return (size_t) (hash ^ (hash >> 32));
+}
+
+static ratt_table_hash_t const l_failtab_hash = {
+	.key = key_failure,
+	.hash = hash_failure,
+	.compare = compare_failure,
+};
+
+/* rest after failed failures in a row */
+static inline uint64_t fail_backoff(uint32_t failed)
+{
+	uint64_t usec = PROC_FAIL_BACKOFF_USEC;
+
+	while (--failed && usec < l_fail_backoff_max)
+		usec <<= 1;
+	return (usec < l_fail_backoff_max) ? usec : l_fail_backoff_max;
+}
+
+/* caller holds l_fail_lock */
+static ratt_proc_failure_t *fail_find(ratt_proc_entry_t const *entry)
+{
+	ratt_proc_failure_t *failure = NULL, key = { 0 };
+
+	key.process = entry->process;
+	key.udata = entry->udata;
+
+	if (ratt_table_exists(&l_failtab))
+		ratt_table_search(&l_failtab, (void **) &failure,
+		    compare_failure, &key);
+	return failure;
+}
+
+/* caller holds l_fail_lock; NULL if out of room */
+static ratt_proc_failure_t *fail_record(ratt_proc_entry_t const *entry)
+{
+	ratt_proc_failure_t *failure = NULL, key = { 0 };
+
+	failure = fail_find(entry);
+	if (failure || !ratt_table_exists(&l_failtab))
+		return failure;
+
+	key.process = entry->process;
+	key.udata = entry->udata;
+	if (ratt_table_count(&l_failtab) >= PROC_FAIL_TABMAX
+	    || ratt_table_insert(&l_failtab, &key) != OK)
+		return NULL;
+	return ratt_table_current(&l_failtab);
+}
+
+int proc_fail_account(ratt_proc_entry_t const *entry, int retval,
+                      ratt_proc_health_t *health)
+{
+	ratt_proc_failure_t *failure = NULL;
+	uint64_t now;
+	int evict;
+
+	if (retval == OK) {	/* back on its feet */
+		health->failed = 0;
+		health->retry = 0;
+
+		pthread_mutex_lock(&l_fail_lock);
+		failure = fail_find(entry);
+		if (failure)
+			failure->failed = 0;
+		pthread_mutex_unlock(&l_fail_lock);
+		return OK;
+	}
+
+	now = ratt_proc_clock();
+	if (health->failed < UINT32_MAX)
+		health->failed++;
+	evict = (l_fail_max && health->failed >= l_fail_max);
+	health->retry = (l_fail_backoff_max)
+	    ? now + fail_backoff(health->failed) : 0;
+
+	__atomic_add_fetch(&l_fail_failures, 1, __ATOMIC_RELAXED);
+	if (evict)
+		__atomic_add_fetch(&l_fail_evictions, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&l_fail_lock);
+	failure = fail_record(entry);
+	if (failure) {
+		failure->failed = health->failed;
+		failure->failures++;
+		failure->last = now;
+		if (evict)
+			failure->evictions++;
+	} else
+		debug("no room to record process %p", entry->process);
+	pthread_mutex_unlock(&l_fail_lock);
+
+	if (evict) {
+		warning("process %p failed %u times in a row, evicted",
+		    entry->process, health->failed);
+		return FAIL;
+	}
+
+	debug("process %p failed %u times in a row",
+	    entry->process, health->failed);
+	return OK;
+}
+
+size_t proc_fail_list(ratt_proc_failure_t *failure, size_t cnt)
+{
+	ratt_proc_failure_t *record = NULL;
+	size_t i = 0;
+
+	pthread_mutex_lock(&l_fail_lock);
+	if (ratt_table_exists(&l_failtab)) {
+		RATT_TABLE_FOREACH(&l_failtab, record)
+		{
+			if (i == cnt)
+				break;
+			failure[i++] = *record;
+		}
+	}
+	pthread_mutex_unlock(&l_fail_lock);
+
+	return i;
+}
+
+void proc_fail_stats(ratt_proc_stats_t *stats)
+{
+	stats->failures = __atomic_load_n(&l_fail_failures,
+	    __ATOMIC_RELAXED);
+	stats->evictions = __atomic_load_n(&l_fail_evictions,
+	    __ATOMIC_RELAXED);
+}
+
+void proc_fail_fini(void)
+{
+	RATTLOG_TRACE();
+	pthread_mutex_lock(&l_fail_lock);
+	ratt_table_destroy(&l_failtab);
+	pthread_mutex_unlock(&l_fail_lock);
+}
+
+int proc_fail_init(uint32_t max, uint64_t backoff_max)
+{
+	RATTLOG_TRACE();
+	int retval;
+
+	retval = ratt_table_create_hashed(&l_failtab, PROC_FAIL_TABSIZ,
+	    sizeof(ratt_proc_failure_t), 0, &l_failtab_hash);
+	if (retval != OK) {
+		debug("ratt_table_create_hashed() failed");
+		return FAIL;
+	}
+
+	l_fail_max = max;
+	l_fail_backoff_max = backoff_max;
+	return OK;
+}
@@ -0,0 +1,15 @@
+#ifndef SRC_PROC_FAIL_H
+#define SRC_PROC_FAIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <rattle/proc.h>
+
+void proc_fail_fini(void);
+int proc_fail_init(uint32_t, uint64_t);
+int proc_fail_account(ratt_proc_entry_t const *, int, ratt_proc_health_t *);
+size_t proc_fail_list(ratt_proc_failure_t *, size_t);
+void proc_fail_stats(ratt_proc_stats_t *);
+
+#endif /* SRC_PROC_FAIL_H */
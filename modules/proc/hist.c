@@ -0,0 +1,288 @@
+/*
+ * RATTLE processor latency histograms
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Processors time each run of a process into the histogram of its
+ * handler and user data, looked up once when the process comes in and
+ * kept along its entry.  Histograms are log-linear: runs shorter than a power of two
+ * share its 2^RATTPROCLTBIT linear steps, which keeps the error under
+ * 1/2^RATTPROCLTBIT at any scale.  They live until the core goes.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+
+#include "hist.h"
+
+/* initial histogram table size */
+#ifndef PROC_HIST_TABSIZ
+#define PROC_HIST_TABSIZ	16
+#endif
+
+/* processes with a histogram, later ones go untimed */
+#ifndef PROC_HIST_TABMAX
+#define PROC_HIST_TABMAX	1024
+#endif
+
+/* histograms, indexed by handler and user data */
+static RATT_TABLE_INIT(l_histtab);
+static pthread_rwlock_t l_hist_lock = PTHREAD_RWLOCK_INITIALIZER;
+static unsigned int l_hist_gen = 0;	/* bumped on each init */
+
+/* last lookup of the thread; batches often hold a single handler */
+static __thread int (*l_hist_last_process)(void *) = NULL;
+static __thread void *l_hist_last_udata = NULL;
+static __thread ratt_proc_hist_t *l_hist_last = NULL;
+static __thread unsigned int l_hist_last_gen = 0;
+
+static int compare_hist(void const *in, void const *find)
+{
+	ratt_proc_latency_t * const *latency = in;
+	ratt_proc_latency_t const *key = find;
+
+	return ((*latency)->process == key->process
+	    && (*latency)->udata == key->udata) ? MATCH : NOMATCH;
+}
+
+static void const *key_hist(void const *in)
+{
+	ratt_proc_latency_t * const *latency = in;
+	return *latency;
+}
+
+static size_t hash_hist(void const *key)
+{
+	ratt_proc_latency_t const *latency = key;
+	uint64_t hash;
+
+	hash = ((uintptr_t) latency->process ^ (uintptr_t) latency->udata)
+	    * 0x9e3779b97f4a7c15ULL;
+	return (size_t) (hash ^ (hash >> 32));
+}
+
+static ratt_table_hash_t const l_histtab_hash = {
+	.key = key_hist,
+	.hash = hash_hist,
+	.compare = compare_hist,
+};
+
+/* caller holds l_hist_lock; readers share it so only iterators walk */
+static ratt_proc_latency_t *hist_find(int (*process)(void *), void *udata)
+{
+	ratt_proc_latency_t **latency = NULL, key = { 0 };
+	ratt_table_iter_t it;
+
+	if (!ratt_table_exists(&l_histtab))
+		return NULL;
+	key.process = process;
+	key.udata = udata;
+	latency = ratt_table_iter_search(&it, &l_histtab, compare_hist, &key);
+	return (latency) ? *latency : NULL;
+}
+
+/* caller holds l_hist_lock for writing; NULL if out of room */
+static ratt_proc_latency_t *hist_create(int (*process)(void *), void *udata)
+{
+	ratt_proc_latency_t *latency = NULL;
+
+	if (!ratt_table_exists(&l_histtab)
+	    || ratt_table_count(&l_histtab) >= PROC_HIST_TABMAX)
+		return NULL;
+
+	latency = calloc(1, sizeof(ratt_proc_latency_t));
+	if (!latency) {
+		debug("calloc() failed");
+		return NULL;
+	}
+	latency->process = process;
+	latency->udata = udata;
+
+	if (ratt_table_insert(&l_histtab, &latency) != OK) {
+		debug("ratt_table_insert() failed");
+		free(latency);
+		return NULL;
+	}
+
+	return latency;
+}
+
+ratt_proc_hist_t *proc_hist_get(int (*process)(void *), void *udata)
+{
+	ratt_proc_latency_t *latency = NULL;
+	unsigned int gen;
+
+	gen = __atomic_load_n(&l_hist_gen, __ATOMIC_ACQUIRE);
+	if (process == l_hist_last_process && udata == l_hist_last_udata
+	    && gen == l_hist_last_gen)
+		return l_hist_last;
+
+	pthread_rwlock_rdlock(&l_hist_lock);
+	latency = hist_find(process, udata);
+	pthread_rwlock_unlock(&l_hist_lock);
+
+	if (!latency) {
+		pthread_rwlock_wrlock(&l_hist_lock);
+		latency = hist_find(process, udata);
+		if (!latency)
+			latency = hist_create(process, udata);
+		pthread_rwlock_unlock(&l_hist_lock);
+	}
+
+	if (!latency) {
+		debug("no room for a histogram of process %p", process);
+		return NULL;
+	}
+
+	l_hist_last_process = process;
+	l_hist_last_udata = udata;
+	l_hist_last = &(latency->hist);
+	l_hist_last_gen = gen;
+	return l_hist_last;
+}
+
+/* upper bound of a bucket */
+static inline uint64_t hist_bound(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < (1 << RATTPROCLTBIT))
+		return bucket;
+
+	shift = (bucket >> RATTPROCLTBIT) - 1;
+	return (((uint64_t) (bucket & ((1 << RATTPROCLTBIT) - 1))
+	    + (1 << RATTPROCLTBIT) + 1) << shift) - 1;
+}
+
+uint64_t proc_hist_value(ratt_proc_hist_t const *hist, double pct)
+{
+	uint64_t want, seen = 0, count;
+	unsigned int i;
+
+	count = hist->count;
+	if (!count)
+		return 0;
+
+	want = (uint64_t) (count * pct / 100.0 + 0.5);
+	if (!want)
+		want = 1;
+
+	for (i = 0; i < RATTPROCLTCNT; ++i) {
+		seen += hist->bucket[i];
+		if (seen >= want)
+			break;
+	}
+
+	/* a bucket bound may overshoot what was seen */
+	if (i == RATTPROCLTCNT || hist_bound(i) > hist->max)
+		return hist->max;
+	return hist_bound(i);
+}
+
+size_t proc_hist_list(ratt_proc_latency_t *latency, size_t cnt)
+{
+	ratt_proc_latency_t **record = NULL;
+	ratt_table_iter_t it;
+	size_t i = 0;
+
+	pthread_rwlock_rdlock(&l_hist_lock);
+	if (ratt_table_exists(&l_histtab)) {
+		RATT_TABLE_ITER_FOREACH(&l_histtab, &it, record)
+		{
+			if (i == cnt)
+				break;
+			/* runs going on may tear it a little */
+			memcpy(&(latency[i++]), *record,
+			    sizeof(ratt_proc_latency_t));
+		}
+	}
+	pthread_rwlock_unlock(&l_hist_lock);
+
+	return i;
+}
+
+void proc_hist_reset(int (*process)(void *), void *udata)
+{
+	ratt_proc_latency_t **record = NULL;
+	ratt_table_iter_t it;
+
+	pthread_rwlock_rdlock(&l_hist_lock);
+	if (ratt_table_exists(&l_histtab)) {
+		RATT_TABLE_ITER_FOREACH(&l_histtab, &it, record)
+		{
+			if (process && ((*record)->process != process
+			    || (*record)->udata != udata))
+				continue;
+			memset(&((*record)->hist), 0, sizeof(ratt_proc_hist_t));
+		}
+	}
+	pthread_rwlock_unlock(&l_hist_lock);
+}
+
+void proc_hist_fini(void)
+{
+	RATTLOG_TRACE();
+	ratt_proc_latency_t **record = NULL;
+
+	pthread_rwlock_wrlock(&l_hist_lock);
+	if (ratt_table_exists(&l_histtab)) {
+		RATT_TABLE_FOREACH(&l_histtab, record)
+		{
+			free(*record);
+		}
+		ratt_table_destroy(&l_histtab);
+	}
+	pthread_rwlock_unlock(&l_hist_lock);
+}
+
+int proc_hist_init(void)
+{
+	RATTLOG_TRACE();
+	int retval;
+
+	pthread_rwlock_wrlock(&l_hist_lock);
+	retval = ratt_table_create_hashed(&l_histtab, PROC_HIST_TABSIZ,
+	    sizeof(ratt_proc_latency_t *), 0, &l_histtab_hash);
+	__atomic_add_fetch(&l_hist_gen, 1, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&l_hist_lock);
+
+	if (retval != OK) {
+		debug("ratt_table_create_hashed() failed");
+		return FAIL;
+	}
+	return OK;
+}
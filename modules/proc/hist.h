@@ -0,0 +1,16 @@
+#ifndef SRC_PROC_HIST_H
+#define SRC_PROC_HIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <rattle/proc.h>
+
+void proc_hist_fini(void);
+int proc_hist_init(void);
+ratt_proc_hist_t *proc_hist_get(int (*)(void *), void *);
+uint64_t proc_hist_value(ratt_proc_hist_t const *, double);
+size_t proc_hist_list(ratt_proc_latency_t *, size_t);
+void proc_hist_reset(int (*)(void *), void *);
+
+#endif /* SRC_PROC_HIST_H */
@@ -1,20 +1,100 @@
 #ifndef RATTLE_PROC_H
 #define RATTLE_PROC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define RATT_PROC_NAME		"proc"	/* name of parent */
-#define RATT_PROC_VER_MAJOR	0	/* major version */
-#define RATT_PROC_VER_MINOR	1	/* minor version */
+#define RATT_PROC_VER_MAJOR	2	/* major version */
+#define RATT_PROC_VER_MINOR	0	/* minor version */
 
 #define RATTPROCFLNTS	0x1	/* not thread-safe */ // should be opposite
 #define RATTPROCFLSTC	0x2	/* sticky */
+#define RATTPROCFLCOR	0x4	/* coroutine, may yield */
+
+/* priority classes; zeroed attributes are normal */
+#define RATTPROCPRNRM	0	/* normal */
+#define RATTPROCPRHIG	1	/* latency-critical, run first */
+#define RATTPROCPRLOW	2	/* bulk, run last */
+#define RATTPROCPRCNT	3	/* number of classes */
+
+/* descriptor readiness, honored by event-driven processors */
+#define RATTPROCEVRD	0x1	/* readable */
+#define RATTPROCEVWR	0x2	/* writable */
 
 typedef struct {
 	uint32_t flags;		/* process flags */
 	void *lock;		/* process lock */
+	uint32_t priority;	/* process priority class */
+	uint32_t period;	/* run every period usec, 0 if not periodic */
+	uint64_t deadline;	/* first run at ratt_proc_clock(), 0 if none */
+	int fd;			/* descriptor to wait on */
+	uint32_t events;	/* readiness to wait for, 0 if none */
 } ratt_proc_attr_t;
 
+/* I/O operations */
+#define RATTPROCIORD	0	/* read, at off unless negative */
+#define RATTPROCIOWR	1	/* write, at off unless negative */
+#define RATTPROCIOACC	2	/* accept a connection */
+#define RATTPROCIOSYN	3	/* flush to storage */
+
+/* I/O request, owned by the caller until completion */
+typedef struct {
+	uint32_t op;		/* operation */
+	int fd;			/* descriptor */
+	void *buf;		/* buffer to read to or write from */
+	size_t len;		/* buffer length */
+	int64_t off;		/* file offset, negative for current */
+	int64_t res;		/* result, negated errno on failure */
+} ratt_proc_io_t;
+
+typedef struct {
+	uint64_t runs[RATTPROCPRCNT];	/* processes run per priority */
+	uint64_t failures;		/* failed runs of sticky processes */
+	uint64_t evictions;		/* sticky processes evicted */
+} ratt_proc_stats_t;
+
+/* failure state of a sticky process, kept by its processor */
+typedef struct {
+	uint32_t failed;	/* failures in a row */
+	uint64_t retry;		/* ratt_proc_clock() to rest until, 0 if none */
+} ratt_proc_health_t;
+
+/* failure record of a sticky process, see ratt_proc_failures() */
+typedef struct {
+	int (*process)(void *);	/* process pointer */
+	void *udata;		/* process user data */
+	uint32_t failed;	/* failures in a row */
+	uint32_t evictions;	/* times evicted */
+	uint64_t failures;	/* failures overall */
+	uint64_t last;		/* ratt_proc_clock() of the last failure */
+} ratt_proc_failure_t;
+
+typedef struct {
+	int (*process)(void *);	/* process pointer */
+	ratt_proc_attr_t *attr;	/* process attributes */
+	void *udata;		/* process user data */
+} ratt_proc_entry_t;
+
+/* latency histogram, log-linear over nanoseconds */
+#define RATTPROCLTBIT	3	/* log2 of linear steps per power of two */
+#define RATTPROCLTTOP	41	/* log2 of the bound, longer runs are capped */
+#define RATTPROCLTCNT	((RATTPROCLTTOP - RATTPROCLTBIT + 1) << RATTPROCLTBIT)
+
+typedef struct {
+	uint64_t count;			/* runs */
+	uint64_t sum;			/* nanoseconds overall */
+	uint64_t max;			/* longest run */
+	uint64_t bucket[RATTPROCLTCNT];	/* runs per bucket */
+} ratt_proc_hist_t;
+
+/* latency of a process, see ratt_proc_latency() */
+typedef struct {
+	int (*process)(void *);	/* process pointer */
+	void *udata;		/* process user data */
+	ratt_proc_hist_t hist;	/* its runs */
+} ratt_proc_latency_t;
+
 typedef struct {
 	int (*on_start)();
 	int (*on_stop)();
@@ -22,13 +102,160 @@ typedef struct {
 	int (*on_register)(int (*)(void *), ratt_proc_attr_t *, void *);
 } ratt_proc_hook_v0_t;
 
+/* v0 plus batches, all or nothing */
+typedef struct {
+	int (*on_start)();
+	int (*on_stop)();
+	void (*on_unregister)(int (*)(void *), ratt_proc_attr_t *, void *);
+	int (*on_register)(int (*)(void *), ratt_proc_attr_t *, void *);
+	void (*on_unregister_batch)(ratt_proc_entry_t const *, size_t);
+	int (*on_register_batch)(ratt_proc_entry_t const *, size_t);
+	int (*on_stats)(ratt_proc_stats_t *);
+} ratt_proc_hook_v1_t;
+
+/* v1 plus I/O submission */
+typedef struct {
+	int (*on_start)();
+	int (*on_stop)();
+	void (*on_unregister)(int (*)(void *), ratt_proc_attr_t *, void *);
+	int (*on_register)(int (*)(void *), ratt_proc_attr_t *, void *);
+	void (*on_unregister_batch)(ratt_proc_entry_t const *, size_t);
+	int (*on_register_batch)(ratt_proc_entry_t const *, size_t);
+	int (*on_stats)(ratt_proc_stats_t *);
+	int (*on_submit)(ratt_proc_io_t *, ratt_proc_entry_t const *);
+} ratt_proc_hook_v2_t;
+
 typedef union ratt_proc_hook {
 	ratt_proc_hook_v0_t v0;
+	ratt_proc_hook_v1_t v1;
+	ratt_proc_hook_v2_t v2;
 } ratt_proc_hook_t;
 
 #define RATT_PROC_HOOK_SIZE sizeof(ratt_proc_hook_t)
 
+/* run queue of a process, 0 runs first */
+static inline unsigned int ratt_proc_rank(ratt_proc_attr_t const *attr)
+{
+	if (!attr)
+		return 1;
+
+	switch (attr->priority) {
+	case RATTPROCPRHIG:
+		return 0;
+	case RATTPROCPRLOW:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/* priority of a run queue, the reverse of ratt_proc_rank() */
+static inline uint32_t ratt_proc_rank_priority(unsigned int rank)
+{
+	switch (rank) {
+	case 0:
+		return RATTPROCPRHIG;
+	case 2:
+		return RATTPROCPRLOW;
+	default:
+		return RATTPROCPRNRM;
+	}
+}
+
+/* where a processor is in its round over the run queues */
+typedef struct {
+	unsigned int rank;		/* class being run */
+	uint8_t begun;			/* classes with a pass going on */
+	uint8_t done;			/* classes gone through this round */
+	uint8_t fresh;			/* classes given new processes */
+} ratt_proc_round_t;
+
+/* the run queue of rank was given new processes */
+static inline void
+ratt_proc_round_fresh(ratt_proc_round_t *round, unsigned int rank)
+{
+	round->fresh |= (1 << rank);
+}
+
+struct ratt_table;	/* see rattle/table.h */
+
 void ratt_proc_unregister(int (*)(void *), ratt_proc_attr_t *, void *);
 int ratt_proc_register(int (*)(void *), ratt_proc_attr_t *, void *);
+void ratt_proc_unregister_batch(ratt_proc_entry_t const *, size_t);
+int ratt_proc_register_batch(ratt_proc_entry_t const *, size_t);
+int ratt_proc_stats(ratt_proc_stats_t *);
+uint64_t ratt_proc_clock(void);
+uint64_t ratt_proc_tick(void);
+int ratt_proc_account(ratt_proc_entry_t const *, int, ratt_proc_health_t *);
+size_t ratt_proc_failures(ratt_proc_failure_t *, size_t);
+uint64_t ratt_proc_nclock(void);
+ratt_proc_hist_t *ratt_proc_hist(int (*)(void *), void *);
+uint64_t ratt_proc_hist_value(ratt_proc_hist_t const *, double);
+size_t ratt_proc_latency(ratt_proc_latency_t *, size_t);
+void ratt_proc_latency_reset(int (*)(void *), void *);
+int64_t ratt_proc_io_perform(ratt_proc_io_t *);
+void ratt_proc_yield(void);
+int ratt_proc_wait_fd(int, uint32_t);
+int ratt_proc_submit(ratt_proc_io_t *, int (*)(void *),
+    ratt_proc_attr_t *, void *);
+void ratt_proc_online(void);
+void ratt_proc_offline(void);
+void ratt_proc_quiescent(void);
+void ratt_proc_leave(void);
+void ratt_proc_synchronize(void);
+void ratt_proc_restore(struct ratt_table *, size_t);
+void *ratt_proc_round_pick(struct ratt_table *, ratt_proc_round_t *,
+    int (*)(void const *, void *), void *, int *);
+int ratt_table_parallel_for(struct ratt_table *, int (*)(void *, void *),
+    void *);
+int ratt_table_parallel_reduce(struct ratt_table *,
+    int (*)(void *, void *, void *),
+    void (*)(void *, void const *, void *), void *, size_t, void *);
+
+/* true while a failing sticky process rests; now is read once, on need */
+static inline int
+ratt_proc_resting(ratt_proc_health_t const *health, uint64_t *now)
+{
+	if (!health->retry)
+		return 0;
+	if (!*now)
+		*now = ratt_proc_clock();
+	return (*now < health->retry);
+}
+
+/* bucket of a run of nsec nanoseconds */
+static inline unsigned int ratt_proc_hist_bucket(uint64_t nsec)
+{
+	unsigned int msb;
+
+	if (nsec < (1 << RATTPROCLTBIT))
+		return nsec;
+	if (nsec >> RATTPROCLTTOP)
+		nsec = (1ULL << RATTPROCLTTOP) - 1;
+
+	msb = 63 - __builtin_clzll(nsec);
+	return ((msb - RATTPROCLTBIT + 1) << RATTPROCLTBIT)
+	    + ((nsec >> (msb - RATTPROCLTBIT)) & ((1 << RATTPROCLTBIT) - 1));
+}
+
+/* a run of nsec nanoseconds; runs on other threads may race in */
+static inline void
+ratt_proc_hist_record(ratt_proc_hist_t *hist, uint64_t nsec)
+{
+	uint64_t max;
+
+	if (!hist)
+		return;
+
+	__atomic_add_fetch(&(hist->bucket[ratt_proc_hist_bucket(nsec)]), 1,
+	    __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(hist->count), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(hist->sum), nsec, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&(hist->max), __ATOMIC_RELAXED);
+	while (nsec > max && !__atomic_compare_exchange_n(&(hist->max), &max,
+	    nsec, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
 
 #endif /* RATTLE_PROC_H */
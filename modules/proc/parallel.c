@@ -0,0 +1,276 @@
+/*
+ * RATTLE processor parallel table passes
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A parallel pass splits the positions of a table, [0, last], into
+ * ranges of whole frag_mask words and registers one plain run per range
+ * with the processor.  The caller does not sit idle meanwhile: it takes
+ * every range no run has started yet, so a pass completes even when no
+ * processor runs or every worker is busy, then waits for the ranges
+ * runs took.  Runs left find their range taken and return at once.
+ * The ranges are counted by the caller and every run registered, and
+ * go away with the last of them: a pass never waits for a grace period,
+ * which a pass run from a process could not see end.
+ *
+ * The chunks may be written to but the table must not change shape
+ * during a pass.  Processors running processes on their own loop
+ * (serial, epoll) must be called from that loop.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+
+/* minimum chunks per range */
+#ifndef PROC_PARALLEL_RANGE
+#define PROC_PARALLEL_RANGE	4096
+#endif
+
+/* maximum ranges per pass */
+#ifndef PROC_PARALLEL_SPLIT
+#define PROC_PARALLEL_SPLIT	64
+#endif
+
+#define PROC_PARALLEL_WORD	64	/* chunks per frag_mask word */
+
+typedef struct {
+	ratt_table_t *table;	/* table walked */
+	int (*each)(void *, void *);	/* parallel for callback */
+	int (*map)(void *, void *, void *);	/* parallel reduce callback */
+	void (*combine)(void *, void const *, void *);	/* folds partials */
+	void *result;		/* reduce result */
+	size_t size;		/* reduce result size */
+	void *udata;		/* callback user data */
+	size_t done;		/* ranges done */
+	int retval;		/* FAIL once a callback failed */
+} parallel_job_t;
+
+typedef struct parallel_pass parallel_pass_t;
+
+typedef struct {
+	parallel_job_t *job;	/* job of the range */
+	parallel_pass_t *pass;	/* pass of the range */
+	size_t first, end;	/* positions, end excluded */
+	void *partial;		/* partial result, reduce only */
+	int claimed;		/* taken by a run or the caller */
+} parallel_range_t;
+
+struct parallel_pass {
+	parallel_range_t *range;	/* ranges of the pass */
+	char *partial;		/* partial results, reduce only */
+	size_t refs;		/* caller and runs yet to return */
+};
+
+static void parallel_run(parallel_range_t *range)
+{
+	parallel_job_t *job = range->job;
+	ratt_table_iter_t it;
+	void *chunk = NULL;
+	int retval = OK;
+
+	for (chunk = ratt_table_iter_at(&it, job->table, range->first);
+	    chunk && ratt_table_iter_pos(&it) < range->end;
+	    chunk = ratt_table_iter_next(&it)) {
+		if (job->map && job->map(chunk, range->partial,
+		    job->udata) != OK)
+			retval = FAIL;
+		else if (!job->map && job->each(chunk, job->udata) != OK)
+			retval = FAIL;
+	}
+
+	if (retval != OK)
+		__atomic_store_n(&(job->retval), FAIL, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(job->done), 1, __ATOMIC_RELEASE);
+}
+
+/* the last of the caller and the runs frees the pass */
+static void parallel_put(parallel_pass_t *pass)
+{
+	if (__atomic_sub_fetch(&(pass->refs), 1, __ATOMIC_ACQ_REL))
+		return;
+	free(pass->range);
+	free(pass->partial);
+	free(pass);
+}
+
+static void parallel_claim(parallel_range_t *range)
+{
+	if (!__atomic_exchange_n(&(range->claimed), 1, __ATOMIC_ACQ_REL))
+		parallel_run(range);
+}
+
+/* the process registered per range; the caller may have taken it */
+static int parallel_process(void *udata)
+{
+	parallel_range_t *range = udata;
+	parallel_pass_t *pass = range->pass;
+
+	parallel_claim(range);
+	parallel_put(pass);
+	return OK;
+}
+
+static int parallel_pass(parallel_job_t *job)
+{
+	ratt_table_t *table = job->table;
+	parallel_pass_t *pass = NULL;
+	parallel_range_t *range = NULL;
+	size_t cnt, span, per, i, registered = 0;
+	int retval;
+
+	if (ratt_table_isempty(table))
+		return OK;
+
+	span = ratt_table_pos_last(table) + 1;
+	per = (span + PROC_PARALLEL_SPLIT - 1) / PROC_PARALLEL_SPLIT;
+	if (per < PROC_PARALLEL_RANGE)
+		per = PROC_PARALLEL_RANGE;
+	per = (per + PROC_PARALLEL_WORD - 1) & ~((size_t)
+	    PROC_PARALLEL_WORD - 1);
+	cnt = (span + per - 1) / per;
+
+	pass = calloc(1, sizeof(parallel_pass_t));
+	if (pass) {
+		pass->range = calloc(cnt, sizeof(parallel_range_t));
+		if (job->map)
+			pass->partial = calloc(cnt, job->size);
+	}
+	if (!pass || !pass->range || (job->map && !pass->partial)) {
+		debug("calloc() failed");
+		if (pass) {
+			free(pass->range);
+			free(pass->partial);
+		}
+		free(pass);
+		return FAIL;
+	}
+
+	range = pass->range;
+	pass->refs = cnt + 1;
+	for (i = 0; i < cnt; ++i) {
+		range[i].job = job;
+		range[i].pass = pass;
+		range[i].first = i * per;
+		range[i].end = (span - range[i].first > per)
+		    ? range[i].first + per : span;
+		if (pass->partial)
+			range[i].partial = pass->partial + i * job->size;
+	}
+
+	/*
+	 * a single range is not worth a run; ranges are registered one by
+	 * one as a batch failing half way could not tell which runs are
+	 * left, and the caller takes those the processor refuses
+	 */
+	for (; cnt > 1 && registered < cnt; ++registered)
+		if (ratt_proc_register(parallel_process, NULL,
+		    &(range[registered])) != OK) {
+			debug("ratt_proc_register() failed at %u of %u",
+			    registered, cnt);
+			break;
+		}
+	if (registered < cnt)
+		__atomic_sub_fetch(&(pass->refs), cnt - registered,
+		    __ATOMIC_RELEASE);
+
+	for (i = 0; i < cnt; ++i)
+		parallel_claim(&(range[i]));
+
+	while (__atomic_load_n(&(job->done), __ATOMIC_ACQUIRE) < cnt)
+		sched_yield();
+
+	for (i = 0; pass->partial && i < cnt; ++i)
+		job->combine(job->result, range[i].partial, job->udata);
+
+	retval = job->retval;
+	parallel_put(pass);
+	return retval;
+}
+
+/**
+ * \fn int ratt_table_parallel_for(ratt_table_t *table,
+ *             int (*each)(void *, void *), void *udata)
+ * \brief run each(chunk, udata) on every chunk of table on the workers
+ *
+ * \return FAIL if each() failed on any chunk, OK otherwise
+ */
+int ratt_table_parallel_for(ratt_table_t *table,
+                            int (*each)(void *, void *), void *udata)
+{
+	RATTLOG_TRACE();
+	parallel_job_t job = { 0 };
+
+	job.table = table;
+	job.each = each;
+	job.udata = udata;
+	job.retval = OK;
+
+	return parallel_pass(&job);
+}
+
+/**
+ * \fn int ratt_table_parallel_reduce(ratt_table_t *table,
+ *             int (*map)(void *, void *, void *),
+ *             void (*combine)(void *, void const *, void *),
+ *             void *result, size_t size, void *udata)
+ * \brief fold every chunk of table into result on the workers
+ *
+ * Every range folds its chunks with map(chunk, partial, udata) into a
+ * partial result of size bytes, zeroed first; partials are then folded
+ * into result with combine(result, partial, udata) in position order,
+ * on the calling thread.
+ *
+ * \return FAIL if map() failed on any chunk, OK otherwise
+ */
+int ratt_table_parallel_reduce(ratt_table_t *table,
+                               int (*map)(void *, void *, void *),
+                               void (*combine)(void *, void const *, void *),
+                               void *result, size_t size, void *udata)
+{
+	RATTLOG_TRACE();
+	parallel_job_t job = { 0 };
+
+	job.table = table;
+	job.map = map;
+	job.combine = combine;
+	job.result = result;
+	job.size = size;
+	job.udata = udata;
+	job.retval = OK;
+
+	return parallel_pass(&job);
+}
@@ -30,19 +30,118 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
 
 #include <rattle/conf.h>
 #include <rattle/def.h>
 #include <rattle/log.h>
 #include <rattle/module.h>
 #include <rattle/proc.h>
+#include <rattle/rcu.h>
 
 #include "conf.h"
+#include "coro.h"
+#include "fail.h"
+#include "hist.h"
 #include "module.h"
+#include "timer.h"
+
+/*
+ * attached process module
+ *
+ * Dispatch reads the hook through rcu and takes no lock; threads which
+ * dispatch all the time (workers) go online and announce quiescent
+ * states, any other goes online around each dispatch.  proc_detach()
+ * waits for them before freeing.  Readers are registered on first use
+ * and unregistered when their thread exits.
+ */
+typedef struct {
+	ratt_proc_hook_t const *hook;	/* module hook */
+	unsigned int version;		/* hook version */
+} proc_dispatch_t;
+
+static proc_dispatch_t *l_proc_dispatch = NULL;
+static RATT_RCU_INIT(l_proc_rcu);
+static __thread ratt_rcu_reader_t l_proc_reader;
+static __thread int l_proc_reader_on = 0;	/* registered */
+static __thread int l_proc_online = 0;		/* announcing */
+static pthread_key_t l_proc_reader_key;	/* unregisters at exit */
+static pthread_once_t l_proc_reader_once = PTHREAD_ONCE_INIT;
+static int l_proc_reader_keyed = 0;
+
+/* hook of the attached module if at version or later, NULL if none */
+static inline ratt_proc_hook_t const *proc_hook(unsigned int version)
+{
+	proc_dispatch_t const *dispatch = NULL;
+
+	dispatch = ratt_rcu_dereference(l_proc_dispatch);
+	if (!dispatch || dispatch->version < version)
+		return NULL;
+	return dispatch->hook;
+}
+
+/* thread of reader exits without ratt_proc_leave() */
+static void proc_reader_exit(void *udata)
+{
+	ratt_rcu_reader_t *reader = udata;
+
+	if (ratt_rcu_exists(&l_proc_rcu))
+		ratt_rcu_unregister(&l_proc_rcu, reader);
+}
+
+static void proc_reader_key(void)
+{
+	if (pthread_key_create(&l_proc_reader_key, proc_reader_exit) == 0)
+		l_proc_reader_keyed = 1;
+	else
+		error("pthread_key_create() failed");
+}
+
+/* registers the calling thread as a reader on first call */
+static int proc_reader(void)
+{
+	if (l_proc_reader_on)
+		return OK;
+
+	/* a reader must not outlive its thread */
+	pthread_once(&l_proc_reader_once, proc_reader_key);
+	if (!l_proc_reader_keyed)
+		return FAIL;
+
+	if (ratt_rcu_register(&l_proc_rcu, &l_proc_reader) != OK)
+		return FAIL;
+	pthread_setspecific(l_proc_reader_key, &l_proc_reader);
+	l_proc_reader_on = 1;
+	return OK;
+}
 
-/* attached process module */
-static ratt_proc_hook_v0_t *l_proc_hook = NULL;
+/* online around a dispatch unless online already; true if it went */
+static inline int proc_enter(void)
+{
+	if (l_proc_online || proc_reader() != OK)
+		return 0;
+
+	ratt_rcu_online(&l_proc_rcu, &l_proc_reader);
+	l_proc_online = 1;
+	return 1;
+}
+
+static inline void proc_exit(int entered)
+{
+	if (!entered)
+		return;
+
+	l_proc_online = 0;
+	ratt_rcu_offline(&l_proc_reader);
+}
 
 /* configuration */
 #define PROC_CONF_LABEL	"process"
@@ -53,10 +152,30 @@ static ratt_proc_hook_v0_t *l_proc_hook = NULL;
 static RATT_CONF_DEFVAL(l_conf_module_defval, RATTD_PROC_MODULE);
 static RATT_CONF_LIST_INIT(l_conf_module);
 
+#ifndef RATTD_PROC_MAX_FAILURES
+#define RATTD_PROC_MAX_FAILURES "0"	/* never evict */
+#endif
+static RATT_CONF_DEFVAL(l_conf_max_failures_defval, RATTD_PROC_MAX_FAILURES);
+static uint16_t l_conf_max_failures = 0;
+
+#ifndef RATTD_PROC_BACKOFF_MAX
+#define RATTD_PROC_BACKOFF_MAX "1000"	/* milliseconds */
+#endif
+static RATT_CONF_DEFVAL(l_conf_backoff_max_defval, RATTD_PROC_BACKOFF_MAX);
+static uint32_t l_conf_backoff_max = 0;
+
 static ratt_conf_t l_conf[] = {
 	{ "module", "process module to use. first load, first use.",
 	    l_conf_module_defval, &l_conf_module,
 	    RATTCONFDTSTR, RATTCONFFLLST },
+	{ "max-failures", "failures in a row before a sticky process "
+	    "is evicted, 0 never evicts",
+	    l_conf_max_failures_defval, &l_conf_max_failures,
+	    RATTCONFDTNUM16, RATTCONFFLUNS },
+	{ "backoff-max", "longest rest in milliseconds of a failing "
+	    "sticky process, 0 disables resting",
+	    l_conf_backoff_max_defval, &l_conf_backoff_max,
+	    RATTCONFDTNUM32, RATTCONFFLUNS },
 	{ NULL }
 };
 
@@ -74,36 +193,145 @@ static ratt_module_core_t l_core_info = {
 
 static inline int on_start()
 {
-	if (l_proc_hook && l_proc_hook->on_start)
-		return l_proc_hook->on_start();
+	ratt_proc_hook_t const *hook = proc_hook(0);
+
+	/* runs the processor until stopped; detach comes after */
+	if (hook && hook->v0.on_start)
+		return hook->v0.on_start();
 	debug("on_start() undefined");
 	return FAIL;
 }
 
 static inline int on_stop()
 {
-	if (l_proc_hook && l_proc_hook->on_stop)
-		return l_proc_hook->on_stop();
-	debug("on_stop() undefined");
-	return FAIL;
+	ratt_proc_hook_t const *hook = NULL;
+	int entered = proc_enter(), retval = FAIL;
+
+	hook = proc_hook(0);
+	if (hook && hook->v0.on_stop)
+		retval = hook->v0.on_stop();
+	else {
+		debug("on_stop() undefined");
+	}
+
+	proc_exit(entered);
+	return retval;
 }
 
 static void
 on_unregister(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
 {
-	if (l_proc_hook && l_proc_hook->on_unregister) {
-		l_proc_hook->on_unregister(process, attr, udata);
+	ratt_proc_hook_t const *hook = NULL;
+	int entered = proc_enter();
+
+	hook = proc_hook(0);
+	if (hook && hook->v0.on_unregister) {
+		hook->v0.on_unregister(process, attr, udata);
 	} else
 		debug("on_unregister() undefined");
+
+	proc_exit(entered);
 }
 
 static int
 on_register(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
 {
-	if (l_proc_hook && l_proc_hook->on_register)
-		return l_proc_hook->on_register(process, attr, udata);
-	debug("on_register() undefined");
-	return FAIL;
+	ratt_proc_hook_t const *hook = NULL;
+	int entered = proc_enter(), retval = FAIL;
+
+	hook = proc_hook(0);
+	if (hook && hook->v0.on_register)
+		retval = hook->v0.on_register(process, attr, udata);
+	else {
+		debug("on_register() undefined");
+	}
+
+	proc_exit(entered);
+	return retval;
+}
+
+static void
+on_unregister_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	ratt_proc_hook_t const *hook = NULL;
+	int entered = proc_enter();
+	size_t i;
+
+	hook = proc_hook(1);
+	if (hook && hook->v1.on_unregister_batch) {
+		hook->v1.on_unregister_batch(entry, cnt);
+	} else {
+		/* processor knows of single processes only */
+		for (i = 0; i < cnt; ++i)
+			on_unregister(entry[i].process, entry[i].attr,
+			    entry[i].udata);
+	}
+
+	proc_exit(entered);
+}
+
+static int
+on_register_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	ratt_proc_hook_t const *hook = NULL;
+	int entered = proc_enter(), retval = OK;
+	size_t i;
+
+	hook = proc_hook(1);
+	if (hook && hook->v1.on_register_batch) {
+		retval = hook->v1.on_register_batch(entry, cnt);
+		goto out;
+	}
+
+	/* processor knows of single processes only */
+	for (i = 0; i < cnt; ++i) {
+		if (on_register(entry[i].process,
+		    entry[i].attr, entry[i].udata) != OK) {
+			debug("on_register() failed at %u of %u", i, cnt);
+			on_unregister_batch(entry, i);
+			retval = FAIL;
+			break;
+		}
+	}
+
+out:
+	proc_exit(entered);
+	return retval;
+}
+
+static int on_stats(ratt_proc_stats_t *stats)
+{
+	ratt_proc_hook_t const *hook = NULL;
+	int entered = proc_enter(), retval = FAIL;
+
+	hook = proc_hook(1);
+	if (hook && hook->v1.on_stats)
+		retval = hook->v1.on_stats(stats);
+	else {
+		debug("on_stats() undefined");
+	}
+
+	proc_exit(entered);
+	return retval;
+}
+
+static int on_submit(ratt_proc_io_t *io, ratt_proc_entry_t const *entry)
+{
+	ratt_proc_hook_t const *hook = NULL;
+	int entered = proc_enter(), retval;
+
+	hook = proc_hook(2);
+	if (hook && hook->v2.on_submit) {
+		retval = hook->v2.on_submit(io, entry);
+	} else {
+		/* processor has no I/O path, do it here and now */
+		ratt_proc_io_perform(io);
+		retval = on_register(entry->process, entry->attr,
+		    entry->udata);
+	}
+
+	proc_exit(entered);
+	return retval;
 }
 
 int proc_stop()
@@ -121,13 +349,21 @@ int proc_start()
 void proc_detach(void *udata)
 {
 	RATTLOG_TRACE();
-	l_proc_hook = NULL;
+	proc_dispatch_t *dispatch = l_proc_dispatch;
+
+	ratt_rcu_assign(l_proc_dispatch, NULL);
+	if (dispatch) {
+		/* no reader dispatches through the hook past this */
+		ratt_proc_synchronize();
+		free(dispatch);
+	}
 	module_core_detach(RATT_PROC_NAME);
 }
 
 int proc_attach(void)
 {
 	ratt_module_hook_t *module_hook = NULL;
+	proc_dispatch_t *dispatch = NULL;
 	char **module = NULL;
 	int retval;
 
@@ -148,13 +384,27 @@ int proc_attach(void)
 		module_core_detach(RATT_PROC_NAME);
 		return FAIL;
 	}
-	l_proc_hook = module_hook->hook;
+
+	dispatch = calloc(1, sizeof(proc_dispatch_t));
+	if (!dispatch) {
+		debug("calloc() failed");
+		module_core_detach(RATT_PROC_NAME);
+		return FAIL;
+	}
+	dispatch->hook = module_hook->hook;
+	dispatch->version = module_hook->version;
+	ratt_rcu_assign(l_proc_dispatch, dispatch);
 	return OK;
 }
 
 void proc_fini(void *udata)
 {
 	RATTLOG_TRACE();
+	ratt_rcu_destroy(&l_proc_rcu);
+	proc_coro_fini();
+	proc_timer_fini();
+	proc_hist_fini();
+	proc_fail_fini();
 	conf_release(l_conf);
 }
 
@@ -169,14 +419,85 @@ int proc_init(void)
 		return FAIL;
 	}
 
+	retval = proc_fail_init(l_conf_max_failures,
+	    (uint64_t) l_conf_backoff_max * 1000);
+	if (retval != OK) {
+		debug("proc_fail_init() failed");
+		conf_release(l_conf);
+		return FAIL;
+	}
+
+	retval = proc_hist_init();
+	if (retval != OK) {
+		debug("proc_hist_init() failed");
+		proc_fail_fini();
+		conf_release(l_conf);
+		return FAIL;
+	}
+
+	retval = proc_timer_init(on_register_batch, on_unregister_batch);
+	if (retval != OK) {
+		debug("proc_timer_init() failed");
+		proc_hist_fini();
+		proc_fail_fini();
+		conf_release(l_conf);
+		return FAIL;
+	}
+
+	retval = proc_coro_init(on_register, on_unregister);
+	if (retval != OK) {
+		debug("proc_coro_init() failed");
+		proc_timer_fini();
+		proc_hist_fini();
+		proc_fail_fini();
+		conf_release(l_conf);
+		return FAIL;
+	}
+
+	retval = ratt_rcu_create(&l_proc_rcu);
+	if (retval != OK) {
+		debug("ratt_rcu_create() failed");
+		proc_coro_fini();
+		proc_timer_fini();
+		proc_hist_fini();
+		proc_fail_fini();
+		conf_release(l_conf);
+		return FAIL;
+	}
+
 	return OK;
 }
 
+/* true if the core keeps the process rather than the processor */
+static inline int proc_kept(ratt_proc_attr_t const *attr)
+{
+	return (proc_timer_timed(attr) || proc_coro_coro(attr));
+}
+
+/* true if the core keeps any of the batch */
+static int batch_kept(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; ++i)
+		if (proc_kept(entry[i].attr))
+			return 1;
+	return 0;
+}
+
 void ratt_proc_unregister(int (*process)(void *),
                           ratt_proc_attr_t *attr,
                           void *udata)
 {
 	RATTLOG_TRACE();
+	if (proc_coro_coro(attr)) {
+		proc_coro_cancel(process, attr, udata);
+		return;
+	}
+
+	/* a due run might still wait in the processor */
+	if (proc_timer_timed(attr))
+		proc_timer_cancel(process, attr, udata);
 	on_unregister(process, attr, udata);
 }
 
@@ -185,5 +506,219 @@ int ratt_proc_register(int (*process)(void *),
                        void *udata)
 {
 	RATTLOG_TRACE();
+	if (proc_coro_coro(attr))
+		return proc_coro_spawn(process, attr, udata);
+	if (proc_timer_timed(attr))
+		return proc_timer_arm(process, attr, udata);
 	return on_register(process, attr, udata);
 }
+
+void ratt_proc_unregister_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	RATTLOG_TRACE();
+	size_t i;
+
+	if (!batch_kept(entry, cnt)) {
+		on_unregister_batch(entry, cnt);
+		return;
+	}
+
+	for (i = 0; i < cnt; ++i)
+		ratt_proc_unregister(entry[i].process,
+		    entry[i].attr, entry[i].udata);
+}
+
+int ratt_proc_register_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	RATTLOG_TRACE();
+	size_t i;
+
+	if (!batch_kept(entry, cnt))
+		return on_register_batch(entry, cnt);
+
+	/* the core takes its own one by one */
+	for (i = 0; i < cnt; ++i) {
+		if (ratt_proc_register(entry[i].process,
+		    entry[i].attr, entry[i].udata) != OK) {
+			debug("ratt_proc_register() failed at %u of %u", i, cnt);
+			ratt_proc_unregister_batch(entry, i);
+			return FAIL;
+		}
+	}
+
+	return OK;
+}
+
+int ratt_proc_stats(ratt_proc_stats_t *stats)
+{
+	RATTLOG_TRACE();
+	int retval;
+
+	memset(stats, 0, sizeof(ratt_proc_stats_t));
+	retval = on_stats(stats);
+	proc_fail_stats(stats);
+	return retval;
+}
+
+uint64_t ratt_proc_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Processors run due timers once a round and before they sleep, which
+ * they may do until the ratt_proc_clock() given, 0 if none is armed.
+ */
+uint64_t ratt_proc_tick(void)
+{
+	return proc_timer_tick();
+}
+
+/*
+ * Processors account for runs of sticky processes which failed or are
+ * failing; FAIL tells the process is to be evicted.
+ */
+int ratt_proc_account(ratt_proc_entry_t const *entry,
+                      int retval,
+                      ratt_proc_health_t *health)
+{
+	return proc_fail_account(entry, retval, health);
+}
+
+size_t ratt_proc_failures(ratt_proc_failure_t *failure, size_t cnt)
+{
+	RATTLOG_TRACE();
+	return proc_fail_list(failure, cnt);
+}
+
+/* clock of run latencies, in nanoseconds */
+uint64_t ratt_proc_nclock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* histogram processors time runs of process into, NULL if none */
+ratt_proc_hist_t *ratt_proc_hist(int (*process)(void *), void *udata)
+{
+	/* coroutines are timed on their own */
+	if (proc_coro_resumer(process))
+		return NULL;
+	return proc_hist_get(process, udata);
+}
+
+/* latency at or under which pct percent of the runs went */
+uint64_t ratt_proc_hist_value(ratt_proc_hist_t const *hist, double pct)
+{
+	return proc_hist_value(hist, pct);
+}
+
+size_t ratt_proc_latency(ratt_proc_latency_t *latency, size_t cnt)
+{
+	RATTLOG_TRACE();
+	return proc_hist_list(latency, cnt);
+}
+
+/* clears the histogram of process with udata, of all if process is NULL */
+void ratt_proc_latency_reset(int (*process)(void *), void *udata)
+{
+	RATTLOG_TRACE();
+	proc_hist_reset(process, udata);
+}
+
+/* the calling thread dispatches from now on, registered on first call */
+void ratt_proc_online(void)
+{
+	if (proc_reader() != OK)
+		return;
+
+	ratt_rcu_online(&l_proc_rcu, &l_proc_reader);
+	l_proc_online = 1;
+}
+
+/* the calling thread does not dispatch until back online */
+void ratt_proc_offline(void)
+{
+	if (!l_proc_reader_on)
+		return;
+
+	l_proc_online = 0;
+	ratt_rcu_offline(&l_proc_reader);
+}
+
+/* the calling thread holds nothing it got from dispatch */
+void ratt_proc_quiescent(void)
+{
+	if (l_proc_reader_on)
+		ratt_rcu_quiescent(&l_proc_rcu, &l_proc_reader);
+}
+
+/* every other online thread passes a quiescent state before return */
+void ratt_proc_synchronize(void)
+{
+	ratt_rcu_synchronize(&l_proc_rcu,
+	    (l_proc_reader_on) ? &l_proc_reader : NULL);
+}
+
+/* the calling thread is about to exit */
+void ratt_proc_leave(void)
+{
+	if (l_proc_reader_on) {
+		ratt_rcu_unregister(&l_proc_rcu, &l_proc_reader);
+		pthread_setspecific(l_proc_reader_key, NULL);
+		l_proc_reader_on = 0;
+		l_proc_online = 0;
+	}
+}
+
+int64_t ratt_proc_io_perform(ratt_proc_io_t *io)
+{
+	ssize_t retval;
+
+	switch (io->op) {
+	case RATTPROCIORD:
+		retval = (io->off < 0) ? read(io->fd, io->buf, io->len)
+		    : pread(io->fd, io->buf, io->len, io->off);
+		break;
+	case RATTPROCIOWR:
+		retval = (io->off < 0) ? write(io->fd, io->buf, io->len)
+		    : pwrite(io->fd, io->buf, io->len, io->off);
+		break;
+	case RATTPROCIOACC:
+		retval = accept(io->fd, NULL, NULL);
+		break;
+	case RATTPROCIOSYN:
+		retval = fsync(io->fd);
+		break;
+	default:
+		retval = -1;
+		errno = EINVAL;
+		break;
+	}
+
+	io->res = (retval < 0) ? -errno : retval;
+	return io->res;
+}
+
+int ratt_proc_submit(ratt_proc_io_t *io,
+                     int (*process)(void *),
+                     ratt_proc_attr_t *attr,
+                     void *udata)
+{
+	RATTLOG_TRACE();
+	ratt_proc_entry_t entry = { process, attr, udata };
+
+	/* the process runs once, when the I/O is over */
+	if (attr && ((attr->flags & RATTPROCFLSTC) || attr->events
+	    || proc_kept(attr))) {
+		error("process %p resumed on I/O must run once", process);
+		return FAIL;
+	}
+
+	return on_submit(io, &entry);
+}
@@ -0,0 +1,108 @@
+/*
+ * RATTLE processor rounds over priority classes
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Processors keeping one process table per priority class, serial and
+ * worker, go round them the same way; see ratt_proc_round_pick().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+
+/* the processor goes on where it was */
+void ratt_proc_restore(ratt_table_t *table, size_t pos)
+{
+	if (pos <= ratt_table_pos_last(table))
+		ratt_table_chunk(table, pos);
+}
+
+/*
+ * Each round makes a pass over every class of proctab, the highest
+ * first; a class given new processes goes through again before any
+ * lower one runs.  wrapped tells a round ended.  Entries skip is true
+ * of, if any, are passed over.  The table the entry comes from is left
+ * on it, round->rank tells which.
+ */
+void *ratt_proc_round_pick(ratt_table_t *proctab, ratt_proc_round_t *round,
+                           int (*skip)(void const *, void *), void *udata,
+                           int *wrapped)
+{
+	ratt_table_t *table = NULL;
+	unsigned int rank, pass;
+	void *entry = NULL;
+	uint8_t bit;
+
+	*wrapped = 0;
+	for (pass = 0; pass < 2; ++pass) {
+		for (rank = 0; rank < RATTPROCPRCNT; ++rank) {
+			bit = 1 << rank;
+			table = &(proctab[rank]);
+
+			if (round->done & round->fresh & bit)
+				round->done &= ~bit;
+			if (round->done & bit)
+				continue;
+
+			if (!(round->begun & bit)) {
+				round->fresh &= ~bit;
+				entry = ratt_table_first_next(table);
+			} else {
+				entry = ratt_table_next(table);
+				if (!entry && (round->fresh & bit)) {
+					/* newcomers may sit behind us */
+					round->fresh &= ~bit;
+					entry = ratt_table_first_next(table);
+				}
+			}
+			while (entry && skip && skip(entry, udata))
+				entry = ratt_table_next(table);
+			round->begun |= bit;
+
+			if (entry) {
+				round->rank = rank;
+				return entry;
+			}
+
+			round->done |= bit;
+			round->begun &= ~bit;
+		}
+
+		/* round over */
+		*wrapped = 1;
+		round->done = 0;
+	}
+
+	return NULL;
+}
@@ -32,6 +32,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <rattle/def.h>
 #include <rattle/log.h>
@@ -53,13 +54,21 @@ typedef struct {
 	int (*process)(void *);		/* process pointer */
 	ratt_proc_attr_t *attr;		/* process attributes */
 	void *udata;			/* process user data */
+	ratt_proc_health_t health;	/* failures of a sticky process */
+	ratt_proc_hist_t *hist;		/* run latencies, NULL if none */
 } proc_serial_register_t;
 
 /* process table initial size */
 #ifndef PROC_PROCTABSIZ
 #define PROC_PROCTABSIZ		4
 #endif
-static RATT_TABLE_INIT(l_proctab);	/* process table */
+
+/* process tables, one per priority class */
+static ratt_table_t l_proctab[RATTPROCPRCNT];
+static ratt_proc_round_t l_round;	/* where we are in them */
+
+/* runs per priority */
+static ratt_proc_stats_t l_stats;
 
 static int compare_process(void const *in, void const *find)
 {
@@ -69,55 +78,131 @@ static int compare_process(void const *in, void const *find)
 
 	if (proc->udata) {
 		if (proc->udata != entry->udata)
-			return FAIL;
+			return NOMATCH;
 	}
 
 	if (proc->attr && entry->attr) {
 		retval = memcmp(proc->attr,
 		    entry->attr, sizeof(ratt_proc_attr_t));
 		if (retval != 0)
-			return FAIL;
+			return NOMATCH;
 	}
 
-	return (proc->process == entry->process) ? OK : FAIL;
+	return (proc->process == entry->process) ? MATCH : NOMATCH;
+}
+
+/* a failing process resting, passed over */
+static int proc_resting(void const *in, void *udata)
+{
+	proc_serial_register_t const *entry = in;
+	uint64_t now = 0;
+
+	return ratt_proc_resting(&(entry->health), &now);
+}
+
+/* failure accounting of the sticky process run from pos */
+static void proc_account(ratt_table_t *table, size_t pos,
+    proc_serial_register_t *proc, int retval)
+{
+	ratt_proc_entry_t entry = { proc->process, proc->attr, proc->udata };
+	proc_serial_register_t *found = NULL;
+	int verdict;
+
+	verdict = ratt_proc_account(&entry, retval, &(proc->health));
+
+	/* the process may have gone meanwhile */
+	if (ratt_table_pos_isfrag(table, pos))
+		return;
+	found = ratt_table_chunk(table, pos);
+	if (!found || compare_process(found, proc) != MATCH)
+		return;
+
+	if (verdict == OK)
+		found->health = proc->health;
+	else
+		ratt_table_del_current(table);
 }
 
 static void
 on_unregister(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
 {
 	proc_serial_register_t *entry = NULL, proc = { process, attr, udata };
+	ratt_table_t *table = &(l_proctab[ratt_proc_rank(attr)]);
+	size_t pos = ratt_table_pos_current(table);
 	int retval;
 
-	retval = ratt_table_search(&l_proctab, (void **) &entry,
+	retval = ratt_table_search(table, (void **) &entry,
 	    &compare_process, &proc);
 	if (retval != OK) {
 		debug("no matching process found");
 	} else
-		ratt_table_del_current(&l_proctab);
+		ratt_table_del_current(table);
+
+	ratt_proc_restore(table, pos);
 }
 
 static int
 on_register(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
 {
 	proc_serial_register_t proc = { process, attr, udata };
+	unsigned int rank = ratt_proc_rank(attr);
+	ratt_table_t *table = &(l_proctab[rank]);
+	size_t pos = ratt_table_pos_current(table);
 	int retval;
 
-	retval = ratt_table_insert(&l_proctab, &proc);
+	proc.hist = ratt_proc_hist(process, udata);
+	retval = ratt_table_insert(table, &proc);
 	if (retval != OK) {
 		debug("ratt_table_insert() failed");
 		return FAIL;
 	}
+	debug("registered process %p, class %u slot %u",
+	    process, rank, ratt_table_pos_current(table));
+	ratt_proc_restore(table, pos);
+	ratt_proc_round_fresh(&l_round, rank);
+
+	return OK;
+}
+
+static void
+on_unregister_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; ++i)
+		on_unregister(entry[i].process, entry[i].attr, entry[i].udata);
+}
+
+static int
+on_register_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; ++i) {
+		if (on_register(entry[i].process,
+		    entry[i].attr, entry[i].udata) != OK) {
+			on_unregister_batch(entry, i);
+			return FAIL;
+		}
+	}
 
-	debug("registered process %p, slot %i",
-	    process, ratt_table_pos_last(&l_proctab));
+	return OK;
+}
 
+static int on_stats(ratt_proc_stats_t *stats)
+{
+	memcpy(stats, &l_stats, sizeof(ratt_proc_stats_t));
 	return OK;
 }
 
 static int on_start(void)
 {
-	proc_serial_register_t *proc = NULL;
-	int retval;
+	proc_serial_register_t *entry = NULL, proc;
+	ratt_table_t *table = NULL;
+	unsigned int rank;
+	uint64_t since;
+	size_t pos;
+	int retval, wrapped;
 
 	if (l_proc_state == PROC_SERIAL_STATE_RUN) {
 		debug("processor is running already");
@@ -127,28 +212,41 @@ static int on_start(void)
 	l_proc_state = PROC_SERIAL_STATE_RUN;
 
 	do {
-		RATT_TABLE_FOREACH(&l_proctab, proc)
-		{
-			if (proc->process) {
-				retval = proc->process(proc->udata);
-				if (!(proc->attr->flags & RATTPROCFLSTC)) {
-					ratt_table_del_current(&l_proctab);
-					continue;
-				} else if (retval != OK) {
-					debug("process at %p failed",
-					    proc->process);
-					/* increase failure count;
-					 * check for max sticky failure conf;
-					 * trash if exceed.
-					 * proc->failure++; */
-				}
-			} else {	/* trash ghost process */
-				debug("ghost process registered on slot %u",
-				    ratt_table_pos_current(&l_proctab));
-				ratt_table_del_current(&l_proctab);
-			}
+		entry = ratt_proc_round_pick(l_proctab, &l_round,
+		    proc_resting, NULL, &wrapped);
+
+		/* once per round, run due timers */
+		if (wrapped)
+			ratt_proc_tick();
+		if (!entry)
+			continue;
+
+		rank = l_round.rank;
+		table = &(l_proctab[rank]);
+		pos = ratt_table_pos_current(table);
+
+		if (!entry->process) {	/* trash ghost process */
+			debug("ghost process registered on slot %u", pos);
+			ratt_table_del_current(table);
+			continue;
 		}
 
+		/* the table may move while the process runs; a one-shot
+		 * is out before it runs, its slot free to be reused */
+		proc = *entry;
+		if (!proc.attr || !(proc.attr->flags & RATTPROCFLSTC))
+			ratt_table_del_current(table);
+		since = ratt_proc_nclock();
+		retval = proc.process(proc.udata);
+		ratt_proc_hist_record(proc.hist, ratt_proc_nclock() - since);
+		l_stats.runs[ratt_proc_rank_priority(rank)]++;
+
+		if (proc.attr && (proc.attr->flags & RATTPROCFLSTC)
+		    && (retval != OK || proc.health.failed)) {
+			if (retval != OK)
+				debug("process at %p failed", proc.process);
+			proc_account(table, pos, &proc, retval);
+		}
 	} while (l_proc_state == PROC_SERIAL_STATE_RUN);
 
 	return OK;
@@ -167,31 +265,55 @@ static int on_stop(void)
 
 static int
 attach_module(
-    ratt_module_core_t const *parinfo,
+    ratt_module_core_t const *core,
     ratt_module_hook_t *hookinfo)
 {
-	return FAIL;
+	ratt_proc_hook_t *proc_hook = hookinfo->hook;
+
+	switch (core->ver_major) {
+	default:
+	case 1:
+		(*proc_hook).v1.on_unregister_batch = on_unregister_batch;
+		(*proc_hook).v1.on_register_batch = on_register_batch;
+		(*proc_hook).v1.on_stats = on_stats;
+		/* FALLTHROUGH */
+	case 0:
+		(*proc_hook).v0.on_start = on_start;
+		(*proc_hook).v0.on_stop = on_stop;
+		(*proc_hook).v0.on_register = on_register;
+		(*proc_hook).v0.on_unregister = on_unregister;
+		break;
+	}
+	hookinfo->version = (core->ver_major < 1) ? core->ver_major : 1;
+	return OK;
 }
 
 static void __proc_serial_fini(void)
 {
 	RATTLOG_TRACE();
-	ratt_table_destroy(&l_proctab);
+	int rank;
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+		ratt_table_destroy(&(l_proctab[rank]));
 }
 
 static int __proc_serial_init(void)
 {
 	RATTLOG_TRACE();
-	int retval;
-	
-	retval = ratt_table_create(&l_proctab,
-	    PROC_PROCTABSIZ, sizeof(proc_serial_register_t), 0);
-	if (retval != OK) {
-		debug("ratt_table_create() failed");
-		return FAIL;
-	} else
-		debug("allocated process table of size `%u'",
-		    PROC_PROCTABSIZ);
+	int retval, rank;
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank) {
+		retval = ratt_table_create(&(l_proctab[rank]),
+		    PROC_PROCTABSIZ, sizeof(proc_serial_register_t), 0);
+		if (retval != OK) {
+			debug("ratt_table_create() failed");
+			while (rank--)
+				ratt_table_destroy(&(l_proctab[rank]));
+			return FAIL;
+		}
+	}
+	debug("allocated %u process tables of size `%u'",
+	    RATTPROCPRCNT, PROC_PROCTABSIZ);
 
 	return OK;
 }
@@ -203,6 +325,7 @@ static ratt_module_entry_t module_entry = {
 	.attach = attach_module,
 	.constructor = &__proc_serial_init,
 	.destructor = &__proc_serial_fini,
+	.hook_size = RATT_PROC_HOOK_SIZE,
 };
 
 RATT_MODULE_INIT(proc_serial, &module_entry)
@@ -0,0 +1,481 @@
+/*
+ * RATTLE processor timer wheel
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timed processes sit in a hierarchical timer wheel: level 0 has a slot
+ * per tick, each next level a slot per whole turn of the level below.
+ * A timer is linked into the slot of its expiry at the lowest level
+ * that reaches it and moves down a level each time its slot comes up,
+ * so arm and cancel are O(1) and only due slots are ever walked.
+ *
+ * The wheel is driven by the processors through ratt_proc_tick(): once
+ * a round while busy and before going to sleep, which they do until the
+ * deadline it gives at the latest.  Arming a timer due before the one a
+ * processor may be sleeping on registers a plain kick run to wake it.
+ * Due processes are handed to the processor as plain runs, which keeps
+ * their priority and locking in the processor's hands.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+
+#include "timer.h"
+
+/* length of a tick in microseconds */
+#ifndef PROC_TIMER_TICK_USEC
+#define PROC_TIMER_TICK_USEC	1000
+#endif
+
+/* initial timer table size */
+#ifndef PROC_TIMER_TABSIZ
+#define PROC_TIMER_TABSIZ	64
+#endif
+
+/* due processes handed to the processor at once */
+#ifndef PROC_TIMER_BATCH
+#define PROC_TIMER_BATCH	32
+#endif
+
+#define PROC_TIMER_BITS		6	/* log2 of slots per level */
+#define PROC_TIMER_SLOTS	(1 << PROC_TIMER_BITS)
+#define PROC_TIMER_MASK		(PROC_TIMER_SLOTS - 1)
+#define PROC_TIMER_LEVELS	4
+/* ticks the wheel reaches, later timers wait in the last slot */
+#define PROC_TIMER_SPAN		(1ULL << (PROC_TIMER_BITS * PROC_TIMER_LEVELS))
+
+#define PROC_TIMER_NONE		RATTSIZMAX	/* end of slot list */
+
+typedef struct {
+	int (*process)(void *);	/* process pointer */
+	ratt_proc_attr_t *attr;	/* process attributes */
+	void *udata;		/* process user data */
+
+	uint64_t expire;	/* tick to run at */
+	uint64_t period;	/* ticks between runs, 0 runs once */
+
+	size_t slot;		/* wheel slot */
+	size_t prev, next;	/* slot list, by table position */
+} proc_timer_t;
+
+/* timers, indexed by process and user data */
+static RATT_TABLE_INIT(l_timertab);
+
+static size_t l_timer_slot[PROC_TIMER_LEVELS * PROC_TIMER_SLOTS];
+static uint64_t l_timer_mask[PROC_TIMER_LEVELS];	/* occupied slots */
+static uint64_t l_timer_now;	/* last tick done */
+static uint64_t l_timer_next;	/* next tick to do, UINT64_MAX if none */
+static int l_timer_kicked;	/* kick registered, not run yet (atomic) */
+static pthread_mutex_t l_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* processor interface */
+static int (*l_timer_dispatch)(ratt_proc_entry_t const *, size_t);
+static void (*l_timer_release)(ratt_proc_entry_t const *, size_t);
+
+static ratt_proc_attr_t l_timer_kick_attr = {
+	.priority = RATTPROCPRHIG,
+};
+
+static ratt_proc_entry_t const l_timer_kick = {
+	.process = proc_timer_kick,
+	.attr = &l_timer_kick_attr,
+};
+
+static int compare_timer(void const *in, void const *find)
+{
+	proc_timer_t const *timer = in;
+	proc_timer_t const *key = find;
+
+	return (timer->process == key->process
+	    && timer->udata == key->udata) ? MATCH : NOMATCH;
+}
+
+static void const *key_timer(void const *in)
+{
+	return in;
+}
+
+static size_t hash_timer(void const *key)
+{
+	proc_timer_t const *timer = key;
+	uint64_t hash;
+
+	hash = ((uintptr_t) timer->process ^ (uintptr_t) timer->udata)
+	    * 0x9e3779b97f4a7c15ULL;
+	return (size_t) (hash ^ (hash >> 32));
+}
+
+static ratt_table_hash_t const l_timertab_hash = {
+	.key = key_timer,
+	.hash = hash_timer,
+	.compare = compare_timer,
+};
+
+static inline uint64_t timer_clock(void)
+{
+	return ratt_proc_clock() / PROC_TIMER_TICK_USEC;
+}
+
+/* ticks covering usec, rounded up so timers never run early */
+static inline uint64_t timer_ticks(uint64_t usec)
+{
+	return (usec + PROC_TIMER_TICK_USEC - 1) / PROC_TIMER_TICK_USEC;
+}
+
+static inline proc_timer_t *timer_at(size_t pos)
+{
+	return ratt_table_chunk(&l_timertab, pos);
+}
+
+static void timer_link(size_t pos, proc_timer_t *timer)
+{
+	uint64_t expire = timer->expire;
+	unsigned int level = 0;
+
+	if (expire - l_timer_now >= PROC_TIMER_SPAN)
+		expire = l_timer_now + PROC_TIMER_SPAN - 1;
+	while (expire - l_timer_now
+	    >= 1ULL << (PROC_TIMER_BITS * (level + 1)))
+		level++;
+
+	timer->slot = level * PROC_TIMER_SLOTS
+	    + ((expire >> (PROC_TIMER_BITS * level)) & PROC_TIMER_MASK);
+	timer->prev = PROC_TIMER_NONE;
+	timer->next = l_timer_slot[timer->slot];
+	if (timer->next != PROC_TIMER_NONE)
+		timer_at(timer->next)->prev = pos;
+	l_timer_slot[timer->slot] = pos;
+	l_timer_mask[level] |= 1ULL << (timer->slot & PROC_TIMER_MASK);
+}
+
+static void timer_unlink(proc_timer_t *timer)
+{
+	if (timer->prev != PROC_TIMER_NONE)
+		timer_at(timer->prev)->next = timer->next;
+	else
+		l_timer_slot[timer->slot] = timer->next;
+	if (timer->next != PROC_TIMER_NONE)
+		timer_at(timer->next)->prev = timer->prev;
+
+	if (l_timer_slot[timer->slot] == PROC_TIMER_NONE)
+		l_timer_mask[timer->slot / PROC_TIMER_SLOTS] &=
+		    ~(1ULL << (timer->slot & PROC_TIMER_MASK));
+}
+
+/* empty a slot, giving the head of its list */
+static size_t timer_take(size_t slot)
+{
+	size_t pos = l_timer_slot[slot];
+
+	l_timer_slot[slot] = PROC_TIMER_NONE;
+	l_timer_mask[slot / PROC_TIMER_SLOTS] &=
+	    ~(1ULL << (slot & PROC_TIMER_MASK));
+	return pos;
+}
+
+/* tick the next occupied slot of a level comes up at */
+static uint64_t timer_level_next(unsigned int level)
+{
+	uint64_t mask = l_timer_mask[level], upper;
+	unsigned int shift = PROC_TIMER_BITS * level;
+	uint64_t turn = l_timer_now >> shift;
+	unsigned int idx = turn & PROC_TIMER_MASK;
+
+	if (!mask)
+		return UINT64_MAX;
+
+	turn &= ~((uint64_t) PROC_TIMER_MASK);
+	upper = (idx == PROC_TIMER_MASK) ? 0 : mask >> (idx + 1) << (idx + 1);
+	if (upper)
+		turn += __builtin_ctzll(upper);
+	else	/* wraps around */
+		turn += PROC_TIMER_SLOTS + __builtin_ctzll(mask);
+
+	return turn << shift;
+}
+
+static uint64_t timer_next(void)
+{
+	uint64_t next = UINT64_MAX, tick;
+	unsigned int level;
+
+	for (level = 0; level < PROC_TIMER_LEVELS; ++level) {
+		tick = timer_level_next(level);
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+/* move the current slot of a level down the wheel */
+static void timer_cascade(unsigned int level)
+{
+	proc_timer_t *timer = NULL;
+	size_t pos, next;
+
+	pos = timer_take(level * PROC_TIMER_SLOTS
+	    + ((l_timer_now >> (PROC_TIMER_BITS * level)) & PROC_TIMER_MASK));
+	for (; pos != PROC_TIMER_NONE; pos = next) {
+		timer = timer_at(pos);
+		next = timer->next;
+		timer_link(pos, timer);
+	}
+}
+
+static void timer_dispatch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	if (!cnt)
+		return;
+
+	if (l_timer_dispatch(entry, cnt) != OK)
+		warning("dropped %u runs of timed processes", cnt);
+}
+
+/* run the current level 0 slot, periodic timers next run after now */
+static void timer_expire(uint64_t now)
+{
+	ratt_proc_entry_t entry[PROC_TIMER_BATCH];
+	proc_timer_t *timer = NULL;
+	size_t pos, next, cnt = 0;
+
+	pos = timer_take(l_timer_now & PROC_TIMER_MASK);
+	for (; pos != PROC_TIMER_NONE; pos = next) {
+		if (cnt == PROC_TIMER_BATCH) {
+			timer_dispatch(entry, cnt);
+			cnt = 0;
+		}
+
+		timer = timer_at(pos);
+		next = timer->next;
+		entry[cnt].process = timer->process;
+		entry[cnt].attr = timer->attr;
+		entry[cnt].udata = timer->udata;
+		cnt++;
+
+		if (timer->period) {
+			/* keep the phase, skipping missed runs */
+			timer->expire += timer->period
+			    * ((now - timer->expire) / timer->period + 1);
+			timer_link(pos, timer);
+		} else {
+			ratt_table_chunk(&l_timertab, pos);
+			ratt_table_del_current(&l_timertab);
+		}
+	}
+
+	timer_dispatch(entry, cnt);
+}
+
+/* do every tick up to now with work in it */
+static void timer_advance(uint64_t now)
+{
+	unsigned int level;
+	uint64_t next;
+
+	while ((next = timer_next()) <= now) {
+		l_timer_now = next;
+		for (level = 1; level < PROC_TIMER_LEVELS; ++level) {
+			if (l_timer_now
+			    & ((1ULL << (PROC_TIMER_BITS * level)) - 1))
+				break;
+			timer_cascade(level);
+		}
+		timer_expire(now);
+	}
+
+	l_timer_now = now;
+	__atomic_store_n(&l_timer_next, next, __ATOMIC_RELEASE);
+}
+
+/* runs due timers, gives the ratt_proc_clock() of the next, 0 if none */
+uint64_t proc_timer_tick(void)
+{
+	uint64_t now = timer_clock(), next;
+
+	next = __atomic_load_n(&l_timer_next, __ATOMIC_ACQUIRE);
+
+	/* arming, cancelling or ticking elsewhere; next call catches up */
+	if (now >= next && pthread_mutex_trylock(&l_timer_lock) == 0) {
+		if (now > l_timer_now)
+			timer_advance(now);
+		next = l_timer_next;
+		pthread_mutex_unlock(&l_timer_lock);
+	}
+
+	return (next == UINT64_MAX) ? 0 : next * PROC_TIMER_TICK_USEC;
+}
+
+int proc_timer_kick(void *unused)
+{
+	__atomic_store_n(&l_timer_kicked, 0, __ATOMIC_SEQ_CST);
+	proc_timer_tick();
+	return OK;
+}
+
+void proc_timer_cancel(int (*process)(void *),
+                       ratt_proc_attr_t *attr,
+                       void *udata)
+{
+	RATTLOG_TRACE();
+	proc_timer_t key = {
+		.process = process,
+		.udata = udata,
+	};
+	proc_timer_t *timer = NULL;
+	size_t pos;
+
+	pthread_mutex_lock(&l_timer_lock);
+	ratt_table_search(&l_timertab, (void **) &timer, compare_timer, &key);
+	if (!timer) {
+		debug("process %p is not timed", process);
+		pthread_mutex_unlock(&l_timer_lock);
+		return;
+	}
+
+	pos = ratt_table_pos_current(&l_timertab);
+	timer_unlink(timer);
+	ratt_table_chunk(&l_timertab, pos);
+	ratt_table_del_current(&l_timertab);
+
+	/* a processor may wake up early once, nothing more */
+	pthread_mutex_unlock(&l_timer_lock);
+}
+
+int proc_timer_arm(int (*process)(void *),
+                   ratt_proc_attr_t *attr,
+                   void *udata)
+{
+	RATTLOG_TRACE();
+	proc_timer_t timer = {
+		.process = process,
+		.attr = attr,
+		.udata = udata,
+	}, *found = NULL;
+	uint64_t now = timer_clock(), next;
+	size_t pos;
+	int retval;
+
+	if (attr->flags & RATTPROCFLSTC) {
+		error("timed process %p cannot be sticky", process);
+		return FAIL;
+	}
+
+	timer.period = attr->period ? timer_ticks(attr->period) : 0;
+	if (attr->deadline)
+		timer.expire = timer_ticks(attr->deadline);
+	else
+		timer.expire = now + timer.period;
+
+	pthread_mutex_lock(&l_timer_lock);
+	ratt_table_search(&l_timertab, (void **) &found, compare_timer, &timer);
+	if (found) {
+		debug("process %p is already timed", process);
+		goto fail;
+	}
+
+	/* idle wheel has nothing to catch up on */
+	if (ratt_table_isempty(&l_timertab) && now > l_timer_now)
+		l_timer_now = now;
+	if (timer.expire <= l_timer_now)
+		timer.expire = l_timer_now + 1;
+
+	retval = ratt_table_insert(&l_timertab, &timer);
+	if (retval != OK) {
+		debug("ratt_table_insert() failed");
+		goto fail;
+	}
+	pos = ratt_table_pos_current(&l_timertab);
+	timer_link(pos, timer_at(pos));
+
+	/* processors may sleep until the former deadline, or for ever */
+	next = timer_next();
+	if (next < l_timer_next
+	    && !__atomic_exchange_n(&l_timer_kicked, 1, __ATOMIC_SEQ_CST)) {
+		retval = l_timer_dispatch(&l_timer_kick, 1);
+		if (retval != OK) {
+			debug("registering kick process failed");
+			__atomic_store_n(&l_timer_kicked, 0, __ATOMIC_SEQ_CST);
+			timer_unlink(timer_at(pos));
+			ratt_table_chunk(&l_timertab, pos);
+			ratt_table_del_current(&l_timertab);
+			goto fail;
+		}
+	}
+
+	__atomic_store_n(&l_timer_next, next, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&l_timer_lock);
+	return OK;
+
+fail:
+	pthread_mutex_unlock(&l_timer_lock);
+	return FAIL;
+}
+
+void proc_timer_fini(void)
+{
+	RATTLOG_TRACE();
+	pthread_mutex_lock(&l_timer_lock);
+	if (__atomic_exchange_n(&l_timer_kicked, 0, __ATOMIC_SEQ_CST))
+		l_timer_release(&l_timer_kick, 1);
+	ratt_table_destroy(&l_timertab);
+	l_timer_next = UINT64_MAX;
+	pthread_mutex_unlock(&l_timer_lock);
+}
+
+int proc_timer_init(int (*dispatch)(ratt_proc_entry_t const *, size_t),
+                    void (*release)(ratt_proc_entry_t const *, size_t))
+{
+	RATTLOG_TRACE();
+	size_t i;
+	int retval;
+
+	retval = ratt_table_create_hashed(&l_timertab, PROC_TIMER_TABSIZ,
+	    sizeof(proc_timer_t), 0, &l_timertab_hash);
+	if (retval != OK) {
+		debug("ratt_table_create_hashed() failed");
+		return FAIL;
+	}
+
+	for (i = 0; i < PROC_TIMER_LEVELS * PROC_TIMER_SLOTS; ++i)
+		l_timer_slot[i] = PROC_TIMER_NONE;
+	memset(l_timer_mask, 0, sizeof(l_timer_mask));
+	l_timer_now = timer_clock();
+	l_timer_next = UINT64_MAX;
+	l_timer_dispatch = dispatch;
+	l_timer_release = release;
+	return OK;
+}
@@ -0,0 +1,23 @@
+#ifndef SRC_PROC_TIMER_H
+#define SRC_PROC_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <rattle/proc.h>
+
+/* true if attributes make a process timed */
+static inline int proc_timer_timed(ratt_proc_attr_t const *attr)
+{
+	return (attr && (attr->period || attr->deadline));
+}
+
+void proc_timer_fini(void);
+int proc_timer_init(int (*)(ratt_proc_entry_t const *, size_t),
+    void (*)(ratt_proc_entry_t const *, size_t));
+uint64_t proc_timer_tick(void);
+int proc_timer_kick(void *);
+void proc_timer_cancel(int (*)(void *), ratt_proc_attr_t *, void *);
+int proc_timer_arm(int (*)(void *), ratt_proc_attr_t *, void *);
+
+#endif /* SRC_PROC_TIMER_H */
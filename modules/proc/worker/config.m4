@@ -3,3 +3,9 @@
 #
 
 RATTLE_MODULE([proc_worker])
+
+# CPU affinity of workers
+AC_CHECK_FUNCS([pthread_attr_setaffinity_np sched_getaffinity])
+
+# idle workers sleep on a futex when available
+AC_CHECK_HEADERS([linux/futex.h])
@@ -25,6 +25,10 @@
  * SUCH DAMAGE.
  */
 
+/* CPU_SET and friends */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -34,18 +38,28 @@
 #error "proc_worker implies WANT_THREADS"
 #endif
 
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #include <rattle/conf.h>
 #include <rattle/def.h>
 #include <rattle/log.h>
 #include <rattle/module.h>
 #include <rattle/proc.h>
+#include <rattle/ring.h>
 #include <rattle/table.h>
 
 #define MODULE_NAME	RATT_PROC_NAME "_worker"
@@ -64,6 +78,33 @@ static uint8_t l_conf_worker_min = 0;
 static RATT_CONF_DEFVAL(l_conf_worker_max_defval, PROC_WORKER_MAX);
 static uint8_t l_conf_worker_max = 0;
 
+#ifndef PROC_WORKER_SCHED
+#define PROC_WORKER_SCHED	"round-robin"	/* scheduling policy */
+#endif
+static RATT_CONF_DEFVAL(l_conf_worker_sched_defval, PROC_WORKER_SCHED);
+static char *l_conf_worker_sched = NULL;
+
+#ifndef PROC_WORKER_GROW
+#define PROC_WORKER_GROW	"64"	/* processes per worker */
+#endif
+static RATT_CONF_DEFVAL(l_conf_worker_grow_defval, PROC_WORKER_GROW);
+static uint16_t l_conf_worker_grow = 0;
+
+#ifndef PROC_WORKER_LINGER
+#define PROC_WORKER_LINGER	"60"	/* idle seconds */
+#endif
+static RATT_CONF_DEFVAL(l_conf_worker_linger_defval, PROC_WORKER_LINGER);
+static uint16_t l_conf_worker_linger = 0;
+
+static RATT_CONF_DEFVAL(l_conf_worker_cpuset_defval, NULL);	/* no pinning */
+static RATT_CONF_LIST_INIT(l_conf_worker_cpuset);
+
+#ifndef PROC_WORKER_NUMA
+#define PROC_WORKER_NUMA	"none"	/* memory placement */
+#endif
+static RATT_CONF_DEFVAL(l_conf_worker_numa_defval, PROC_WORKER_NUMA);
+static char *l_conf_worker_numa = NULL;
+
 static ratt_conf_t l_conf[] = {
 	{ "worker/min-workers", "minimum number of threads (workers)",
 	    l_conf_worker_min_defval, &l_conf_worker_min,
@@ -71,11 +112,67 @@ static ratt_conf_t l_conf[] = {
 	{ "worker/max-workers", "maximum number of threads (workers)",
 	    l_conf_worker_max_defval, &l_conf_worker_max,
 	    RATTCONFDTNUM8, RATTCONFFLUNS },
+	{ "worker/scheduler", "scheduling policy, round-robin or "
+	    "work-stealing", l_conf_worker_sched_defval, &l_conf_worker_sched,
+	    RATTCONFDTSTR, 0 },
+	{ "worker/grow-threshold", "processes per worker above which a "
+	    "worker is added, 0 disables growing",
+	    l_conf_worker_grow_defval, &l_conf_worker_grow,
+	    RATTCONFDTNUM16, RATTCONFFLUNS },
+	{ "worker/linger", "seconds an idle worker lingers before it is "
+	    "retired, 0 disables retiring",
+	    l_conf_worker_linger_defval, &l_conf_worker_linger,
+	    RATTCONFDTNUM16, RATTCONFFLUNS },
+	{ "worker/cpu-set", "CPUs workers are pinned to, one each in turn",
+	    l_conf_worker_cpuset_defval, &l_conf_worker_cpuset,
+	    RATTCONFDTNUM16, RATTCONFFLLST | RATTCONFFLUNS },
+	{ "worker/numa-policy", "memory placement, none or local",
+	    l_conf_worker_numa_defval, &l_conf_worker_numa,
+	    RATTCONFDTSTR, 0 },
 	{ NULL }
 };
 
+/* scheduling policy */
+typedef enum {
+	PROC_WORKER_SCHED_RR = 0,	/* processes stay on their worker */
+	PROC_WORKER_SCHED_STEAL,	/* idle workers steal processes */
+} proc_worker_sched_t;
+
+static proc_worker_sched_t l_worker_sched = PROC_WORKER_SCHED_RR;
+
+/* memory placement policy */
+typedef enum {
+	PROC_WORKER_NUMA_NONE = 0,	/* allocated by the creator */
+	PROC_WORKER_NUMA_LOCAL,		/* allocated by the worker itself */
+} proc_worker_numa_t;
+
+static proc_worker_numa_t l_worker_numa = PROC_WORKER_NUMA_NONE;
+
+/* CPUs workers are pinned to, empty for no pinning */
+static cpu_set_t l_worker_cpuset;
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+static int l_worker_cpu = -1;		/* CPU of the last worker */
+#endif
+
+/* least time between two steal attempts of a busy worker */
+#ifndef PROC_WORKER_STEAL_USEC
+#define PROC_WORKER_STEAL_USEC		1000
+#endif
+
+/* rounds an idle worker spins before sleeping, a burst may be coming */
+#ifndef PROC_WORKER_SPIN
+#define PROC_WORKER_SPIN		64
+#endif
+
+/* cache line size, parts of a worker written by others lie apart */
+#ifndef PROC_WORKER_LINESIZ
+#define PROC_WORKER_LINESIZ		64
+#endif
+#define PROC_WORKER_LINE	__attribute__((aligned(PROC_WORKER_LINESIZ)))
+
 /* worker flags */
 #define PROC_WORKER_FLMEM	0x1	/* memory holder */
+#define PROC_WORKER_FLREADY	0x2	/* worker allocated its own memory */
 
 /* worker state */
 typedef enum {
@@ -94,24 +191,68 @@ static proc_worker_state_t l_proc_worker_state = PROC_WORKER_STATE_BOOT;
 static RATT_TABLE_INIT(l_worktab);	/* worker table */
 static pthread_mutex_t l_worktab_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* processes on all workers (atomic), away from the worktab lock */
+static size_t l_proc_count PROC_WORKER_LINE = 0;
+
+/* next worker in round-robin order */
+static size_t l_worker_rrpos = 0;
+
+/* workers idle under work-stealing (atomic), worth hailing */
+static size_t l_worker_idle = 0;
+
+/* runs of retired workers (atomic) */
+static uint64_t l_runs_retired[RATTPROCPRCNT];
+
 /* process table initial size */
 #ifndef PROC_WORKER_PROCTABSIZ
 #define PROC_WORKER_PROCTABSIZ		4
 #endif
 
+/* newcomers a worker holds before registrars take its lock */
+#ifndef PROC_WORKER_INBOXSIZ
+#define PROC_WORKER_INBOXSIZ		64
+#endif
+
+/*
+ * Hot parts come first, each on lines of its own: what registrars
+ * write to wake the worker, the process tables the worker shares with
+ * thieves, the inbox registrars push to, then the run counters only
+ * the worker writes.  Cold parts follow, set once or touched around a
+ * nap.  Workers are allocated on line boundaries, neighbours never
+ * share.
+ */
 typedef struct {
+	/* wake-up (atomic) */
+	proc_worker_state_t state PROC_WORKER_LINE;	/* worker state */
+	uint32_t wake;			/* wake-up counter, futex word */
+	int sleeping;			/* worker waits on wake */
+	int parked;			/* worker counted in l_worker_idle */
+
+	/* process tables, one per priority class */
+	pthread_mutex_t proctab_lock PROC_WORKER_LINE;	/* foreign access */
+	int foreign;			/* a foreign thread is in (atomic) */
+	int picking;			/* owner picks unlocked (atomic) */
+	int picklock;			/* owner picks under the lock */
+	ratt_table_t proctab[RATTPROCPRCNT];
+	ratt_proc_round_t round;	/* where the owner is in them */
+	uint64_t rest;			/* earliest end of a rest, 0 if none */
+
+	/* newcomers, pushed without a lock */
+	ratt_ring_t inbox;
+
+	/* run counters, written by the worker alone (atomic) */
+	uint64_t runs PROC_WORKER_LINE;	/* processes run so far */
+	uint64_t runs_rank[RATTPROCPRCNT];	/* runs per class */
+
+	/* cold */
+	uint64_t runs_seen PROC_WORKER_LINE;	/* runs at last steal
+						 * attempt, worktab lock */
+	uint32_t flags;			/* worker flags (atomic) */
 	pthread_t id;			/* worker id */
+	int cpu;			/* pinned CPU, -1 if none */
 	pthread_attr_t attr;		/* worker attributes */
-	pthread_cond_t get_to_work;	/* worker has to work */
-	pthread_mutex_t lock;		/* worker lock */
-	proc_worker_state_t state;	/* worker state */
-	uint32_t flags;			/* worker flags */
-
-	ratt_table_t proctab;		/* process table */
-	pthread_mutex_t proctab_lock;	/* process table lock */
-
-	/* not locked */
-
+	pthread_cond_t get_to_work;	/* wait without futex */
+	pthread_mutex_t lock;		/* wait without futex */
 	sigset_t sigblockmask;		/* blocked signals */
 } worker_register_t;
 
@@ -119,7 +260,8 @@ typedef struct {
 	int (*process)(void *);		/* process pointer */
 	ratt_proc_attr_t *attr;		/* process attributes */
 	void *udata;			/* process user data */
-	unsigned int failure;		/* process failure count */
+	ratt_proc_health_t health;	/* failures of a sticky process */
+	ratt_proc_hist_t *hist;		/* run latencies, NULL if none */
 } proc_register_t;
 
 /* proc_worker program arguments */
@@ -130,6 +272,49 @@ static ratt_args_t l_args[] = {
 	{ 0 }
 };
 
+/* keep the CPUs we may run on; without any, workers are not pinned */
+static int check_config_cpuset()
+{
+	cpu_set_t allowed;
+	uint16_t *cpu = NULL;
+
+	CPU_ZERO(&l_worker_cpuset);
+	if (!ratt_table_exists(&l_conf_worker_cpuset)
+	    || ratt_table_isempty(&l_conf_worker_cpuset))
+		return OK;
+
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP) \
+    && defined(HAVE_SCHED_GETAFFINITY)
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+		warning("proc_worker: unknown CPU affinity, "
+		    "workers are not pinned");
+		return OK;
+	}
+
+	RATT_CONF_LIST_FOREACH(&l_conf_worker_cpuset, cpu)
+	{
+		if (*cpu >= CPU_SETSIZE || !CPU_ISSET(*cpu, &allowed)) {
+			warning("proc_worker: CPU %u is not available",
+			    *cpu);
+			continue;
+		}
+		CPU_SET(*cpu, &l_worker_cpuset);
+	}
+
+	if (!CPU_COUNT(&l_worker_cpuset))
+		warning("proc_worker: no CPU available in cpu-set, "
+		    "workers are not pinned");
+#else
+	(void) allowed;
+	(void) cpu;
+	warning("proc_worker: CPU affinity not supported, "
+	    "workers are not pinned");
+#endif
+
+	return OK;
+}
+
 static int check_config()
 {
 	if (l_conf_worker_min <= 0) {
@@ -141,6 +326,38 @@ static int check_config()
 		return FAIL;
 	}
 
+	if (!l_conf_worker_sched
+	    || strcmp(l_conf_worker_sched, "round-robin") == 0) {
+		l_worker_sched = PROC_WORKER_SCHED_RR;
+	} else if (strcmp(l_conf_worker_sched, "work-stealing") == 0) {
+		l_worker_sched = PROC_WORKER_SCHED_STEAL;
+	} else {
+		error("proc_worker: unknown scheduler `%s'",
+		    l_conf_worker_sched);
+		return FAIL;
+	}
+
+	if (!l_conf_worker_numa || strcmp(l_conf_worker_numa, "none") == 0) {
+		l_worker_numa = PROC_WORKER_NUMA_NONE;
+	} else if (strcmp(l_conf_worker_numa, "local") == 0) {
+		l_worker_numa = PROC_WORKER_NUMA_LOCAL;
+	} else {
+		error("proc_worker: unknown numa-policy `%s'",
+		    l_conf_worker_numa);
+		return FAIL;
+	}
+
+	if (check_config_cpuset() != OK)
+		return FAIL;
+
+	/* unpinned, a worker may allocate on one node and run on another */
+	if (l_worker_numa == PROC_WORKER_NUMA_LOCAL
+	    && !CPU_COUNT(&l_worker_cpuset)) {
+		warning("proc_worker: numa-policy `local' needs a cpu-set, "
+		    "using `none'");
+		l_worker_numa = PROC_WORKER_NUMA_NONE;
+	}
+
 	return OK;
 }
 
@@ -153,24 +370,43 @@ static inline void set_state(proc_worker_state_t state)
 	    old, state);
 }
 
+static inline proc_worker_state_t
+worker_get_state(worker_register_t *worker)
+{
+	return __atomic_load_n(&(worker->state), __ATOMIC_SEQ_CST);
+}
+
 static inline void
 worker_set_state(worker_register_t *worker, proc_worker_state_t state)
 {
 	proc_worker_state_t old;
-	old = worker->state;
-	worker->state = state;
+	old = __atomic_exchange_n(&(worker->state), state, __ATOMIC_SEQ_CST);
 	debug("worker (%p) state changed from %u to %u",
-	    worker, old, worker->state);
+	    worker, old, state);
+}
+
+/* the worker leaves l_worker_idle, or joins it */
+static inline void worker_park(worker_register_t *self, int parked)
+{
+	if (self->parked == parked)
+		return;
+	__atomic_store_n(&(self->parked), parked, __ATOMIC_SEQ_CST);
+	if (parked)
+		__atomic_add_fetch(&l_worker_idle, 1, __ATOMIC_SEQ_CST);
+	else
+		__atomic_sub_fetch(&l_worker_idle, 1, __ATOMIC_SEQ_CST);
 }
 
 static void worker_cleanup(void *udata)
 {
 	worker_register_t *worker = udata;
 
+	worker_park(worker, 0);
+
+	/* locks live on until worker_destroy(), others may still
+	 * wake us while we are cancelled */
 	pthread_attr_destroy(&(worker->attr));
-	pthread_cond_destroy(&(worker->get_to_work));
-	pthread_mutex_destroy(&(worker->lock));
-	pthread_mutex_destroy(&(worker->proctab_lock));
+	ratt_proc_leave();
 }
 
 static void worker_cleanup_mutex_unlock(void *udata)
@@ -179,40 +415,678 @@ static void worker_cleanup_mutex_unlock(void *udata)
 	pthread_mutex_unlock(mutex);
 }
 
+static void idle_deadline(struct timespec *deadline, uint64_t usec)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += usec / 1000000;
+	deadline->tv_nsec += (usec % 1000000) * 1000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+static inline uint64_t elapsed_usec(struct timespec const *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000
+	    + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/*
+ * The worker sleeps on its wake counter once it found nothing to do;
+ * whoever gives it work bumps the counter and only issues a wake-up if
+ * the worker flagged itself sleeping, so a burst of registrations costs
+ * a single system call.  usec of 0 waits until woken.
+ */
+#ifdef HAVE_LINUX_FUTEX_H
+static void worker_sleep(worker_register_t *worker, uint32_t seq,
+    uint64_t usec)
+{
+	struct timespec timeout;
+
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_nsec = (usec % 1000000) * 1000;
+
+	/* returns at once if wake moved past seq */
+	syscall(SYS_futex, &(worker->wake), FUTEX_WAIT_PRIVATE, seq,
+	    (usec) ? &timeout : NULL, NULL, 0);
+}
+
+static void worker_kick(worker_register_t *worker)
+{
+	syscall(SYS_futex, &(worker->wake), FUTEX_WAKE_PRIVATE, INT_MAX,
+	    NULL, NULL, 0);
+}
+#else
+static void worker_sleep(worker_register_t *worker, uint32_t seq,
+    uint64_t usec)
+{
+	struct timespec deadline;
+
+	pthread_cleanup_push(&worker_cleanup_mutex_unlock, &(worker->lock));
+	pthread_mutex_lock(&(worker->lock));
+	if (__atomic_load_n(&(worker->wake), __ATOMIC_SEQ_CST) == seq) {
+		if (usec) {
+			idle_deadline(&deadline, usec);
+			pthread_cond_timedwait(&(worker->get_to_work),
+			    &(worker->lock), &deadline);
+		} else
+			pthread_cond_wait(&(worker->get_to_work),
+			    &(worker->lock));
+	}
+	/* worker_cleanup_mutex_unlock (worker) */
+	pthread_cleanup_pop(1);
+}
+
+static void worker_kick(worker_register_t *worker)
+{
+	pthread_mutex_lock(&(worker->lock));
+	pthread_cond_broadcast(&(worker->get_to_work));
+	pthread_mutex_unlock(&(worker->lock));
+}
+#endif
+
+static inline void worker_wake(worker_register_t *worker)
+{
+	__atomic_add_fetch(&(worker->wake), 1, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&(worker->sleeping), 0, __ATOMIC_SEQ_CST))
+		worker_kick(worker);
+}
+
+static int compare_process(void const *in, void const *find)
+{
+	proc_register_t const *entry = in;
+	proc_register_t const *proc = find;
+	int retval;
+
+	if (proc->process != entry->process) {
+		/* not the same process */
+		return NOMATCH;
+	}
+
+	if (proc->udata && (proc->udata != entry->udata)) {
+		/* process to find has user data,
+		 * entry might have but did not match */
+		return NOMATCH;
+	} else if (!proc->udata && entry->udata) {
+		/* process to find has no user data, entry has */
+		return NOMATCH;
+	}
+
+	if (proc->attr) {
+		/* process to find has attributes */
+		if (entry->attr) {
+			retval = memcmp(proc->attr,
+			    entry->attr, sizeof(ratt_proc_attr_t));
+			if (retval != 0) {
+				/* attributes did not match */
+				return NOMATCH;
+			}
+		} else	/* entry has no attribute */
+			return NOMATCH;
+	} else if (entry->attr) {
+		/* process to find has no attribute, entry has */
+		return NOMATCH;
+	}
+
+	return MATCH;
+}
+
+static int proctab_create(worker_register_t *worker)
+{
+	int rank;
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank) {
+		if (ratt_table_create(&(worker->proctab[rank]),
+		    PROC_WORKER_PROCTABSIZ, sizeof(proc_register_t),
+		    RATTTABFLSEG) != OK) {
+			debug("ratt_table_create() failed");
+			while (rank--)
+				ratt_table_destroy(&(worker->proctab[rank]));
+			return FAIL;
+		}
+	}
+
+	if (ratt_ring_create(&(worker->inbox), PROC_WORKER_INBOXSIZ,
+	    sizeof(proc_register_t), 0) != OK) {
+		debug("ratt_ring_create() failed");
+		for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+			ratt_table_destroy(&(worker->proctab[rank]));
+		return FAIL;
+	}
+
+	return OK;
+}
+
+static inline size_t proctab_count(worker_register_t *worker)
+{
+	size_t count = 0;
+	int rank;
+
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+		count += ratt_table_count(&(worker->proctab[rank]));
+
+	return count + ratt_ring_count(&(worker->inbox));
+}
+
+/* caller holds the proctab lock */
+static int proctab_insert(worker_register_t *worker, proc_register_t *proc)
+{
+	unsigned int rank = ratt_proc_rank(proc->attr);
+	ratt_table_t *table = &(worker->proctab[rank]);
+	size_t pos = ratt_table_pos_current(table);
+	int retval;
+
+	retval = ratt_table_insert(table, proc);
+	ratt_proc_restore(table, pos);
+	if (retval == OK)
+		ratt_proc_round_fresh(&(worker->round), rank);
+
+	return retval;
+}
+
+/* caller has the tables to itself; newcomers leave the inbox for them */
+static void proctab_drain(worker_register_t *worker)
+{
+	proc_register_t proc;
+
+	while (ratt_ring_pop(&(worker->inbox), &proc) == OK) {
+		if (proctab_insert(worker, &proc) == OK)
+			continue;
+
+		/* wait in the inbox for the next drain */
+		debug("ratt_table_insert() failed");
+		if (ratt_ring_push(&(worker->inbox), &proc) != OK) {
+			error("proc_worker: lost process at %p",
+			    proc.process);
+			__atomic_sub_fetch(&l_proc_count, 1, __ATOMIC_RELAXED);
+		}
+		break;
+	}
+}
+
+/*
+ * The owner picks from its tables without the lock.  Any other thread
+ * takes the lock, flags itself and waits for a pick going on to end;
+ * the owner seeing the flag queues on the lock instead.
+ */
+static void proctab_enter(worker_register_t *worker)
+{
+	pthread_mutex_lock(&(worker->proctab_lock));
+	__atomic_store_n(&(worker->foreign), 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&(worker->picking), __ATOMIC_SEQ_CST))
+		sched_yield();
+	proctab_drain(worker);
+}
+
+static void proctab_leave(worker_register_t *worker)
+{
+	__atomic_store_n(&(worker->foreign), 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&(worker->proctab_lock));
+}
+
+static void worker_cleanup_proctab_leave(void *udata)
+{
+	proctab_leave(udata);
+}
+
+/* the owner alone; pick_leave() follows */
+static void proctab_pick_enter(worker_register_t *self)
+{
+	__atomic_store_n(&(self->picking), 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&(self->foreign), __ATOMIC_SEQ_CST)) {
+		__atomic_store_n(&(self->picking), 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_lock(&(self->proctab_lock));
+		self->picklock = 1;
+	}
+	proctab_drain(self);
+}
+
+static void proctab_pick_leave(worker_register_t *self)
+{
+	if (self->picklock) {
+		self->picklock = 0;
+		pthread_mutex_unlock(&(self->proctab_lock));
+	} else
+		__atomic_store_n(&(self->picking), 0, __ATOMIC_SEQ_CST);
+}
+
+static void worker_cleanup_pick_leave(void *udata)
+{
+	proctab_pick_leave(udata);
+}
+
+/*
+ * Each process table is the deque of its worker; the owner goes round
+ * it from the head while a thief takes from the tail, leaving alone
+ * the process the owner is running.
+ *
+ * An idle thief picks the worker with the most processes; a busy one
+ * only relieves a worker which has not run a single process since the
+ * previous attempt, i.e. one stuck in a slow process.
+ */
+static int worker_steal(worker_register_t *self, int idle)
+{
+	worker_register_t **worker = NULL, *victim = NULL;
+	proc_register_t *entry = NULL, proc;
+	size_t busiest = 1, count, pos;	/* a lonely process stays */
+	ratt_table_t *table = NULL;
+	uint64_t runs;
+	int retval = FAIL, rank;
+
+	pthread_cleanup_push(&worker_cleanup_mutex_unlock, &l_worktab_lock);
+	pthread_mutex_lock(&l_worktab_lock);
+
+	RATT_TABLE_FOREACH(&l_worktab, worker)
+	{
+		if (*worker == self)
+			continue;
+
+		/* counts are read unlocked; good enough for a choice */
+		count = proctab_count(*worker);
+		runs = __atomic_load_n(&((*worker)->runs), __ATOMIC_RELAXED);
+		if (count > busiest
+		    && (idle || runs == (*worker)->runs_seen)) {
+			busiest = count;
+			victim = *worker;
+		}
+		(*worker)->runs_seen = runs;
+	}
+
+	if (victim) {
+		pthread_cleanup_push(&worker_cleanup_proctab_leave, victim);
+		proctab_enter(victim);
+
+		/* higher classes first, they matter most */
+		for (rank = 0; rank < RATTPROCPRCNT && retval != OK; ++rank) {
+			table = &(victim->proctab[rank]);
+			pos = ratt_table_pos_current(table);
+			entry = ratt_table_last(table);
+			if (entry && rank == victim->round.rank
+			    && ratt_table_pos_last(table) == pos)
+				entry = ratt_table_prev(table);
+
+			if (entry) {
+				proc = *entry;
+				ratt_table_del_current(table);
+				retval = OK;
+			}
+
+			ratt_proc_restore(table, pos);
+		}
+
+		/* worker_cleanup_proctab_leave (victim) */
+		pthread_cleanup_pop(1);
+	}
+
+	if (retval == OK) {
+		pthread_mutex_lock(&(self->proctab_lock));
+		retval = proctab_insert(self, &proc);
+		pthread_mutex_unlock(&(self->proctab_lock));
+
+		if (retval != OK) {	/* give it back */
+			debug("ratt_table_insert() failed");
+			proctab_enter(victim);
+			if (proctab_insert(victim, &proc) != OK)
+				error("proc_worker: lost process at %p",
+				    proc.process);
+			proctab_leave(victim);
+		} else
+			debug("worker (%p) stole process %p from (%p)",
+			    self, proc.process, victim);
+	}
+
+	/* worker_cleanup_mutex_unlock (worktab) */
+	pthread_cleanup_pop(1);
+
+	return retval;
+}
+
+/*
+ * Caller holds l_worktab_lock.  Processes queued behind a busy worker
+ * rouse one idle worker, which comes and steals them; idle workers
+ * sleep until then.
+ */
+static void worker_hail(worker_register_t *self)
+{
+	worker_register_t **worker = NULL;
+
+	RATT_TABLE_FOREACH(&l_worktab, worker)
+	{
+		if (*worker != self
+		    && __atomic_load_n(&((*worker)->parked), __ATOMIC_SEQ_CST)
+		    && worker_get_state(*worker) == PROC_WORKER_STATE_IDLE) {
+			worker_wake(*worker);
+			break;
+		}
+	}
+}
+
+static void worker_destroy(worker_register_t *worker)
+{
+	int rank;
+
+	/* worker_cleanup should have been called already */
+	pthread_cond_destroy(&(worker->get_to_work));
+	pthread_mutex_destroy(&(worker->lock));
+	pthread_mutex_destroy(&(worker->proctab_lock));
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+		ratt_table_destroy(&(worker->proctab[rank]));
+	if (ratt_ring_exists(&(worker->inbox)))
+		ratt_ring_destroy(&(worker->inbox));
+}
+
+/*
+ * worker_create() throws away a worker that never got to its loop; the
+ * caller may be a worker growing the pool, its reader stays registered.
+ */
+static void worker_discard(worker_register_t *worker)
+{
+	pthread_attr_destroy(&(worker->attr));
+	worker_destroy(worker);
+	free(worker);
+}
+
+/* what a pick of the owner passes over */
+typedef struct {
+	worker_register_t *self;
+	uint64_t now;			/* read once, on need */
+} worker_pick_t;
+
+/* a failing process resting; keeps the earliest end of a rest */
+static int worker_resting(void const *in, void *udata)
+{
+	proc_register_t const *entry = in;
+	worker_pick_t *pick = udata;
+
+	if (!ratt_proc_resting(&(entry->health), &(pick->now)))
+		return 0;
+	if (!pick->self->rest || entry->health.retry < pick->self->rest)
+		pick->self->rest = entry->health.retry;
+	return 1;
+}
+
+/*
+ * Caller is the owner, in between proctab_pick_enter() and leave().
+ * Failing processes are passed over while they rest.
+ */
+static proc_register_t *worker_pick(worker_register_t *self, int *wrapped)
+{
+	worker_pick_t pick = { self, 0 };
+
+	self->rest = 0;
+	return ratt_proc_round_pick(self->proctab, &(self->round),
+	    worker_resting, &pick, wrapped);
+}
+
+/*
+ * A worker which lingered idle long enough leaves the pool unless it
+ * would shrink below min-workers; once out of the worker table nobody
+ * may reach it anymore and it can free itself.
+ */
+static int worker_retire(worker_register_t *self)
+{
+	worker_register_t **worker = NULL;
+	int retval = FAIL, rank;
+
+	/* processes only come in under the worktab lock */
+	pthread_cleanup_push(&worker_cleanup_mutex_unlock, &l_worktab_lock);
+	pthread_mutex_lock(&l_worktab_lock);
+	pthread_mutex_lock(&(self->proctab_lock));
+
+	if (worker_get_state(self) == PROC_WORKER_STATE_IDLE
+	    && !proctab_count(self)
+	    && ratt_table_count(&l_worktab) > l_conf_worker_min) {
+		RATT_TABLE_FOREACH(&l_worktab, worker)
+		{
+			if (*worker != self)
+				continue;
+
+			ratt_table_del_current(&l_worktab);
+			worker_set_state(self, PROC_WORKER_STATE_STOP);
+
+			/* keep the stats of the runs */
+			for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+				__atomic_add_fetch(&(l_runs_retired[rank]),
+				    self->runs_rank[rank], __ATOMIC_RELAXED);
+			retval = OK;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&(self->proctab_lock));
+	/* worker_cleanup_mutex_unlock (worktab) */
+	pthread_cleanup_pop(1);
+
+	if (retval == OK)
+		debug("worker (%p) retired", self);
+
+	return retval;
+}
+
+/*
+ * Failure accounting of a sticky process the worker ran from pos; a
+ * process stolen meanwhile keeps the state it left with.
+ */
+static void worker_account(worker_register_t *self, unsigned int rank,
+    size_t pos, proc_register_t *proc, int retval)
+{
+	ratt_proc_entry_t entry = { proc->process, proc->attr, proc->udata };
+	ratt_table_t *table = &(self->proctab[rank]);
+	proc_register_t *found = NULL;
+	size_t cur;
+	int verdict;
+
+	verdict = ratt_proc_account(&entry, retval, &(proc->health));
+
+	pthread_cleanup_push(&worker_cleanup_mutex_unlock,
+	    &(self->proctab_lock));
+	pthread_mutex_lock(&(self->proctab_lock));
+
+	cur = ratt_table_pos_current(table);
+	if (pos <= ratt_table_pos_last(table)
+	    && !ratt_table_pos_isfrag(table, pos))
+		found = ratt_table_chunk(table, pos);
+	if (found && compare_process(found, proc) != MATCH) {
+		found = NULL;
+		ratt_table_search(table, (void **) &found,
+		    compare_process, proc);
+	}
+
+	if (found) {
+		if (verdict == OK)
+			found->health = proc->health;
+		else {
+			ratt_table_del_current(table);
+			__atomic_sub_fetch(&l_proc_count, 1,
+			    __ATOMIC_RELAXED);
+		}
+	}
+	ratt_proc_restore(table, cur);
+
+	/* worker_cleanup_mutex_unlock (proctab) */
+	pthread_cleanup_pop(1);
+}
+
+/* how long an idle worker naps, 0 until woken */
+static uint64_t worker_nap(worker_register_t *self, uint64_t linger)
+{
+	uint64_t usec = linger, now, until;
+
+	/* up again for the next timer, or when the first failing
+	 * process is done resting */
+	until = ratt_proc_tick();
+	if (self->rest && (!until || self->rest < until))
+		until = self->rest;
+
+	if (until) {
+		now = ratt_proc_clock();
+		now = (until > now) ? until - now : 1;
+		if (!usec || now < usec)
+			usec = now;
+	}
+
+	return usec;
+}
+
 static void *worker_loop(void *udata)
 {
 	worker_register_t *self = udata;
-	proc_register_t *proc = NULL;
-	int retval;
+	proc_register_t *entry = NULL, proc;
+	struct timespec last_steal = { 0 }, idle_since;
+	uint64_t linger = (uint64_t) l_conf_worker_linger * 1000000;
+	uint64_t since, usec;
+	proc_worker_state_t state;
+	unsigned int rank;
+	uint32_t seq;
+	size_t pos = 0;
+	int retval, wrapped, retired = 0, spin, hail = 0;
 
 	pthread_sigmask(SIG_BLOCK, &(self->sigblockmask), NULL);
+
+	/* allocated and first touched here to be local to our CPU */
+	if (l_worker_numa == PROC_WORKER_NUMA_LOCAL) {
+		retval = proctab_create(self);
+
+		/* last touch of self should it fail */
+		__atomic_or_fetch(&(self->flags), PROC_WORKER_FLREADY,
+		    __ATOMIC_SEQ_CST);
+
+		if (retval != OK) {
+			/* worker_create() disposes of us */
+			debug("ratt_table_create() failed");
+			return NULL;
+		}
+	}
+
 	pthread_cleanup_push(&worker_cleanup, self);
 
-	do {
-		pthread_cleanup_push(&worker_cleanup_mutex_unlock,
-		    &(self->lock));
-		pthread_mutex_lock(&(self->lock));
-		while (self->state != PROC_WORKER_STATE_RUN)
-			pthread_cond_wait(&(self->get_to_work), &(self->lock));
-debug("HEY!");
-		/* worker_cleanup_mutex_unlock (self) */
-		pthread_cleanup_pop(0);	/* do not execute */
-
-		pthread_cleanup_push(&worker_cleanup_mutex_unlock,
-		    &(self->proctab_lock));
-		pthread_mutex_lock(&(self->proctab_lock));
+	clock_gettime(CLOCK_MONOTONIC, &idle_since);
+	ratt_proc_online();
+
+	while (!retired) {
+		/* nothing from the last round is held anymore */
+		ratt_proc_quiescent();
+
+		state = worker_get_state(self);
+		if (state != PROC_WORKER_STATE_RUN) {
+			if (state == PROC_WORKER_STATE_IDLE
+			    && l_worker_sched == PROC_WORKER_SCHED_STEAL)
+				worker_park(self, 1);
+
+			/* a wake-up from now on is not lost; counted idle
+			 * first, a registrar hails us or we see its work */
+			seq = __atomic_load_n(&(self->wake), __ATOMIC_SEQ_CST);
+
+			if (state == PROC_WORKER_STATE_IDLE) {
+				/* failing processes done resting */
+				if (self->rest
+				    && ratt_proc_clock() >= self->rest) {
+					self->rest = 0;
+					__atomic_compare_exchange_n(
+					    &(self->state), &state,
+					    PROC_WORKER_STATE_RUN, 0,
+					    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+					continue;
+				}
+
+				/* idle for too long, leave the pool */
+				if (linger
+				    && elapsed_usec(&idle_since) >= linger
+				    && worker_retire(self) == OK) {
+					retired = 1;
+					continue;
+				}
+
+				/* idle, look for work elsewhere */
+				if (l_worker_sched == PROC_WORKER_SCHED_STEAL
+				    && worker_steal(self, 1) == OK) {
+					__atomic_compare_exchange_n(
+					    &(self->state), &state,
+					    PROC_WORKER_STATE_RUN, 0,
+					    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+					continue;
+				}
+			}
+
+			for (spin = 0; spin < PROC_WORKER_SPIN
+			    && state == PROC_WORKER_STATE_IDLE
+			    && worker_get_state(self) == state; ++spin)
+				sched_yield();
+			if (worker_get_state(self) != state)
+				continue;
+
+			/* announce the nap, then look again so a wake-up
+			 * in between is not lost */
+			__atomic_store_n(&(self->sleeping), 1, __ATOMIC_SEQ_CST);
+			if (worker_get_state(self) == state) {
+				/* due timers may wake us at once */
+				usec = (state != PROC_WORKER_STATE_IDLE) ? 0
+				    : worker_nap(self, linger);
+				ratt_proc_offline();
+				worker_sleep(self, seq, usec);
+				ratt_proc_online();
+			}
+			__atomic_store_n(&(self->sleeping), 0, __ATOMIC_SEQ_CST);
+
+			/* a futex wait is no cancellation point */
+			pthread_testcancel();
+			continue;
+		}
+		worker_park(self, 0);
 
-		proc = ratt_table_circular_next(&(self->proctab));
+		pthread_cleanup_push(&worker_cleanup_pick_leave, self);
+		proctab_pick_enter(self);
+
+		/* work on a copy; the entry may be deleted or stolen
+		 * while the process runs */
+		entry = worker_pick(self, &wrapped);
+		rank = self->round.rank;
+		if (entry) {
+			proc = *entry;
+			pos = ratt_table_pos_current(&(self->proctab[rank]));
+			if (!proc.attr || !(proc.attr->flags & RATTPROCFLSTC)) {
+				ratt_table_del_current(&(self->proctab[rank]));
+				__atomic_sub_fetch(&l_proc_count, 1,
+				    __ATOMIC_RELAXED);
+			}
+			/* others queued behind us, as worker_steal() sees it */
+			hail = (l_worker_sched == PROC_WORKER_SCHED_STEAL
+			    && __atomic_load_n(&l_worker_idle, __ATOMIC_SEQ_CST)
+			    && proctab_count(self) > 1);
+		} else {
+			state = PROC_WORKER_STATE_RUN;
+			if (__atomic_compare_exchange_n(&(self->state), &state,
+			    PROC_WORKER_STATE_IDLE, 0,
+			    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				/* a registrar pushing since the drain found
+				 * us running and left us be */
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+				state = PROC_WORKER_STATE_IDLE;
+				if (!ratt_ring_isempty(&(self->inbox)))
+					__atomic_compare_exchange_n(
+					    &(self->state), &state,
+					    PROC_WORKER_STATE_RUN, 0,
+					    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+			}
+		}
 
-		/* worker_cleanup_mutex_unlock (proctab) */
+		/* worker_cleanup_pick_leave (self) */
 		pthread_cleanup_pop(1);
 
-		if (!proc) { /* nothing to process */
-			worker_set_state(self, PROC_WORKER_STATE_IDLE);
-			pthread_mutex_unlock(&(self->lock));
+		if (!entry) { /* nothing to process */
+			clock_gettime(CLOCK_MONOTONIC, &idle_since);
 			continue;
-		} else
-			pthread_mutex_unlock(&(self->lock));
+		}
+
+		/* someone else may be at it already */
+		if (hail && pthread_mutex_trylock(&l_worktab_lock) == 0) {
+			worker_hail(self);
+			pthread_mutex_unlock(&l_worktab_lock);
+		}
 
 		/* We should not hold any worker's locks as the
 		 * process we shall execute might need to lock again; i.e.
@@ -223,35 +1097,56 @@ debug("HEY!");
 		 * exhaust the thread stack as would any endless recursivity.
 		 */
 
-		if (!proc->process) {
+		since = ratt_proc_nclock();
+		if (!proc.process) {
 			debug("ghost process; should not happen");
-		} else if (proc->attr && proc->attr->flags & RATTPROCFLNTS) {
+		} else if (proc.attr && proc.attr->flags & RATTPROCFLNTS) {
 			/* process is not thread-safe */
 			pthread_cleanup_push(&worker_cleanup_mutex_unlock,
-			    proc->attr->lock);
-			pthread_mutex_lock(proc->attr->lock);
-			retval = proc->process(proc->udata);
+			    proc.attr->lock);
+			pthread_mutex_lock(proc.attr->lock);
+			retval = proc.process(proc.udata);
 			/* worker_cleanup_mutex_unlock (process) */
 			pthread_cleanup_pop(1);
 		} else
-			retval = proc->process(proc->udata);
-	} while (1);
+			retval = proc.process(proc.udata);
+		/* a process not thread-safe waits for its lock too */
+		ratt_proc_hist_record(proc.hist, ratt_proc_nclock() - since);
+
+		if (proc.process && proc.attr
+		    && (proc.attr->flags & RATTPROCFLSTC)
+		    && (retval != OK || proc.health.failed))
+			worker_account(self, rank, pos, &proc, retval);
+
+		__atomic_add_fetch(&(self->runs), 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&(self->runs_rank[rank]), 1,
+		    __ATOMIC_RELAXED);
+
+		/* once per round, run due timers */
+		if (wrapped)
+			ratt_proc_tick();
+
+		/* once per round, see if another worker is stuck */
+		if (l_worker_sched == PROC_WORKER_SCHED_STEAL && wrapped
+		    && elapsed_usec(&last_steal) >= PROC_WORKER_STEAL_USEC) {
+			clock_gettime(CLOCK_MONOTONIC, &last_steal);
+			worker_steal(self, 0);
+		}
+	}
 
-	/* NOTREACHED */
 	pthread_cleanup_pop(1);	/* worker_cleanup (self) */
-	pthread_exit(NULL);
-}
 
-static void worker_destroy(worker_register_t *worker)
-{
-	/* worker_cleanup should have been called already */
-	ratt_table_destroy(&(worker->proctab));
+	/* retired, out of the worker table */
+	worker_destroy(self);
+	free(self);
+	pthread_exit(NULL);
 }
 
 static void worker_flush(void)
 {
 	worker_register_t **worker = NULL;
 
+	pthread_mutex_lock(&l_worktab_lock);
 	RATT_TABLE_FOREACH_REVERSE(&l_worktab, worker)
 	{
 		worker_destroy(*worker);
@@ -260,8 +1155,44 @@ static void worker_flush(void)
 			free(*worker);
 		}
 	}
+	pthread_mutex_unlock(&l_worktab_lock);
 }
 
+/* pin the worker to the next CPU of cpu-set */
+static void worker_pin(worker_register_t *worker)
+{
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+	cpu_set_t set;
+	int cpu;
+#endif
+
+	worker->cpu = -1;
+
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+	if (!CPU_COUNT(&l_worker_cpuset))
+		return;
+
+	for (cpu = l_worker_cpu + 1;; ++cpu) {
+		if (cpu >= CPU_SETSIZE)
+			cpu = 0;
+		if (CPU_ISSET(cpu, &l_worker_cpuset))
+			break;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_attr_setaffinity_np(&(worker->attr),
+	    sizeof(cpu_set_t), &set) != 0) {
+		warning("proc_worker: cannot pin worker to CPU %i", cpu);
+		return;
+	}
+
+	worker->cpu = l_worker_cpu = cpu;
+	debug("worker (%p) pinned to CPU %i", worker, cpu);
+#endif
+}
+
+/* caller holds l_worktab_lock */
 static int worker_create(unsigned int wanted)
 {
 	worker_register_t *worker = NULL;
@@ -275,32 +1206,39 @@ static int worker_create(unsigned int wanted)
 		wanted = l_conf_worker_max - worker_now;
 	}
 
-	if (wanted)
-		worker = calloc(wanted, sizeof(worker_register_t));
-
-	if (!worker) {
-		debug("either wanted is 0 or calloc() failed");
+	if (!wanted) {
+		debug("wanted is 0");
 		return FAIL;
 	}
 
-	/* first worker is the memory holder */
-	worker->flags |= PROC_WORKER_FLMEM;
-
-	for (i = 0; i < wanted; ++i, ++worker) {
+	for (i = 0; i < wanted; ++i) {
 
-		/* individual process table, destroyed via worker_destroy() */
-		retval = ratt_table_create(&(worker->proctab),
-		    PROC_WORKER_PROCTABSIZ, sizeof(proc_register_t), 0);
-		if (retval != OK) {
-			debug("ratt_table_create() failed");
+		/* each worker holds its memory, it may retire alone */
+		if (posix_memalign((void **) &worker, PROC_WORKER_LINESIZ,
+		    sizeof(worker_register_t)) != 0) {
+			debug("posix_memalign() failed");
 			break;
 		}
+		memset(worker, 0, sizeof(worker_register_t));
+		worker->flags |= PROC_WORKER_FLMEM;
+
+		/* individual process table, destroyed via worker_destroy();
+		 * with a local policy the worker allocates it itself */
+		if (l_worker_numa == PROC_WORKER_NUMA_NONE) {
+			retval = proctab_create(worker);
+			if (retval != OK) {
+				debug("proctab_create() failed");
+				free(worker);
+				break;
+			}
+		}
 
 		/* all signals blocked, set later with pthread_sigmask */
 		sigfillset(&(worker->sigblockmask));
 		sigdelset(&(worker->sigblockmask), SIGSEGV);
 
-		/* initializer, destroyed via worker_cleanup() */
+		/* initializer, destroyed via worker_cleanup(), or
+		 * worker_discard() if the worker never ran */
 		pthread_attr_init(&(worker->attr));
 		pthread_cond_init(&(worker->get_to_work), NULL);
 		pthread_mutex_init(&(worker->lock), NULL);
@@ -310,23 +1248,44 @@ static int worker_create(unsigned int wanted)
 		pthread_attr_setdetachstate(&(worker->attr),
 		    PTHREAD_CREATE_DETACHED);
 
-		/* stopped */
-		worker_set_state(worker, PROC_WORKER_STATE_STOP);
+		worker_pin(worker);
+
+		/* stopped, unless the pool is already running */
+		worker_set_state(worker,
+		    (l_proc_worker_state == PROC_WORKER_STATE_RUN)
+		    ? PROC_WORKER_STATE_IDLE : PROC_WORKER_STATE_STOP);
+
+		/* in the table first, the worker may look for itself;
+		 * slots of retired workers are reused */
+		retval = ratt_table_insert(&l_worktab, &worker);
+		if (retval != OK) {
+			debug("ratt_table_insert() failed");
+			worker_discard(worker);
+			break;
+		}
 
 		retval = pthread_create(&(worker->id),
 		    &(worker->attr), worker_loop, worker);
 		if (retval) {
 			debug("pthread_create() failed");
-			ratt_table_destroy(&(worker->proctab));
+			ratt_table_del_current(&l_worktab);
+			worker_discard(worker);
 			break;
 		}
 
-		retval = ratt_table_push(&l_worktab, &worker);
-		if (retval != OK) {
-			debug("ratt_table_push() failed");
-			/* cancel worker */
-			pthread_cancel(worker->id);
-			break;
+		if (l_worker_numa == PROC_WORKER_NUMA_LOCAL) {
+			/* no process may come before the table exists;
+			 * that is a mere allocation away */
+			while (!(__atomic_load_n(&(worker->flags),
+			    __ATOMIC_SEQ_CST) & PROC_WORKER_FLREADY))
+				sched_yield();
+
+			if (!ratt_table_exists(&(worker->proctab[0]))) {
+				/* worker is gone, still at current pos */
+				ratt_table_del_current(&l_worktab);
+				worker_discard(worker);
+				break;
+			}
 		}
 	}
 
@@ -334,127 +1293,282 @@ static int worker_create(unsigned int wanted)
 	return (i == wanted) ? OK : FAIL;
 }
 
-static int compare_process(void const *in, void const *find)
+/* caller holds l_worktab_lock; workers missing for incoming processes */
+static inline unsigned int worker_shortage(size_t incoming)
 {
-	proc_register_t const *entry = in;
-	proc_register_t const *proc = find;
-	int retval;
+	size_t workers = ratt_table_count(&l_worktab), wanted;
 
-	if (proc->process != entry->process) {
-		/* not the same process */
-		return NOMATCH;
-	}
+	if (!l_conf_worker_grow || !incoming || workers >= l_conf_worker_max)
+		return 0;
 
-	if (proc->udata && (proc->udata != entry->udata)) {
-		/* process to find has user data,
-		 * entry might have but did not match */
-		return NOMATCH;
-	} else if (entry->udata) {
-		/* process to find has no user data, entry has */
-		return NOMATCH;
-	}
+	wanted = (__atomic_load_n(&l_proc_count, __ATOMIC_RELAXED)
+	    + incoming - 1) / l_conf_worker_grow + 1;
+	if (wanted > l_conf_worker_max)
+		wanted = l_conf_worker_max;
 
-	if (proc->attr) {
-		/* process to find has attributes */
-		if (entry->attr) {
-			retval = memcmp(proc->attr,
-			    entry->attr, sizeof(ratt_proc_attr_t));
-			if (retval != 0) {
-				/* attributes did not match */
-				return NOMATCH;
-			}
-		} else	/* entry has no attribute */
-			return NOMATCH;
-	} else if (entry->attr) {
-		/* process to find has no attribute, entry has */
-		return NOMATCH;
+	return (wanted > workers) ? wanted - workers : 0;
+}
+
+/*
+ * Caller holds l_worktab_lock; takes the processes not done yet out of
+ * the worker with one lock of its process table.
+ */
+static size_t
+worker_unregister(worker_register_t *worker,
+    ratt_proc_entry_t const *entry, size_t cnt, uint8_t *done)
+{
+	proc_register_t *found = NULL, proc = { 0 };
+	ratt_table_t *table = NULL;
+	size_t i, pos, removed = 0;
+
+	pthread_cleanup_push(&worker_cleanup_proctab_leave, worker);
+	proctab_enter(worker);
+
+	for (i = 0; i < cnt; ++i) {
+		if (done[i])
+			continue;
+
+		proc.process = entry[i].process;
+		proc.attr = entry[i].attr;
+		proc.udata = entry[i].udata;
+
+		table = &(worker->proctab[ratt_proc_rank(proc.attr)]);
+		pos = ratt_table_pos_current(table);
+
+		found = NULL;
+		ratt_table_search(table, (void **) &found,
+		    compare_process, &proc);
+		if (found) {
+			ratt_table_del_current(table);
+			done[i] = 1;
+			removed++;
+		}
+
+		ratt_proc_restore(table, pos);
 	}
+	__atomic_sub_fetch(&l_proc_count, removed, __ATOMIC_RELAXED);
 
-	return MATCH;
+	/* worker_cleanup_proctab_leave (worker) */
+	pthread_cleanup_pop(1);
+
+	return removed;
 }
 
-static void
-on_unregister(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
+/* caller holds l_worktab_lock */
+static void worker_unregister_all(ratt_proc_entry_t const *entry, size_t cnt)
 {
 	worker_register_t **worker = NULL;
-	proc_register_t *entry = NULL, proc = { process, attr, udata };
-	int retval;
-
-	pthread_cleanup_push(&worker_cleanup_mutex_unlock, &l_worktab_lock);
-	pthread_mutex_lock(&l_worktab_lock);
+	uint8_t *done = NULL, one = 0;
+	size_t left = cnt, i;
+
+	if (cnt > 1)
+		done = calloc(cnt, sizeof(uint8_t));
+
+	if (!done) {	/* one at a time */
+		for (i = 0; i < cnt; ++i) {
+			one = 0;
+			RATT_TABLE_FOREACH(&l_worktab, worker)
+			{
+				if (worker_unregister(*worker,
+				    entry + i, 1, &one))
+					break;
+			}
+		}
+		return;
+	}
 
 	RATT_TABLE_FOREACH(&l_worktab, worker)
 	{
-		pthread_cleanup_push(&worker_cleanup_mutex_unlock,
-		    &((*worker)->proctab_lock));
-		pthread_mutex_lock(&((*worker)->proctab_lock));
-		ratt_table_search(&((*worker)->proctab),
-		    (void **) &entry, compare_process, &proc);
-		if (entry) {
-			ratt_table_del_current(&((*worker)->proctab));
-		}
+		left -= worker_unregister(*worker, entry, cnt, done);
+		if (!left)
+			break;
+	}
 
-		/* worker_cleanup_mutex_unlock (proctab) */
-		pthread_cleanup_pop(1);
+	free(done);
+}
+
+/*
+ * Caller holds l_worktab_lock; hands processes to the worker through
+ * its inbox, or with one lock of its process table once the inbox is
+ * full.  Returns how many made it in.
+ */
+static size_t
+worker_register(worker_register_t *worker,
+    ratt_proc_entry_t const *entry, size_t cnt)
+{
+	proc_register_t proc = { 0 };
+	proc_worker_state_t state = PROC_WORKER_STATE_IDLE;
+	size_t i;
+	int idle = 0, hail = 0, locked = 0;
+
+	for (i = 0; i < cnt; ++i) {
+		proc.process = entry[i].process;
+		proc.attr = entry[i].attr;
+		proc.udata = entry[i].udata;
+		proc.hist = ratt_proc_hist(proc.process, proc.udata);
+
+		if (!locked && ratt_ring_push(&(worker->inbox), &proc) == OK)
+			continue;
 
-		if (retval == OK)
+		if (!locked) {
+			proctab_enter(worker);
+			locked = 1;
+		}
+		if (proctab_insert(worker, &proc) != OK) {
+			debug("ratt_table_insert() failed");
 			break;
+		}
 	}
+	if (locked)
+		proctab_leave(worker);
+	__atomic_add_fetch(&l_proc_count, i, __ATOMIC_RELAXED);
+
+	/* pushed before the worker may go idle, see worker_loop() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/* only the first of a burst finds the worker idle */
+	if (i)
+		idle = __atomic_compare_exchange_n(&(worker->state), &state,
+		    PROC_WORKER_STATE_RUN, 0,
+		    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+	/* a busy worker leaves some to an idle one; counts are a hint */
+	if (i && !idle && l_worker_sched == PROC_WORKER_SCHED_STEAL)
+		hail = (__atomic_load_n(&l_worker_idle, __ATOMIC_SEQ_CST)
+		    && proctab_count(worker) > 1);
+
+	debug("registered %u processes on worker (%p)", i, worker);
+
+	if (idle)
+		worker_wake(worker);
+	else if (hail)
+		worker_hail(worker);
+
+	return i;
+}
+
+/* caller holds l_worktab_lock; next worker in round-robin order */
+static worker_register_t **worker_next(void)
+{
+	worker_register_t **worker = NULL;
+
+	if (l_worker_rrpos > ratt_table_pos_last(&l_worktab))
+		worker = ratt_table_first_next(&l_worktab);
+	else {
+		worker = ratt_table_chunk(&l_worktab, l_worker_rrpos);
+		if (worker && ratt_table_pos_isfrag(&l_worktab, l_worker_rrpos))
+			worker = ratt_table_circular_next(&l_worktab);
+	}
+	l_worker_rrpos = ratt_table_pos_current(&l_worktab) + 1;
+
+	if (worker && !*worker) {
+		debug("worker is gone; should not happen");
+		return NULL;
+	}
+
+	return worker;
+}
+
+static void
+on_unregister_batch(ratt_proc_entry_t const *entry, size_t cnt)
+{
+	pthread_cleanup_push(&worker_cleanup_mutex_unlock, &l_worktab_lock);
+	pthread_mutex_lock(&l_worktab_lock);
+
+	worker_unregister_all(entry, cnt);
 
 	/* worker_cleanup_mutex_unlock (worktab) */
 	pthread_cleanup_pop(1);
 }
 
+/*
+ * The batch is spread evenly over the workers in one pass, starting
+ * where round-robin left; on failure whatever got in is taken out.
+ */
 static int
-on_register(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
+on_register_batch(ratt_proc_entry_t const *entry, size_t cnt)
 {
 	worker_register_t **worker = NULL;
-	proc_register_t proc = { process, attr, udata };
-	static size_t rrpos = 0;
-	int retval;
+	size_t done = 0, share, workers, in, i;
+	unsigned int shortage;
+	int retval = OK;
 
-	/* round-robin selection of workers */
+	/* the worktab lock is held until the processes are in, so a
+	 * worker cannot retire under our feet */
 	pthread_cleanup_push(&worker_cleanup_mutex_unlock, &l_worktab_lock);
 	pthread_mutex_lock(&l_worktab_lock);
-	if (rrpos > ratt_table_pos_last(&l_worktab)) {
-		worker = ratt_table_first(&l_worktab);
-		rrpos = 0;
-	} else
-		worker = ratt_table_chunk(&l_worktab, rrpos);
 
-	rrpos++;
-	/* worker_cleanup_mutex_unlock (worktab) */
-	pthread_cleanup_pop(1);
+	/* too many processes per worker, newcomers start on new ones */
+	shortage = worker_shortage(cnt);
+	if (shortage && worker_create(shortage) == OK && cnt == 1)
+		l_worker_rrpos = ratt_table_pos_current(&l_worktab);
+
+	workers = ratt_table_count(&l_worktab);
+	for (i = 0; i < workers && done < cnt; ++i) {
+		worker = worker_next();
+		if (!worker) {
+			debug("round-robin selection failed");
+			retval = FAIL;
+			break;
+		}
 
-	if (!worker) {
-		debug("round-robin selection failed");
-		return FAIL;
-	} else if (!*worker) {
-		debug("worker is gone; should not happen");
-		return FAIL;
+		/* what got in of a share is rolled back too */
+		share = (cnt - done + (workers - i) - 1) / (workers - i);
+		in = worker_register(*worker, entry + done, share);
+		done += in;
+		if (in != share) {
+			retval = FAIL;
+			break;
+		}
 	}
 
-	pthread_mutex_lock(&((*worker)->lock));
-	pthread_mutex_lock(&((*worker)->proctab_lock));
+	if (done < cnt)
+		retval = FAIL;
 
-	retval = ratt_table_insert(&((*worker)->proctab), &proc);
 	if (retval != OK) {
-		debug("ratt_table_insert() failed");
-		pthread_mutex_unlock(&((*worker)->proctab_lock));
-		pthread_mutex_unlock(&((*worker)->lock));
-		return FAIL;
+		debug("registered %u of %u processes, rolling back",
+		    done, cnt);
+		worker_unregister_all(entry, done);
 	}
 
-	if ((*worker)->state == PROC_WORKER_STATE_IDLE) {
-		worker_set_state(*worker, PROC_WORKER_STATE_RUN);
-		pthread_cond_signal(&((*worker)->get_to_work));
-	}
+	/* worker_cleanup_mutex_unlock (worktab) */
+	pthread_cleanup_pop(1);
+
+	return retval;
+}
+
+static void
+on_unregister(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
+{
+	ratt_proc_entry_t entry = { process, attr, udata };
+	on_unregister_batch(&entry, 1);
+}
+
+static int
+on_register(int (*process)(void *), ratt_proc_attr_t *attr, void *udata)
+{
+	ratt_proc_entry_t entry = { process, attr, udata };
+	return on_register_batch(&entry, 1);
+}
 
-	pthread_mutex_unlock(&((*worker)->proctab_lock));
-	pthread_mutex_unlock(&((*worker)->lock));
+static int on_stats(ratt_proc_stats_t *stats)
+{
+	worker_register_t **worker = NULL;
+	int rank;
 
-	debug("registered process %p, slot %i on worker (%p)",
-	    process, ratt_table_pos_last(&((*worker)->proctab)), *worker);
+	for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+		stats->runs[ratt_proc_rank_priority(rank)] = __atomic_load_n(
+		    &(l_runs_retired[rank]), __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&l_worktab_lock);
+	RATT_TABLE_FOREACH(&l_worktab, worker)
+	{
+		for (rank = 0; rank < RATTPROCPRCNT; ++rank)
+			stats->runs[ratt_proc_rank_priority(rank)] +=
+			    __atomic_load_n(&((*worker)->runs_rank[rank]),
+			    __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&l_worktab_lock);
 
 	return OK;
 }
@@ -469,13 +1583,13 @@ static int on_start(void)
 	} else
 		set_state(PROC_WORKER_STATE_RUN);
 
+	pthread_mutex_lock(&l_worktab_lock);
 	RATT_TABLE_FOREACH(&l_worktab, worker)
 	{
-		pthread_mutex_lock(&((*worker)->lock));
 		worker_set_state(*worker, PROC_WORKER_STATE_RUN);
-		pthread_cond_signal(&((*worker)->get_to_work));
-		pthread_mutex_unlock(&((*worker)->lock));
+		worker_wake(*worker);
 	}
+	pthread_mutex_unlock(&l_worktab_lock);
 
 	return OK;
 }
@@ -490,13 +1604,17 @@ static int on_stop(void)
 	} else
 		set_state(PROC_WORKER_STATE_STOP);
 
+	pthread_mutex_lock(&l_worktab_lock);
 	RATT_TABLE_FOREACH(&l_worktab, worker)
 	{
-		if (*worker)
+		if (*worker) {
 			pthread_cancel((*worker)->id);
+			worker_wake(*worker);	/* acts on cancel once up */
+		}
 
 		/* workers are removed from worktab later */
 	}
+	pthread_mutex_unlock(&l_worktab_lock);
 
 	return OK;
 }
@@ -519,22 +1637,29 @@ attach_module(
 		return FAIL;
 
 	/* start initial workers */
+	pthread_mutex_lock(&l_worktab_lock);
 	retval = worker_create(l_conf_worker_min);
+	pthread_mutex_unlock(&l_worktab_lock);
 	if (retval != OK) {
 		debug("worker_create() failed");
 		return FAIL;
 	}
 
-	switch (core->ver_minor) {
+	switch (core->ver_major) {
 	default:
+	case 1:
+		(*proc_hook).v1.on_unregister_batch = on_unregister_batch;
+		(*proc_hook).v1.on_register_batch = on_register_batch;
+		(*proc_hook).v1.on_stats = on_stats;
+		/* FALLTHROUGH */
 	case 0:
-		hookinfo->version = 0;
 		(*proc_hook).v0.on_start = on_start;
 		(*proc_hook).v0.on_stop = on_stop;
 		(*proc_hook).v0.on_register = on_register;
 		(*proc_hook).v0.on_unregister = on_unregister;
 		break;
 	}
+	hookinfo->version = (core->ver_major < 1) ? core->ver_major : 1;
 	return OK;
 }
 
@@ -551,7 +1676,7 @@ static int init_module(void)
 	int retval;
 	
 	retval = ratt_table_create(&l_worktab, PROC_WORKER_WORKTABSIZ,
-	    sizeof(worker_register_t *), RATTTABFLNRU);
+	    sizeof(worker_register_t *), 0);
 	if (retval != OK) {
 		debug("ratt_table_create() failed");
 		return FAIL;
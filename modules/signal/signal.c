@@ -77,6 +77,25 @@ static int compare_signal_number(void const *in, void const *find)
 	return (sig->num == *signum) ? MATCH : NOMATCH;
 }
 
+static void const *key_signal_number(void const *in)
+{
+	signal_register_t const *sig = in;
+	return &(sig->num);
+}
+
+static size_t hash_signal_number(void const *key)
+{
+	int const *signum = key;
+	return (size_t) *signum;
+}
+
+/* signal table is indexed by signal number */
+static ratt_table_hash_t const l_sigtab_hash = {
+	.key = key_signal_number,
+	.hash = hash_signal_number,
+	.compare = compare_signal_number,
+};
+
 static int compare_entry_handler(void const *in, void const *find)
 {
 	signal_entry_t const *entry = in;
@@ -89,18 +108,20 @@ static int constrains_on_entry(void const *in, void const *find)
 	return compare_entry_handler(in, entry->handler);
 }
 
+/* handlers may register or unregister, iterators keep our place */
 static void handle_signal(int signum, siginfo_t *siginfo, void *unused)
 {
 	int retval;
 	signal_register_t *sig = NULL;
 	signal_entry_t *entry = NULL;
+	ratt_table_iter_t it;
 
-	ratt_table_search(&l_sigtab, (void **) &sig,
+	sig = ratt_table_iter_search(&it, &l_sigtab,
 	    compare_signal_number, &signum);
 	if (!sig) {
 		debug("signal %i handled but not registered?", signum);
 	} else
-		RATT_TABLE_FOREACH_REVERSE(&(sig->entry), entry)
+		RATT_TABLE_ITER_FOREACH_REVERSE(&(sig->entry), &it, entry)
 		{
 			if (entry->handler)
 				entry->handler(signum,
@@ -121,11 +142,12 @@ static void unregister_signal_all()
 {
 	signal_register_t *sig = NULL;
 	signal_entry_t *entry = NULL;
+	ratt_table_iter_t sig_it, entry_it;
 
 	sigemptyset(&l_wait_sigmask);
-	RATT_TABLE_FOREACH(&l_sigtab, sig)
+	RATT_TABLE_ITER_FOREACH(&l_sigtab, &sig_it, sig)
 	{
-		RATT_TABLE_FOREACH(&(sig->entry), entry)
+		RATT_TABLE_ITER_FOREACH(&(sig->entry), &entry_it, entry)
 		{
 			debug("`%s' stack is not empty with %p still around",
 			    signum_to_string(sig->num), entry->handler);
@@ -173,7 +195,7 @@ static int register_signal(int signum)
 	}
 
 	retval = ratt_table_create(&(new_sig.entry),
-	    SIGNAL_ENTTABSIZ, sizeof(signal_entry_t), 0);
+	    SIGNAL_ENTTABSIZ, sizeof(signal_entry_t), RATTTABFLSEG);
 	if (retval != OK) {
 		debug("ratt_table_create() failed");
 		return FAIL;
@@ -285,10 +307,12 @@ int signal_init(void)
 	sigdelset(&blockmask, SIGSEGV);
 	sigprocmask(SIG_BLOCK, &blockmask, &unused);
 
-	retval = ratt_table_create(&l_sigtab,
-	    SIGNAL_SIGTABSIZ, sizeof(signal_register_t), 0);
+	/* segmented; handlers may register while handle_signal() holds
+	 * on to their signal and entry */
+	retval = ratt_table_create_hashed(&l_sigtab, SIGNAL_SIGTABSIZ,
+	    sizeof(signal_register_t), RATTTABFLSEG, &l_sigtab_hash);
 	if (retval != OK) {
-		debug("ratt_table_create() failed");
+		debug("ratt_table_create_hashed() failed");
 		return FAIL;
 	}
 	debug("allocated signal table of size `%u'",
@@ -40,7 +40,10 @@
 
 static char const *tests_ar_entry[] = {
 	/* category, test name, ..., \0 */
-	"table", "table_frag", "table_resize", '\0',
+	"table", "table_alloc", "table_frag", "table_hash", "table_hook",
+	    "table_mmap", "table_resize", "table_scan", "table_sort", '\0',
+	"ring", "ring_mpmc", '\0',
+	"proc", "proc_coro", "proc_parallel", "proc_scale", '\0',
 	'\0'	/* end of array */
 };
 
@@ -0,0 +1,225 @@
+/*
+ * RATTLE processor coroutine test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Coroutines spawned through ratt_proc_register() yield COROYLD times
+ * and then wait on a pipe of their own; once every one waits, the first
+ * is cancelled and every pipe written to.  All but the cancelled one
+ * must get through, each having come back from every yield.  Runs on
+ * the attached processor, which must be running on threads of its own.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/proc.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_proc_coro"
+#define MODULE_DESC	"processor coroutines"
+#define MODULE_VERSION	"0.1"
+
+#define CORONUM		64	/* coroutines */
+#define COROYLD		8	/* yields of each */
+#define COROWAIT	5000	/* milliseconds to get through */
+
+typedef struct {
+	int pipe[CORONUM][2];		/* pipe each coroutine waits on */
+	uint32_t yields[CORONUM];	/* times back from a yield */
+	int done[CORONUM];		/* read its pipe */
+	size_t waiting;			/* coroutines gone waiting */
+	size_t finished;		/* coroutines through */
+	int spawned;			/* all of them */
+} coro_data_t;
+
+static coro_data_t l_coro_data = { 0 };
+
+static ratt_proc_attr_t l_coro_attr = {
+	.flags = RATTPROCFLCOR,
+};
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_coro_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	coro_data_t *data = NULL;
+	size_t i;
+
+	if (ratt_test_get_retval(test) != OK)
+		return FAIL;
+
+	data = ratt_test_get_udata(test);
+	if (data->done[0] || data->finished != CORONUM - 1)
+		return FAIL;
+
+	for (i = 1; i < CORONUM; ++i)
+		if (!data->done[i] || data->yields[i] != COROYLD)
+			return FAIL;
+
+	return OK;
+}
+
+static int coro(void *udata)
+{
+	size_t i = (uintptr_t) udata;
+	unsigned int n;
+	char c;
+
+	for (n = 0; n < COROYLD; ++n) {
+		ratt_proc_yield();
+		l_coro_data.yields[i]++;
+	}
+
+	__atomic_add_fetch(&(l_coro_data.waiting), 1, __ATOMIC_RELEASE);
+	if (ratt_proc_wait_fd(l_coro_data.pipe[i][0], RATTPROCEVRD) != OK)
+		return FAIL;
+
+	if (read(l_coro_data.pipe[i][0], &c, 1) != 1)
+		return FAIL;
+
+	l_coro_data.done[i] = 1;
+	__atomic_add_fetch(&(l_coro_data.finished), 1, __ATOMIC_RELEASE);
+	return OK;
+}
+
+/* true once count reaches want, false after COROWAIT */
+static int coro_await(size_t *count, size_t want)
+{
+	unsigned int ms;
+
+	for (ms = 0; ms < COROWAIT; ++ms) {
+		if (__atomic_load_n(count, __ATOMIC_ACQUIRE) >= want)
+			return 1;
+		usleep(1000);
+	}
+
+	return 0;
+}
+
+static int on_run(void *udata)
+{
+	coro_data_t *data = udata;
+	int retval = FAIL;
+	size_t i, opened;
+
+	for (opened = 0; opened < CORONUM; ++opened) {
+		if (pipe(data->pipe[opened]) != 0) {
+			debug("pipe() failed");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < CORONUM; ++i) {
+		if (ratt_proc_register(coro, &l_coro_attr,
+		    (void *) (uintptr_t) i) != OK) {
+			debug("ratt_proc_register() failed");
+			break;
+		}
+	}
+	data->spawned = (i == CORONUM);
+
+	if (!coro_await(&(data->waiting), i)) {
+		debug("coroutines did not get to wait");
+		goto cancel;
+	}
+	ratt_proc_unregister(coro, &l_coro_attr, (void *) 0);
+
+	for (i = 0; i < CORONUM; ++i)
+		if (write(data->pipe[i][1], "c", 1) != 1)
+			debug("write() failed");
+
+	if (coro_await(&(data->finished), CORONUM - 1)) {
+		/* give the cancelled one a chance to show up */
+		usleep(10000);
+		retval = (data->spawned) ? OK : FAIL;
+	} else
+		debug("coroutines did not get through");
+
+cancel:
+	for (i = 0; i < CORONUM; ++i)
+		if (!data->done[i])
+			ratt_proc_unregister(coro, &l_coro_attr,
+			    (void *) (uintptr_t) i);
+out:
+	while (opened--) {
+		close(data->pipe[opened][0]);
+		close(data->pipe[opened][1]);
+	}
+
+	return retval;
+}
+
+static void on_summary(void const *udata)
+{
+	coro_data_t const *data = udata;
+
+	notice("`%u' of %u coroutines through, cancelled one %s",
+	    data->finished, CORONUM - 1,
+	    (data->done[0]) ? "went on" : "stayed out");
+}
+
+static ratt_test_hook_t test_proc_coro_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_proc_coro_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_proc_coro(void)
+{
+	ratt_module_register(&module_entry);
+}
@@ -0,0 +1,311 @@
+/*
+ * RATTLE parallel table pass test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Tables with fragments here and there, small enough for one range or
+ * split over many, go through ratt_table_parallel_for(), which must see
+ * every chunk once, and ratt_table_parallel_reduce(), whose partials
+ * must fold in position order.  PARPASS processes then reduce the large
+ * table at once from the workers.  Runs on the attached processor, which
+ * must be running on threads of its own.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/proc.h>
+#include <rattle/table.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_proc_parallel"
+#define MODULE_DESC	"parallel table passes"
+#define MODULE_VERSION	"0.1"
+
+#define PARSMALL	1000	/* chunks of the table taking one range */
+#define PARLARGE	300000	/* chunks of the table split in ranges */
+#define PARPASS		16	/* passes run at once from processes */
+#define PARWAIT		10000	/* milliseconds to get through */
+
+typedef struct {
+	uint64_t key;		/* position the chunk was pushed at */
+	uint64_t seen;		/* times parallel_for got to it */
+} parallel_chunk_t;
+
+typedef struct {
+	uint64_t sum;		/* sum of keys */
+	uint64_t count;		/* chunks folded */
+	uint64_t first;		/* lowest key folded */
+	uint64_t last;		/* highest key folded */
+	uint64_t disorder;	/* partials folded out of order */
+} parallel_sum_t;
+
+typedef struct {
+	ratt_table_t table;	/* large table, reduced by processes */
+	parallel_sum_t expect;	/* what reducing it gives */
+	size_t checked;		/* tables gone through for and reduce */
+	size_t passes;		/* passes from processes right */
+	size_t finished;	/* passes from processes through */
+	size_t bad;		/* results gone wrong */
+} parallel_data_t;
+
+static parallel_data_t l_parallel_data = { { 0 } };
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_parallel_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	parallel_data_t *data = NULL;
+
+	if (ratt_test_get_retval(test) != OK)
+		return FAIL;
+
+	data = ratt_test_get_udata(test);
+	if (data->checked != 4 || data->passes != PARPASS || data->bad)
+		return FAIL;
+
+	return OK;
+}
+
+/* runs of chunks and whole words go, the large table keeps a few */
+static int parallel_deleted(uint64_t key, int sparse)
+{
+	if (sparse)
+		return (key % 3 == 0 || (key / 64) % 7 == 3);
+	return (key % 1000 == 999);
+}
+
+static int parallel_each(void *chunk, void *udata)
+{
+	parallel_chunk_t *c = chunk;
+
+	c->seen++;
+	return OK;
+}
+
+static int parallel_map(void *chunk, void *partial, void *udata)
+{
+	parallel_chunk_t const *c = chunk;
+	parallel_sum_t *sum = partial;
+
+	if (!sum->count || c->key < sum->first)
+		sum->first = c->key;
+	if (!sum->count || c->key > sum->last)
+		sum->last = c->key;
+	sum->sum += c->key;
+	sum->count++;
+	return OK;
+}
+
+/* partials come in position order: each starts past the one before */
+static void parallel_combine(void *result, void const *partial,
+                             void *udata)
+{
+	parallel_sum_t *sum = result;
+	parallel_sum_t const *part = partial;
+
+	if (!part->count)
+		return;
+	if (sum->count && part->first <= sum->last)
+		sum->disorder++;
+	if (!sum->count)
+		sum->first = part->first;
+	sum->last = part->last;
+	sum->sum += part->sum;
+	sum->count += part->count;
+	sum->disorder += part->disorder;
+}
+
+static int parallel_fill(ratt_table_t *table, size_t cnt, int sparse,
+                         parallel_sum_t *expect)
+{
+	parallel_chunk_t chunk = { 0, 0 }, *found = NULL;
+	size_t i;
+
+	if (ratt_table_create(table, cnt, sizeof(parallel_chunk_t), 0)
+	    != OK) {
+		debug("ratt_table_create() failed");
+		return FAIL;
+	}
+
+	for (i = 0; i < cnt; ++i) {
+		chunk.key = i;
+		if (ratt_table_push(table, &chunk) != OK) {
+			debug("ratt_table_push() failed");
+			ratt_table_destroy(table);
+			return FAIL;
+		}
+	}
+
+	memset(expect, 0, sizeof(parallel_sum_t));
+	RATT_TABLE_FOREACH(table, found) {
+		if (parallel_deleted(found->key, sparse))
+			ratt_table_del_current(table);
+		else
+			parallel_map(found, expect, NULL);
+	}
+
+	return OK;
+}
+
+static int parallel_same(parallel_sum_t const *a, parallel_sum_t const *b)
+{
+	return (a->sum == b->sum && a->count == b->count
+	    && a->first == b->first && a->last == b->last
+	    && !a->disorder && !b->disorder);
+}
+
+static void parallel_check(parallel_data_t *data, size_t cnt, int sparse)
+{
+	ratt_table_t table = { 0 };
+	parallel_sum_t expect, sum;
+	parallel_chunk_t *found = NULL;
+
+	if (parallel_fill(&table, cnt, sparse, &expect) != OK) {
+		data->bad++;
+		return;
+	}
+
+	if (ratt_table_parallel_for(&table, parallel_each, NULL) != OK)
+		data->bad++;
+	RATT_TABLE_FOREACH(&table, found) {
+		if (found->seen != 1)
+			data->bad++;
+	}
+
+	memset(&sum, 0, sizeof(parallel_sum_t));
+	if (ratt_table_parallel_reduce(&table, parallel_map,
+	    parallel_combine, &sum, sizeof(parallel_sum_t), NULL) != OK
+	    || !parallel_same(&sum, &expect))
+		data->bad++;
+
+	data->checked++;
+	ratt_table_destroy(&table);
+}
+
+/* a pass run from a process, alongside the others */
+static int parallel_task(void *udata)
+{
+	parallel_data_t *data = udata;
+	parallel_sum_t sum;
+
+	memset(&sum, 0, sizeof(parallel_sum_t));
+	if (ratt_table_parallel_reduce(&(data->table), parallel_map,
+	    parallel_combine, &sum, sizeof(parallel_sum_t), NULL) == OK
+	    && parallel_same(&sum, &(data->expect)))
+		__atomic_add_fetch(&(data->passes), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(data->finished), 1, __ATOMIC_RELEASE);
+	return OK;
+}
+
+static int on_run(void *udata)
+{
+	parallel_data_t *data = udata;
+	unsigned int ms;
+	size_t i;
+
+	parallel_check(data, PARSMALL, 0);
+	parallel_check(data, PARSMALL, 1);
+	parallel_check(data, PARLARGE, 0);
+	parallel_check(data, PARLARGE, 1);
+
+	if (parallel_fill(&(data->table), PARLARGE, 1,
+	    &(data->expect)) != OK)
+		return FAIL;
+
+	for (i = 0; i < PARPASS; ++i)
+		if (ratt_proc_register(parallel_task, NULL, data) != OK) {
+			debug("ratt_proc_register() failed");
+			break;
+		}
+
+	/* the table goes only once every pass is through */
+	for (ms = 0; ms < PARWAIT; ++ms) {
+		if (__atomic_load_n(&(data->finished), __ATOMIC_ACQUIRE)
+		    >= i)
+			break;
+		usleep(1000);
+	}
+	if (ms == PARWAIT) {
+		debug("passes from processes did not get through");
+		return FAIL;
+	}
+
+	ratt_table_destroy(&(data->table));
+	return OK;
+}
+
+static void on_summary(void const *udata)
+{
+	parallel_data_t const *data = udata;
+
+	notice("`%u' tables checked, `%u' results wrong; "
+	    "`%u' of %u passes from processes right",
+	    data->checked, data->bad, data->passes, PARPASS);
+}
+
+static ratt_test_hook_t test_proc_parallel_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_proc_parallel_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_proc_parallel(void)
+{
+	ratt_module_register(&module_entry);
+}
@@ -0,0 +1,245 @@
+/*
+ * RATTLE processor scaling test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Register/run throughput of the attached processor under 1 to SCALETHR
+ * chains at once.  A chain is a one-shot process registering itself
+ * again from each run until it ran SCALERUN times, so there is as much
+ * work queued as there are chains and every run goes through
+ * ratt_proc_register(); with proc_worker that many workers get busy.
+ * Runs are counted from ratt_proc_stats() before and after each pass.
+ * The processor must be running on threads of its own.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/proc.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_proc_scale"
+#define MODULE_DESC	"processor scaling"
+#define MODULE_VERSION	"0.1"
+
+#define SCALETHR	8	/* most chains */
+#define SCALERUN	100000	/* runs per chain */
+#define SCALEWAIT	30	/* seconds a pass may take */
+
+typedef struct {
+	uint64_t left;			/* runs to go */
+} scale_chain_t;
+
+typedef struct {
+	unsigned int threads;		/* chains measured up to */
+	double rate[SCALETHR];		/* runs per second, by chains */
+	scale_chain_t chain[SCALETHR];	/* chains of the pass */
+	unsigned int done;		/* chains through */
+	int failed;			/* a pass went wrong */
+} scale_data_t;
+
+static scale_data_t l_scale_data = { 0 };
+
+static ratt_proc_attr_t l_scale_attr = { 0 };
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_scale_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	scale_data_t *data = NULL;
+	unsigned int i;
+
+	if (ratt_test_get_retval(test) != OK)
+		return FAIL;
+
+	data = ratt_test_get_udata(test);
+	if (data->failed || !data->threads)
+		return FAIL;
+
+	/* every pass got through; the curve is for the eye */
+	for (i = 0; i < data->threads; ++i)
+		if (data->rate[i] <= 0)
+			return FAIL;
+
+	return OK;
+}
+
+static inline double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* runs so far, all classes */
+static uint64_t scale_runs(void)
+{
+	ratt_proc_stats_t stats;
+	uint64_t runs = 0;
+	unsigned int i;
+
+	if (ratt_proc_stats(&stats) != OK)
+		return 0;
+	for (i = 0; i < RATTPROCPRCNT; ++i)
+		runs += stats.runs[i];
+	return runs;
+}
+
+static int scale_run(void *udata)
+{
+	scale_chain_t *chain = udata;
+
+	if (--chain->left
+	    && ratt_proc_register(scale_run, &l_scale_attr, chain) == OK)
+		return OK;
+
+	if (chain->left)
+		l_scale_data.failed = 1;
+	__atomic_add_fetch(&(l_scale_data.done), 1, __ATOMIC_RELEASE);
+	return OK;
+}
+
+/* runs per second of so many chains, negative on failure */
+static double scale_pass(scale_data_t *data, unsigned int chains)
+{
+	unsigned int i, started;
+	uint64_t runs;
+	double start, elapsed;
+
+	data->done = 0;
+	for (i = 0; i < chains; ++i)
+		data->chain[i].left = SCALERUN;
+
+	runs = scale_runs();
+	start = now();
+	for (started = 0; started < chains; ++started) {
+		if (ratt_proc_register(scale_run, &l_scale_attr,
+		    &(data->chain[started])) != OK) {
+			debug("ratt_proc_register() failed");
+			break;
+		}
+	}
+
+	/* chains not started count as through */
+	__atomic_add_fetch(&(data->done), chains - started, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&(data->done), __ATOMIC_ACQUIRE) < chains) {
+		if (now() - start > SCALEWAIT) {
+			debug("%u chains did not get through", chains);
+			return -1;
+		}
+		usleep(1000);
+	}
+	elapsed = now() - start;
+
+	if (started < chains || data->failed)
+		return -1;
+
+	runs = scale_runs() - runs;
+	if (runs < (uint64_t) chains * SCALERUN) {
+		debug("processor counted %u runs of %u", runs,
+		    chains * SCALERUN);
+		return -1;
+	}
+
+	return (uint64_t) chains * SCALERUN / elapsed;
+}
+
+static int on_run(void *udata)
+{
+	scale_data_t *data = udata;
+	unsigned int chains;
+	long cpus;
+
+	/* no point in more chains than CPUs */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	data->threads = (cpus > 0 && cpus < SCALETHR) ? cpus : SCALETHR;
+
+	for (chains = 1; chains <= data->threads; ++chains) {
+		data->rate[chains - 1] = scale_pass(data, chains);
+		if (data->rate[chains - 1] < 0) {
+			/* chains left behind still run on this data */
+			data->failed = 1;
+			break;
+		}
+	}
+
+	return (data->failed) ? FAIL : OK;
+}
+
+static void on_summary(void const *udata)
+{
+	scale_data_t const *data = udata;
+	unsigned int i;
+
+	notice("chains        runs/s  scaling");
+	for (i = 0; i < data->threads; ++i)
+		notice("%6u  %12.0f  %7.2f", i + 1, data->rate[i],
+		    (data->rate[0] > 0) ? data->rate[i] / data->rate[0] : 0);
+}
+
+static ratt_test_hook_t test_proc_scale_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_proc_scale_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_proc_scale(void)
+{
+	ratt_module_register(&module_entry);
+}
@@ -0,0 +1,182 @@
+/*
+ * RATTLE ring multi-producer multi-consumer test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/ring.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_ring_mpmc"
+#define MODULE_DESC	"ring multi-producer multi-consumer"
+#define MODULE_VERSION	"0.1"
+
+#define RINGSIZ		1024	/* ring size */
+#define RINGTHR		4	/* producers, as many consumers */
+#define RINGPSH		250000	/* pushes per producer */
+
+typedef struct {
+	size_t push;		/* number of pushes */
+	size_t pop;		/* number of pops */
+	uint64_t sum;		/* sum of values popped */
+} ring_data_t;
+
+static ring_data_t l_ring_data = { 0 };
+
+static RATT_RING_INIT(l_ring);
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_ring_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	ring_data_t *data = NULL;
+	uint64_t sum = RINGTHR * (((uint64_t) RINGPSH * (RINGPSH + 1)) / 2);
+	int retval;
+
+	retval = ratt_test_get_retval(test);
+	if (retval == OK) {
+		data = ratt_test_get_udata(test);
+		if (data->pop == RINGTHR * RINGPSH && data->sum == sum) {
+			/* every value pushed got popped exactly once */
+			return OK;
+		}
+	}
+
+	return FAIL;
+}
+
+static void *producer(void *udata)
+{
+	ring_data_t *data = udata;
+	uint64_t value;
+
+	for (value = 1; value <= RINGPSH; ++value) {
+		while (ratt_ring_push(&l_ring, &value) != OK)
+			sched_yield();
+		__atomic_add_fetch(&(data->push), 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *udata)
+{
+	ring_data_t *data = udata;
+	uint64_t value, sum = 0;
+
+	while (__atomic_load_n(&(data->pop), __ATOMIC_RELAXED)
+	    < RINGTHR * RINGPSH) {
+		if (ratt_ring_pop(&l_ring, &value) != OK) {
+			sched_yield();
+			continue;
+		}
+		sum += value;
+		__atomic_add_fetch(&(data->pop), 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_add_fetch(&(data->sum), sum, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static int on_run(void *udata)
+{
+	pthread_t thread[2 * RINGTHR];
+	unsigned int i, started = 0;
+	int retval;
+
+	retval = ratt_ring_create(&l_ring, RINGSIZ, sizeof(uint64_t), 0);
+	if (retval != OK) {
+		debug("ratt_ring_create() failed");
+		return FAIL;
+	}
+
+	for (i = 0; i < 2 * RINGTHR; ++i, ++started) {
+		retval = pthread_create(&(thread[i]), NULL,
+		    (i & 1) ? producer : consumer, udata);
+		if (retval) {
+			debug("pthread_create() failed");
+			break;
+		}
+	}
+
+	for (i = 0; i < started; ++i)
+		pthread_join(thread[i], NULL);
+
+	ratt_ring_destroy(&l_ring);
+
+	return (started == 2 * RINGTHR) ? OK : FAIL;
+}
+
+static void on_summary(void const *udata)
+{
+	ring_data_t const *data = udata;
+
+	notice("`%u' pushes; `%u' pops with %u producers and consumers",
+	    data->push, data->pop, RINGTHR);
+}
+
+static ratt_test_hook_t test_ring_mpmc_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_ring_mpmc_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_ring_mpmc(void)
+{
+	ratt_module_register(&module_entry);
+}
@@ -0,0 +1,179 @@
+/*
+ * RATTLE table allocator test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+
+#include <rattle/alloc.h>
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/table.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_table_alloc"
+#define MODULE_DESC	"table allocators"
+#define MODULE_VERSION	"0.1"
+
+#define TABLESIZ	4	/* table initial size */
+#define TABLEINS	1000	/* insertions per scratch table */
+#define TABLEROUNDS	100	/* scratch tables per allocator */
+
+typedef struct {
+	size_t value;		/* chunk value */
+} table_chunk_t;
+
+typedef struct {
+	size_t good[3];	/* tables read back: libc, arena, slab */
+} table_data_t;
+
+static table_data_t l_table_data = { { 0 } };
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_table_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	table_data_t *data = NULL;
+	int retval;
+
+	retval = ratt_test_get_retval(test);
+	if (retval == OK) {
+		data = ratt_test_get_udata(test);
+		if (data->good[0] == TABLEROUNDS
+		    && data->good[1] == TABLEROUNDS
+		    && data->good[2] == TABLEROUNDS)
+			return OK;
+	}
+
+	/*
+	 * every scratch table should have grown and read back the same
+	 * whether it lives on the C library, an arena or a slab.
+	 */
+
+	return FAIL;
+}
+
+static int scratch_table(ratt_alloc_t const *alloc)
+{
+	ratt_table_t mytable;
+	table_chunk_t chunk = { 0 }, *found = NULL;
+	size_t i = 0;
+	int retval;
+
+	retval = ratt_table_create_alloc(&mytable, TABLESIZ,
+	    sizeof(table_chunk_t), 0, alloc);
+	if (retval != OK) {
+		debug("ratt_table_create_alloc() failed");
+		return FAIL;
+	}
+
+	for (chunk.value = 0; chunk.value < TABLEINS; ++chunk.value) {
+		if (ratt_table_push(&mytable, &chunk) != OK)
+			break;
+	}
+
+	RATT_TABLE_FOREACH(&mytable, found) {
+		if (found->value != i++)
+			break;
+	}
+
+	ratt_table_destroy(&mytable);
+
+	return (i == TABLEINS) ? OK : FAIL;
+}
+
+static int on_run(void *udata)
+{
+	table_data_t *data = udata;
+	ratt_arena_t arena;
+	ratt_slab_t slab;
+	size_t i;
+
+	ratt_arena_create(&arena, 0);
+	ratt_slab_create(&slab);
+
+	for (i = 0; i < TABLEROUNDS; ++i) {
+		if (scratch_table(NULL) == OK)
+			data->good[0]++;
+		if (scratch_table(ratt_arena_alloc(&arena)) == OK)
+			data->good[1]++;
+		ratt_arena_reset(&arena);	/* drop it in one shot */
+		if (scratch_table(ratt_slab_alloc(&slab)) == OK)
+			data->good[2]++;
+	}
+
+	ratt_slab_destroy(&slab);
+	ratt_arena_destroy(&arena);
+
+	return OK;
+}
+
+static void on_summary(void const *udata)
+{
+	table_data_t const *data = udata;
+
+	notice("`%u' libc; `%u' arena; `%u' slab scratch tables read back",
+	    data->good[0], data->good[1], data->good[2]);
+}
+
+static ratt_test_hook_t test_table_alloc_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_table_alloc_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_table_alloc(void)
+{
+	ratt_module_register(&module_entry);
+}
@@ -0,0 +1,194 @@
+/*
+ * RATTLE table hash index test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/table.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_table_hash"
+#define MODULE_DESC	"table hash index"
+#define MODULE_VERSION	"0.1"
+
+#define TABLESIZ	4	/* table initial size */
+#define TABLEINS	100000	/* expected insertions count */
+#define KEYSIZ		16	/* key size */
+
+typedef struct {
+	char name[KEYSIZ];	/* chunk key */
+	size_t value;		/* chunk value */
+} table_chunk_t;
+
+typedef struct {
+	size_t insert;		/* number of insertions */
+	size_t reject;		/* number of duplicates rejected */
+	size_t found;		/* number of successful searches */
+} table_data_t;
+
+static table_data_t l_table_data = { 0 };
+
+static int compare_chunk_name(void const *in, void const *find)
+{
+	table_chunk_t const *chunk = in;
+	return (strcmp(chunk->name, find)) ? NOMATCH : MATCH;
+}
+
+static int constrains_on_chunk(void const *in, void const *find)
+{
+	table_chunk_t const *chunk = find;
+	return compare_chunk_name(in, chunk->name);
+}
+
+static void const *key_chunk_name(void const *in)
+{
+	table_chunk_t const *chunk = in;
+	return chunk->name;
+}
+
+static ratt_table_hash_t const l_table_hash = {
+	.key = key_chunk_name,
+	.hash = ratt_table_hash_string,
+	.compare = compare_chunk_name,
+};
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_table_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	table_data_t *data = NULL;
+	int retval;
+
+	retval = ratt_test_get_retval(test);
+	if (retval == OK) {
+		data = ratt_test_get_udata(test);
+		if (data->insert == TABLEINS
+		    && data->reject == TABLEINS
+		    && data->found == TABLEINS) {
+			/* every key inserted once and found back */
+			return OK;
+		}
+	}
+
+	/*
+	 * every key should have been inserted, rejected on its second
+	 * insertion by the constrains and found by the index.
+	 */
+
+	return FAIL;
+}
+
+static int on_run(void *udata)
+{
+	ratt_table_t mytable;
+	table_chunk_t chunk = { { '\0' } }, *found = NULL;
+	table_data_t *data = udata;
+	size_t i;
+	int retval;
+
+	retval = ratt_table_create_hashed(&mytable, TABLESIZ,
+	    sizeof(table_chunk_t), 0, &l_table_hash);
+	if (retval != OK) {
+		debug("ratt_table_create_hashed() failed");
+		return FAIL;
+	}
+	ratt_table_set_constrains(&mytable, constrains_on_chunk);
+
+	for (i = 0; i < TABLEINS; ++i) {
+		snprintf(chunk.name, KEYSIZ, "chunk%u", i);
+		chunk.value = i;
+		if (ratt_table_insert(&mytable, &chunk) == OK)
+			data->insert++;
+	}
+
+	for (i = 0; i < TABLEINS; ++i) {
+		snprintf(chunk.name, KEYSIZ, "chunk%u", i);
+		if (ratt_table_insert(&mytable, &chunk) != OK)
+			data->reject++;
+	}
+
+	for (i = 0; i < TABLEINS; ++i) {
+		snprintf(chunk.name, KEYSIZ, "chunk%u", i);
+		retval = ratt_table_search(&mytable, (void **) &found,
+		    compare_chunk_name, chunk.name);
+		if (retval == OK && found->value == i)
+			data->found++;
+	}
+
+	ratt_table_destroy(&mytable);
+
+	return OK;
+}
+
+static void on_summary(void const *udata)
+{
+	table_data_t const *data = udata;
+
+	notice("`%u' insertions; `%u' duplicates rejected; `%u' found",
+	    data->insert, data->reject, data->found);
+}
+
+static ratt_test_hook_t test_table_hash_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_table_hash_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_table_hash(void)
+{
+	ratt_module_register(&module_entry);
+}
@@ -0,0 +1,251 @@
+/*
+ * RATTLE core hook allocator test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+
+#include <rattle/alloc.h>
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/table.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_table_hook"
+#define MODULE_DESC	"core hooks on an arena"
+#define MODULE_VERSION	"0.1"
+
+#define HOOKCORE	RATT_TEST "_hookcore"	/* scratch core name */
+#define HOOKMODS	3	/* modules hooked per round */
+#define HOOKROUNDS	2	/* core attached then detached again */
+
+typedef struct {
+	size_t value;		/* written by the module */
+} hook_t;
+
+typedef struct {
+	ratt_arena_t arena;	/* memory counted below comes from here */
+	ratt_alloc_t alloc;	/* counting interface, context is this */
+	size_t allocs, frees;	/* calls through the interface */
+} hook_alloc_t;
+
+typedef struct {
+	size_t hooked[HOOKROUNDS];	/* hooks found good per round */
+	size_t allocs[HOOKROUNDS];	/* arena allocations per round */
+	size_t left[HOOKROUNDS];	/* not handed back on detach */
+} table_data_t;
+
+static table_data_t l_table_data = { { 0 } };
+
+RATT_TABLE_INIT(l_hooktab);
+static ratt_module_core_t l_core_info = {
+	.name = HOOKCORE,
+	.ver_major = 0,
+	.ver_minor = 1,
+	.hook_table = &l_hooktab,
+	.hook_size = sizeof(hook_t),
+};
+
+static void *hook_alloc(void *ctx, size_t size)
+{
+	hook_alloc_t *counter = ctx;
+
+	counter->allocs++;
+	return ratt_mem_alloc(ratt_arena_alloc(&(counter->arena)), size);
+}
+
+static void *hook_realloc(void *ctx, void *ptr, size_t old, size_t size)
+{
+	hook_alloc_t *counter = ctx;
+
+	return ratt_mem_realloc(ratt_arena_alloc(&(counter->arena)),
+	    ptr, old, size);
+}
+
+static void hook_free(void *ctx, void *ptr, size_t size)
+{
+	hook_alloc_t *counter = ctx;
+
+	counter->frees++;
+	ratt_mem_free(ratt_arena_alloc(&(counter->arena)), ptr, size);
+}
+
+static int attach_hookmod(ratt_module_core_t const *core,
+                          ratt_module_hook_t *hookinfo)
+{
+	hook_t *hook = hookinfo->hook;
+
+	hook->value = (size_t) hookinfo;	/* any non zero value */
+	hookinfo->version = core->ver_major;
+	return OK;
+}
+
+static ratt_module_entry_t l_hookmods[HOOKMODS] = {
+	{ .name = HOOKCORE "_one", .attach = attach_hookmod,
+	    .hook_size = sizeof(hook_t) },
+	{ .name = HOOKCORE "_two", .attach = attach_hookmod,
+	    .hook_size = sizeof(hook_t) },
+	{ .name = HOOKCORE "_three", .attach = attach_hookmod,
+	    .hook_size = sizeof(hook_t) },
+};
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_table_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	table_data_t *data = NULL;
+	size_t i;
+	int retval;
+
+	retval = ratt_test_get_retval(test);
+	if (retval != OK)
+		return FAIL;
+
+	/*
+	 * every round should have hooked all modules, taken the table and
+	 * each hook from the arena and handed all of them back on detach.
+	 */
+
+	data = ratt_test_get_udata(test);
+	for (i = 0; i < HOOKROUNDS; ++i) {
+		if (data->hooked[i] != HOOKMODS
+		    || data->allocs[i] < HOOKMODS + 1
+		    || data->left[i])
+			return FAIL;
+	}
+	return OK;
+}
+
+static size_t hook_round(void)
+{
+	ratt_module_hook_t *hookinfo = NULL;
+	size_t i, hooked = 0;
+
+	if (module_core_attach(&l_core_info) != OK) {
+		debug("module_core_attach() failed");
+		return 0;
+	}
+
+	for (i = 0; i < HOOKMODS; ++i)
+		ratt_module_attach(&l_core_info, l_hookmods[i].name);
+
+	RATT_TABLE_FOREACH(&l_hooktab, hookinfo) {
+		if (hookinfo->module && hookinfo->hook
+		    && ((hook_t *) hookinfo->hook)->value)
+			hooked++;
+	}
+
+	module_core_detach(HOOKCORE);
+	return hooked;
+}
+
+static int on_run(void *udata)
+{
+	table_data_t *data = udata;
+	hook_alloc_t counter = { .alloc = { 0 } };
+	size_t i;
+	int retval = OK;
+
+	if (ratt_arena_create(&(counter.arena), 0) != OK) {
+		debug("ratt_arena_create() failed");
+		return FAIL;
+	}
+	counter.alloc.alloc = hook_alloc;
+	counter.alloc.realloc = hook_realloc;
+	counter.alloc.free = hook_free;
+	counter.alloc.ctx = &counter;
+
+	for (i = 0; i < HOOKMODS; ++i) {
+		if (ratt_module_register(&l_hookmods[i],
+		    RATT_MODULE_VERSION) != OK) {
+			debug("ratt_module_register() failed");
+			retval = FAIL;
+		}
+	}
+
+	ratt_table_set_allocator(&l_hooktab, &(counter.alloc));
+	for (i = 0; retval == OK && i < HOOKROUNDS; ++i) {
+		counter.allocs = counter.frees = 0;
+		data->hooked[i] = hook_round();
+		data->allocs[i] = counter.allocs;
+		data->left[i] = counter.allocs - counter.frees;
+	}
+	ratt_table_set_allocator(&l_hooktab, NULL);
+
+	for (i = 0; i < HOOKMODS; ++i)
+		ratt_module_unregister(&l_hookmods[i]);
+
+	ratt_arena_destroy(&(counter.arena));	/* drop it in one shot */
+
+	return retval;
+}
+
+static void on_summary(void const *udata)
+{
+	table_data_t const *data = udata;
+
+	notice("`%u' then `%u' hooks attached through an arena",
+	    data->hooked[0], data->hooked[1]);
+}
+
+static ratt_test_hook_t test_table_hook_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_table_hook_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_table_hook(void)
+{
+	ratt_module_register(&module_entry);
+}
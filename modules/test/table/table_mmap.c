@@ -0,0 +1,307 @@
+/*
+ * RATTLE mapped table test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/table.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_table_mmap"
+#define MODULE_DESC	"mapped table"
+#define MODULE_VERSION	"0.1"
+
+#define MMAPSIZ		4	/* table initial size */
+#define MMAPINS		1000	/* chunks pushed by each writer */
+#define MMAPTAIL	10	/* chunks deleted off the tail */
+
+typedef struct {
+	size_t key;		/* chunk key */
+	size_t seq;		/* key again, to spot torn chunks */
+} table_chunk_t;
+
+typedef struct {
+	size_t synced;		/* chunks read back after a sync */
+	size_t repaired;	/* chunks read back after a repair */
+	size_t peeked;		/* chunks read by a reader repairing */
+	size_t refused;		/* opens and resizes refused as they should */
+} table_data_t;
+
+static table_data_t l_table_data = { 0, 0, 0, 0 };
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_table_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+/* keys the first writer keeps, and those the second one keeps */
+static int mmap_kept(size_t key, int writers)
+{
+	if (key < MMAPINS)
+		return (key % 3 != 0);
+	return (writers > 1 && key < 2 * MMAPINS - MMAPTAIL
+	    && key % 5 != 0);
+}
+
+static size_t mmap_expect(int writers)
+{
+	size_t key, cnt = 0;
+
+	for (key = 0; key < 2 * MMAPINS; ++key)
+		if (mmap_kept(key, writers))
+			cnt++;
+	return cnt;
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	table_data_t *data = NULL;
+	int retval;
+
+	retval = ratt_test_get_retval(test);
+	if (retval == OK) {
+		data = ratt_test_get_udata(test);
+		if (data->synced == mmap_expect(1)
+		    && data->repaired == mmap_expect(2)
+		    && data->peeked == mmap_expect(2)
+		    && data->refused == 4)
+			return OK;
+	}
+
+	/*
+	 * a synced table should come back whole; one left dirty by a
+	 * writer that never synced should be refused to writers and
+	 * readers alike, then repaired with every chunk it held; a hash
+	 * index should be refused, as should a resize while a reader
+	 * holds the file.
+	 */
+
+	return FAIL;
+}
+
+/* writer pushes its keys then deletes those it does not keep */
+static int mmap_write(ratt_table_t *table, int writer)
+{
+	table_chunk_t chunk = { 0, 0 }, *found = NULL;
+	size_t i;
+
+	for (i = 0; i < MMAPINS; ++i) {
+		chunk.key = chunk.seq = (writer - 1) * MMAPINS + i;
+		if (ratt_table_push(table, &chunk) != OK) {
+			debug("ratt_table_push() failed");
+			return FAIL;
+		}
+	}
+
+	RATT_TABLE_FOREACH(table, found) {
+		if (!mmap_kept(found->key, writer))
+			ratt_table_del_current(table);
+	}
+
+	return OK;
+}
+
+/* chunks read back, or 0 if one is torn or should not be there */
+static size_t mmap_read(ratt_table_t *table, int writers)
+{
+	table_chunk_t *found = NULL;
+	size_t cnt = 0;
+
+	RATT_TABLE_FOREACH(table, found) {
+		if (found->key != found->seq
+		    || !mmap_kept(found->key, writers))
+			return 0;
+		cnt++;
+	}
+
+	if (cnt != ratt_table_count(table) || (cnt
+	    && ratt_table_pos_last(table) + 1
+	    != cnt + ratt_table_frag_count(table)))
+		return 0;
+	return cnt;
+}
+
+static int on_run(void *udata)
+{
+	table_data_t *data = udata;
+	char path[] = "/tmp/ratt_table_mmapXXXXXX";
+	ratt_table_t mytable = { 0 }, reader = { 0 };
+	pid_t pid;
+	int fd, status, retval = FAIL;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		debug("mkstemp() failed");
+		return FAIL;
+	}
+	close(fd);
+
+	if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+	    sizeof(table_chunk_t), 0) != OK) {
+		debug("ratt_table_create_mmap() failed");
+		goto unlink_file;
+	}
+	retval = mmap_write(&mytable, 1);
+	ratt_table_destroy(&mytable);	/* syncs */
+	if (retval != OK)
+		goto unlink_file;
+
+	retval = FAIL;
+	if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+	    sizeof(table_chunk_t), RATTTABFLHSH) != OK)
+		data->refused++;
+	else
+		ratt_table_destroy(&mytable);
+
+	if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+	    sizeof(table_chunk_t), RATTTABFLRDO) != OK) {
+		debug("ratt_table_create_mmap() failed");
+		goto unlink_file;
+	}
+	data->synced = mmap_read(&mytable, 1);
+	ratt_table_destroy(&mytable);
+
+	/* second writer leaves without syncing, as if it crashed */
+	pid = fork();
+	if (pid < 0) {
+		debug("fork() failed");
+		goto unlink_file;
+	} else if (!pid) {
+		if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+		    sizeof(table_chunk_t), 0) != OK
+		    || mmap_write(&mytable, 2) != OK)
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+	    || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		debug("second writer failed");
+		goto unlink_file;
+	}
+
+	if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+	    sizeof(table_chunk_t), 0) != OK)
+		data->refused++;
+	else
+		ratt_table_destroy(&mytable);
+	if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+	    sizeof(table_chunk_t), RATTTABFLRDO) != OK)
+		data->refused++;
+	else
+		ratt_table_destroy(&mytable);
+
+	/* a reader repairs its own counters and holds the file */
+	if (ratt_table_create_mmap(&reader, path, MMAPSIZ,
+	    sizeof(table_chunk_t), RATTTABFLRDO | RATTTABFLRPR) != OK) {
+		debug("ratt_table_create_mmap() failed");
+		goto unlink_file;
+	}
+	data->peeked = mmap_read(&reader, 2);
+
+	if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+	    sizeof(table_chunk_t), RATTTABFLRPR) != OK) {
+		debug("ratt_table_create_mmap() failed");
+		ratt_table_destroy(&reader);
+		goto unlink_file;
+	}
+
+	/* compaction cannot shrink the file under the reader */
+	if (ratt_table_compact(&mytable) != OK)
+		data->refused++;
+	ratt_table_destroy(&reader);
+	if (ratt_table_compact(&mytable) != OK) {
+		debug("ratt_table_compact() failed");
+		ratt_table_destroy(&mytable);
+		goto unlink_file;
+	}
+	ratt_table_destroy(&mytable);
+
+	/* synced by the repair, it opens for reading like any other */
+	if (ratt_table_create_mmap(&mytable, path, MMAPSIZ,
+	    sizeof(table_chunk_t), 0) != OK) {
+		debug("ratt_table_create_mmap() failed");
+		goto unlink_file;
+	}
+	data->repaired = mmap_read(&mytable, 2);
+	ratt_table_destroy(&mytable);
+	retval = OK;
+
+unlink_file:
+	unlink(path);
+	return retval;
+}
+
+static void on_summary(void const *udata)
+{
+	table_data_t const *data = udata;
+
+	notice("`%u' chunks synced; `%u' repaired; `%u' read while dirty;"
+	    " `%u' refused", data->synced, data->repaired, data->peeked,
+	    data->refused);
+}
+
+static ratt_test_hook_t test_table_mmap_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_table_mmap_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_table_mmap(void)
+{
+	ratt_module_register(&module_entry);
+}
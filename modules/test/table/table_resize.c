@@ -42,10 +42,13 @@
 
 #define TABLESIZ	1	/* table initial size */
 #define TABLEINS	10000000	/* expected insertions count */
+#define TABLEKEEP	1000	/* chunks kept by the shrinking table */
 
 typedef struct {
 	size_t insert;		/* number of insertions */
 	size_t size;		/* final size of table */
+	size_t reserved;	/* size of reserved table once filled */
+	size_t shrunk;		/* size of reserved table once emptied */
 } table_data_t;
 
 static table_data_t l_table_data = { 0 };
@@ -69,14 +72,18 @@ static int on_expect(ratt_test_data_t *test)
 	retval = ratt_test_get_retval(test);
 	if (retval == OK) {
 		data = ratt_test_get_udata(test);
-		if (data->insert == TABLEINS) {
+		if (data->insert == TABLEINS
+		    && data->reserved == TABLEINS
+		    && data->shrunk <= TABLEINS / RATTTABSHRRATIO) {
 			/* table holds TABLEINS chunks, good. */
 			return OK;
 		}
 	}
 
 	/*
-	 * table should have had room for inserting TABLEINS chunks.
+	 * table should have had room for inserting TABLEINS chunks; a
+	 * reserved table should not have grown past its reserve and
+	 * should have shrunk back once emptied from its tail.
 	 */
 
 	return FAIL;
@@ -104,8 +111,30 @@ static int on_run(void *udata)
 	data->size = ratt_table_size(&mytable);
 
 	ratt_table_destroy(&mytable);
+	if (retval != OK)
+		return retval;
+
+	ratt_table_create(&mytable, TABLESIZ, sizeof(int), RATTTABFLSHR);
+	retval = ratt_table_reserve(&mytable, TABLEINS);
+	if (retval != OK) {
+		debug("ratt_table_reserve() failed");
+		ratt_table_destroy(&mytable);
+		return FAIL;
+	}
+
+	for (insert = 0; insert < TABLEINS; ++insert)
+		ratt_table_push(&mytable, &insert);
+	data->reserved = ratt_table_size(&mytable);
+
+	while (ratt_table_count(&mytable) > TABLEKEEP) {
+		ratt_table_last(&mytable);
+		ratt_table_del_current(&mytable);
+	}
+	data->shrunk = ratt_table_size(&mytable);
 
-	return retval;
+	ratt_table_destroy(&mytable);
+
+	return OK;
 }
 
 static void on_summary(void const *udata)
@@ -114,6 +143,8 @@ static void on_summary(void const *udata)
 
 	notice("initial size of `%u'; final size of `%u'; `%u' insertions",
 	    TABLESIZ, data->size, data->insert);
+	notice("reserved size of `%u'; `%u' once emptied to `%u' chunks",
+	    data->reserved, data->shrunk, TABLEKEEP);
 }
 
 static ratt_test_hook_t test_table_resize_hook = {
@@ -0,0 +1,414 @@
+/*
+ * RATTLE table scan test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/table.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_table_scan"
+#define MODULE_DESC	"table bulk scans"
+#define MODULE_VERSION	"0.1"
+
+#define SCANKEYS	11	/* distinct keys */
+#define SCANPATS	5	/* deletion patterns */
+#define SCANLAYS	3	/* grown, reserved, segmented */
+
+/*
+ * Tables of bare keys are scanned with SIMD key masks where the CPU has
+ * them; the same keys padded with a sequence are scanned one chunk at a
+ * time.  Both must agree with a plain walk, whatever the length of the
+ * table and wherever its fragments are.
+ */
+static size_t const l_scan_len[] = {
+	1, 5, 63, 64, 65, 127, 129, 200, 1031
+};
+
+#define SCANLENS	(sizeof(l_scan_len) / sizeof(l_scan_len[0]))
+#define SCANSETS	(SCANLENS * SCANPATS * (2 * SCANLAYS + 1))
+
+typedef struct {
+	uint32_t key;		/* chunk key */
+	uint32_t seq;		/* padding, scanned one chunk at a time */
+} scan_chunk32_t;
+
+typedef struct {
+	uint64_t key;		/* chunk key */
+	uint64_t seq;		/* padding, scanned one chunk at a time */
+} scan_chunk64_t;
+
+typedef struct {
+	size_t sets;		/* tables scanned */
+	size_t finds;		/* keys looked up */
+	size_t mismatch;	/* scans disagreeing with a walk */
+} table_data_t;
+
+static table_data_t l_table_data = { 0, 0, 0 };
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_table_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	table_data_t *data = NULL;
+	int retval;
+
+	retval = ratt_test_get_retval(test);
+	if (retval == OK) {
+		data = ratt_test_get_udata(test);
+		if (data->sets == SCANSETS && !data->mismatch)
+			return OK;
+	}
+
+	/*
+	 * every table should have been built and scanned, and every find
+	 * and count should have agreed with walking the table.
+	 */
+
+	return FAIL;
+}
+
+/* 64 bits keys share their low half so both halves must be compared */
+static uint64_t scan_key(size_t width, size_t pos)
+{
+	uint64_t key = (pos * 7) % SCANKEYS;
+
+	if (width == sizeof(uint64_t))
+		key |= (uint64_t) (pos % 3) << 32;
+	return key;
+}
+
+static uint64_t chunk_key(size_t width, void const *chunk)
+{
+	if (width == sizeof(uint64_t))
+		return *(uint64_t const *) chunk;
+	return *(uint32_t const *) chunk;
+}
+
+static int scan_deleted(int pattern, size_t len, size_t pos)
+{
+	switch (pattern) {
+	case 1:	/* head run */
+		return (pos <= len / 3);
+	case 2:	/* tail run */
+		return (pos + len / 3 >= len - 1);
+	case 3:	/* sparse */
+		return (pos % 3 == 1);
+	case 4:	/* whole words, but a few chunks */
+		return (!((pos / 64) % 2) && pos % 5);
+	}
+	return 0;
+}
+
+static int compare_u32(void const *in, void const *find)
+{
+	return (*(uint32_t const *) in == *(uint64_t const *) find)
+	    ? MATCH : NOMATCH;
+}
+
+static int compare_u64(void const *in, void const *find)
+{
+	return (*(uint64_t const *) in == *(uint64_t const *) find)
+	    ? MATCH : NOMATCH;
+}
+
+static int order_u32(void const *a, void const *b)
+{
+	uint32_t const *a_key = a;
+	uint32_t const *b_key = b;
+
+	if (*a_key != *b_key)
+		return (*a_key < *b_key) ? -1 : 1;
+	return 0;
+}
+
+static int scan_fill(ratt_table_t *table, size_t width, size_t size,
+                     int layout, size_t len, int pattern)
+{
+	union {
+		scan_chunk32_t c32;
+		scan_chunk64_t c64;
+	} chunk;
+	size_t pos, cnt = 4;
+	void *found = NULL;
+	int flags = 0;
+
+	if (layout == 1)	/* tail words are scanned in place */
+		cnt = len + 64;
+	else if (layout == 2)
+		flags = RATTTABFLSEG;
+
+	if (ratt_table_create(table, cnt, size, flags) != OK) {
+		debug("ratt_table_create() failed");
+		return FAIL;
+	}
+
+	for (pos = 0; pos < len; ++pos) {
+		if (width == sizeof(uint64_t)) {
+			chunk.c64.key = scan_key(width, pos);
+			chunk.c64.seq = pos;
+		} else {
+			chunk.c32.key = scan_key(width, pos);
+			chunk.c32.seq = pos;
+		}
+		if (ratt_table_push(table, &chunk) != OK) {
+			debug("ratt_table_push() failed");
+			ratt_table_destroy(table);
+			return FAIL;
+		}
+	}
+
+	RATT_TABLE_FOREACH(table, found) {
+		if (scan_deleted(pattern, len,
+		    ratt_table_pos_current(table)))
+			ratt_table_del_current(table);
+	}
+
+	return OK;
+}
+
+/* first position holding value and number of chunks holding it */
+static size_t scan_walk(ratt_table_t *table, size_t width, uint64_t value,
+                        size_t *cnt)
+{
+	size_t first = (size_t) -1;
+	void *chunk = NULL;
+
+	*cnt = 0;
+	RATT_TABLE_FOREACH(table, chunk) {
+		if (chunk_key(width, chunk) != value)
+			continue;
+		if (!*cnt)
+			first = ratt_table_pos_current(table);
+		(*cnt)++;
+	}
+	return first;
+}
+
+static size_t scan_find(ratt_table_t *table, size_t width, uint64_t value)
+{
+	void *chunk = NULL;
+	int retval;
+
+	if (width == sizeof(uint64_t))
+		retval = ratt_table_find_u64(table, &chunk, 0, value);
+	else
+		retval = ratt_table_find_u32(table, &chunk, 0,
+		    (uint32_t) value);
+
+	if (retval != OK)
+		return (chunk) ? (size_t) -2 : (size_t) -1;
+	if (chunk_key(width, chunk) != value)
+		return (size_t) -2;
+	return ratt_table_pos_current(table);
+}
+
+/* every key, and keys differing in their high half only */
+static void scan_compare(table_data_t *data, ratt_table_t *bare,
+                         ratt_table_t *padded, size_t width)
+{
+	int (*compare)(void const *, void const *) = compare_u32;
+	size_t first, cnt;
+	uint64_t key, value;
+	int high, highs = 1;
+
+	if (width == sizeof(uint64_t)) {
+		compare = compare_u64;
+		highs = 4;
+	}
+
+	for (key = 0; key <= SCANKEYS; ++key)
+		for (high = 0; high < highs; ++high) {
+			value = key | ((width == sizeof(uint64_t))
+			    ? (uint64_t) high << 32 : 0);
+			first = scan_walk(bare, width, value, &cnt);
+			data->finds++;
+
+			if (scan_find(bare, width, value) != first
+			    || (padded && scan_find(padded, width, value)
+			    != first)
+			    || ratt_table_count_if(bare, compare, &value)
+			    != cnt
+			    || (padded && ratt_table_count_if(padded,
+			    compare, &value) != cnt)) {
+				debug("key %llx: scans disagree with a walk",
+				    (unsigned long long) value);
+				data->mismatch++;
+			}
+		}
+}
+
+static int scan_layouts(table_data_t *data, size_t len, int pattern)
+{
+	ratt_table_t bare = { 0 }, padded = { 0 };
+	size_t width;
+	int layout;
+
+	for (width = sizeof(uint32_t); width <= sizeof(uint64_t);
+	    width *= 2)
+		for (layout = 0; layout < SCANLAYS; ++layout) {
+			if (scan_fill(&bare, width, width, layout,
+			    len, pattern) != OK)
+				return FAIL;
+			if (scan_fill(&padded, width, 2 * width, layout,
+			    len, pattern) != OK) {
+				ratt_table_destroy(&bare);
+				return FAIL;
+			}
+
+			scan_compare(data, &bare, &padded, width);
+			data->sets++;
+
+			ratt_table_destroy(&padded);
+			ratt_table_destroy(&bare);
+		}
+
+	return OK;
+}
+
+/* sorted tables compact by sliding runs of live chunks down */
+static int scan_compacted(table_data_t *data, size_t len, int pattern)
+{
+	ratt_table_t sorted = { 0 };
+	uint32_t *chunk = NULL, *prev = NULL;
+	size_t cnt, deleted = 0, left = 0;
+
+	if (scan_fill(&sorted, sizeof(uint32_t), sizeof(uint32_t), 0,
+	    len, pattern) != OK)
+		return FAIL;
+
+	if (ratt_table_set_order(&sorted, order_u32) != OK) {
+		debug("ratt_table_set_order() failed");
+		ratt_table_destroy(&sorted);
+		return FAIL;
+	}
+
+	/* fragment it again, now across runs of equal keys */
+	cnt = ratt_table_count(&sorted);
+	RATT_TABLE_FOREACH(&sorted, chunk) {
+		if (scan_deleted(pattern, cnt,
+		    ratt_table_pos_current(&sorted))) {
+			ratt_table_del_current(&sorted);
+			deleted++;
+		}
+	}
+
+	if (ratt_table_compact(&sorted) != OK) {
+		debug("ratt_table_compact() failed");
+		ratt_table_destroy(&sorted);
+		return FAIL;
+	}
+
+	RATT_TABLE_FOREACH(&sorted, chunk) {
+		if (prev && *prev > *chunk)
+			data->mismatch++;
+		prev = chunk;
+		left++;
+	}
+
+	/* no fragment left, every chunk kept, still in order */
+	if (ratt_table_fragmented(&sorted) || left + deleted != cnt
+	    || left != ratt_table_count(&sorted)
+	    || (left && ratt_table_pos_last(&sorted) + 1 != left)) {
+		debug("compaction lost chunks or left fragments");
+		data->mismatch++;
+	}
+
+	scan_compare(data, &sorted, NULL, sizeof(uint32_t));
+	data->sets++;
+
+	ratt_table_destroy(&sorted);
+	return OK;
+}
+
+static int on_run(void *udata)
+{
+	table_data_t *data = udata;
+	size_t i;
+	int pattern;
+
+	for (i = 0; i < SCANLENS; ++i)
+		for (pattern = 0; pattern < SCANPATS; ++pattern) {
+			if (scan_layouts(data, l_scan_len[i], pattern) != OK
+			    || scan_compacted(data, l_scan_len[i],
+			    pattern) != OK)
+				return FAIL;
+		}
+
+	return OK;
+}
+
+static void on_summary(void const *udata)
+{
+	table_data_t const *data = udata;
+
+	notice("`%u' tables scanned for `%u' keys; `%u' mismatches",
+	    data->sets, data->finds, data->mismatch);
+}
+
+static ratt_test_hook_t test_table_scan_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_table_scan_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_table_scan(void)
+{
+	ratt_module_register(&module_entry);
+}
@@ -0,0 +1,199 @@
+/*
+ * RATTLE sorted table test
+ * Copyright (c) 2012, Jamael Seun
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+
+#include <rattle/def.h>
+#include <rattle/log.h>
+#include <rattle/module.h>
+#include <rattle/table.h>
+#include <rattle/test.h>
+
+#define MODULE_NAME	RATT_TEST "_table_sort"
+#define MODULE_DESC	"sorted table"
+#define MODULE_VERSION	"0.1"
+
+#define TABLESIZ	4	/* table initial size */
+#define TABLEINS	1000	/* chunks inserted */
+#define TABLEKEYS	100	/* distinct keys */
+
+typedef struct {
+	size_t key;		/* chunk key */
+	size_t seq;		/* insertion sequence */
+} table_chunk_t;
+
+typedef struct {
+	size_t sorted;		/* chunks walked in order */
+	size_t found;		/* keys found back */
+} table_data_t;
+
+static table_data_t l_table_data = { 0, 0 };
+
+static int on_register(ratt_test_data_t *test)
+{
+	ratt_test_set_udata(test, &l_table_data);
+	return OK;
+}
+
+static void on_unregister(void *udata)
+{
+	/* empty */
+}
+
+static int on_expect(ratt_test_data_t *test)
+{
+	table_data_t *data = NULL;
+	int retval;
+
+	retval = ratt_test_get_retval(test);
+	if (retval == OK) {
+		data = ratt_test_get_udata(test);
+		if (data->sorted == TABLEINS - TABLEINS / 2
+		    && data->found == TABLEKEYS / 2)
+			return OK;
+	}
+
+	/*
+	 * every other chunk is deleted: the chunks left should walk in key
+	 * then insertion order and only odd keys should be found back.
+	 */
+
+	return FAIL;
+}
+
+static int order_chunk(void const *a, void const *b)
+{
+	table_chunk_t const *a_chunk = a;
+	table_chunk_t const *b_chunk = b;
+
+	if (a_chunk->key != b_chunk->key)
+		return (a_chunk->key < b_chunk->key) ? -1 : 1;
+	return 0;
+}
+
+static int order_key(void const *in, void const *find)
+{
+	table_chunk_t const *chunk = in;
+	size_t const *key = find;
+
+	if (chunk->key != *key)
+		return (chunk->key < *key) ? -1 : 1;
+	return 0;
+}
+
+static int on_run(void *udata)
+{
+	table_data_t *data = udata;
+	ratt_table_t mytable;
+	table_chunk_t chunk = { 0 }, *found = NULL, *prev = NULL;
+	size_t i;
+	int retval;
+
+	retval = ratt_table_create(&mytable, TABLESIZ,
+	    sizeof(table_chunk_t), 0);
+	if (retval != OK) {
+		debug("ratt_table_create() failed");
+		return FAIL;
+	}
+
+	retval = ratt_table_set_order(&mytable, order_chunk);
+	if (retval != OK) {
+		debug("ratt_table_set_order() failed");
+		ratt_table_destroy(&mytable);
+		return FAIL;
+	}
+
+	/* keys go in scrambled, even sequences get deleted */
+	for (i = 0; i < TABLEINS; ++i) {
+		chunk.key = (i * 37) % TABLEKEYS;
+		chunk.seq = i;
+		if (ratt_table_insert(&mytable, &chunk) != OK)
+			break;
+	}
+
+	RATT_TABLE_FOREACH(&mytable, found) {
+		if (!(found->seq % 2))
+			ratt_table_del_current(&mytable);
+	}
+
+	RATT_TABLE_FOREACH(&mytable, found) {
+		if (prev && (prev->key > found->key
+		    || (prev->key == found->key && prev->seq > found->seq)))
+			break;
+		prev = found;
+		data->sorted++;
+	}
+
+	for (i = 0; i < TABLEKEYS; ++i) {
+		retval = ratt_table_bsearch(&mytable, (void **) &found,
+		    order_key, &i);
+		if (retval == OK && found->key == i && (i % 2))
+			data->found++;
+	}
+
+	ratt_table_destroy(&mytable);
+
+	return OK;
+}
+
+static void on_summary(void const *udata)
+{
+	table_data_t const *data = udata;
+
+	notice("`%u' chunks walked in order; `%u' keys found back",
+	    data->sorted, data->found);
+}
+
+static ratt_test_hook_t test_table_sort_hook = {
+	.on_register = &on_register,
+	.on_unregister = &on_unregister,
+	.on_run = &on_run,
+	.on_expect = &on_expect,
+	.on_summary = &on_summary,
+};
+
+static void *attach_hook(ratt_module_parent_t const *parinfo)
+{
+	return &test_table_sort_hook;
+}
+
+static ratt_module_entry_t module_entry = {
+	.name = MODULE_NAME,
+	.desc = MODULE_DESC,
+	.version = MODULE_VERSION,
+	.attach = &attach_hook,
+};
+
+void test_table_sort(void)
+{
+	ratt_module_register(&module_entry);
+}
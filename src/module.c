@@ -38,6 +38,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <rattle/alloc.h>
 #include <rattle/data.h>
 #include <rattle/debug.h>
 
@@ -130,6 +131,7 @@ static int sort_module_name(void const *a, void const *b)
 	return strcmp((*a_entry)->name, (*b_entry)->name);
 }
 
+/* entries stay put, hooks point at them; sort a list of pointers */
 static ratt_module_entry_t **sort_modules(void)
 {
 	ratt_module_entry_t **list = NULL, **p = NULL;
@@ -226,7 +228,40 @@ static int constrains_on_module(void const *in, void const *find)
 	return compare_module_name(in, module->name);
 }
 
-static int compare_hook_module_name(void const *in, void const *find)
+static void const *key_core_name(void const *in)
+{
+	ratt_module_core_t const * const *core = in;
+
+	OOPS(core);
+	OOPS(*core);
+
+	return (*core)->name;
+}
+
+static void const *key_module_name(void const *in)
+{
+	ratt_module_entry_t const *module = in;
+
+	OOPS(module);
+
+	return module->name;
+}
+
+/* core and module tables are indexed by name */
+static ratt_table_hash_t const l_cortab_hash = {
+	.key = key_core_name,
+	.hash = ratt_table_hash_string,
+	.compare = compare_core_name,
+};
+
+static ratt_table_hash_t const l_modtab_hash = {
+	.key = key_module_name,
+	.hash = ratt_table_hash_string,
+	.compare = compare_module_name,
+};
+
+/* hook tables are sorted by module name */
+static int order_hook_module_key(void const *in, void const *find)
 {
 	ratt_module_hook_t const *hookinfo = in;
 	char const *name = find;
@@ -236,7 +271,17 @@ static int compare_hook_module_name(void const *in, void const *find)
 	OOPS(hookinfo->module->name);
 	OOPS(name);
 
-	return (strcmp(hookinfo->module->name, name)) ? NOMATCH : MATCH;
+	return strcmp(hookinfo->module->name, name);
+}
+
+static int order_hook_module_name(void const *a, void const *b)
+{
+	ratt_module_hook_t const *b_hookinfo = b;
+
+	OOPS(b_hookinfo);
+	OOPS(b_hookinfo->module);
+
+	return order_hook_module_key(a, b_hookinfo->module->name);
 }
 
 
@@ -249,10 +294,10 @@ static int create_module_table()
 {
 	int retval;
 
-	retval = ratt_table_create(&l_modtab,
-	    MODULE_MODTABSIZ, sizeof(ratt_module_entry_t), 0);
+	retval = ratt_table_create_hashed(&l_modtab, MODULE_MODTABSIZ,
+	    sizeof(ratt_module_entry_t), RATTTABFLSEG, &l_modtab_hash);
 	if (retval != OK) {
-		debug("ratt_table_create() failed");
+		debug("ratt_table_create_hashed() failed");
 		return FAIL;
 	}
 	ratt_table_set_constrains(&l_modtab, constrains_on_module);
@@ -268,10 +313,10 @@ static int create_core_table()
 {
 	int retval;
 
-	retval = ratt_table_create(&l_cortab,
-	    MODULE_CORTABSIZ, sizeof(ratt_module_core_t *), 0);
+	retval = ratt_table_create_hashed(&l_cortab, MODULE_CORTABSIZ,
+	    sizeof(ratt_module_core_t *), 0, &l_cortab_hash);
 	if (retval != OK) {
-		debug("ratt_table_create() failed");
+		debug("ratt_table_create_hashed() failed");
 		return FAIL;
 	}
 	ratt_table_set_constrains(&l_cortab, constrains_on_core);
@@ -286,13 +331,15 @@ static void detach_module(ratt_module_entry_t *entry)
 
 	if (entry->core) {
 		OOPS(entry->core);
-		ratt_table_search(entry->core->hook_table, (void **) &hookinfo,
-		    compare_hook_module_name, entry->name);
+		ratt_table_bsearch(entry->core->hook_table, (void **) &hookinfo,
+		    order_hook_module_key, entry->name);
 		if (!hookinfo) {
 			debug("hook for `%s' not found", entry->name);
 		} else {
 			debug("removing hook to '%s'", entry->name);
-			free(hookinfo->hook);
+			ratt_mem_free(
+			    ratt_table_allocator(entry->core->hook_table),
+			    hookinfo->hook, entry->core->hook_size);
 			ratt_table_del_current(entry->core->hook_table);
 		}
 		if (entry->core->detach)
@@ -309,6 +356,7 @@ attach_module(
     ratt_module_entry_t *module)
 {
 	ratt_module_hook_t hookinfo = { 0 };
+	ratt_alloc_t const *alloc = NULL;
 	int retval;
 
 	OOPS(core);
@@ -339,7 +387,8 @@ attach_module(
 		}
 	}
 						/* get module hook */
-	hookinfo.hook = calloc(1, core->hook_size);
+	alloc = ratt_table_allocator(core->hook_table);
+	hookinfo.hook = ratt_mem_calloc(alloc, 1, core->hook_size);
 	if (!hookinfo.hook) {
 		debug("calloc() failed");
 		if (module->config)
@@ -350,7 +399,7 @@ attach_module(
 	retval = module->attach(core, &hookinfo);
 	if (retval != OK) {
 		debug("module `%s' chose not to attach", module->name);
-		free(hookinfo.hook);
+		ratt_mem_free(alloc, hookinfo.hook, core->hook_size);
 		if (module->config)
 			conf_release(module->config);
 		return FAIL;
@@ -359,7 +408,7 @@ attach_module(
 		    hookinfo.version, core->ver_major);
 		if (module->detach)
 			module->detach();
-		free(hookinfo.hook);
+		ratt_mem_free(alloc, hookinfo.hook, core->hook_size);
 		if (module->config)
 			conf_release(module->config);
 		return FAIL;
@@ -371,7 +420,7 @@ attach_module(
 			debug("core->attach() failed");
 			if (module->detach)
 				module->detach();
-			free(hookinfo.hook);
+			ratt_mem_free(alloc, hookinfo.hook, core->hook_size);
 			if (module->config)
 				conf_release(module->config);
 			return FAIL;
@@ -386,7 +435,7 @@ attach_module(
 			core->detach(module);
 		if (module->detach)
 			module->detach();
-		free(hookinfo.hook);
+		ratt_mem_free(alloc, hookinfo.hook, core->hook_size);
 		if (module->config)
 			conf_release(module->config);
 		return FAIL;
@@ -427,6 +476,7 @@ int module_core_detach(char const *corname)
 	RATTLOG_TRACE();
 	ratt_module_core_t **core = NULL;
 	ratt_module_entry_t *entry = NULL;
+	ratt_alloc_t const *alloc = NULL;
 
 	OOPS(corname);
 						/* search core */
@@ -445,8 +495,11 @@ int module_core_detach(char const *corname)
 		}
 	}
 						/* delete core */
-	ratt_table_del_current(&l_cortab);
+	alloc = ratt_table_allocator((*core)->hook_table);
 	ratt_table_destroy((*core)->hook_table);
+	/* a later attach goes on the same allocator */
+	ratt_table_set_allocator((*core)->hook_table, alloc);
+	ratt_table_del_current(&l_cortab);	/* clears *core */
 	return OK;
 }
 
@@ -465,10 +518,20 @@ int module_core_attach(ratt_module_core_t const *core)
 		hook_table_flags = RATTTABFLNRA;
 	}
 
-	retval = ratt_table_create(core->hook_table,
-	    hook_table_size, sizeof(void *), hook_table_flags);
+	/* hooks come from the allocator the core left on its hook table */
+	retval = ratt_table_create_alloc(core->hook_table, hook_table_size,
+	    sizeof(ratt_module_hook_t), hook_table_flags,
+	    ratt_table_allocator(core->hook_table));
+	if (retval != OK) {
+		debug("ratt_table_create_alloc() failed");
+		return FAIL;
+	}
+
+	retval = ratt_table_set_order(core->hook_table,
+	    order_hook_module_name);
 	if (retval != OK) {
-		debug("ratt_table_create() failed");
+		debug("ratt_table_set_order() failed");
+		ratt_table_destroy(core->hook_table);
 		return FAIL;
 	}
 